@@ -0,0 +1,108 @@
+#pragma once
+#include <easylogging++.h>
+#include "graph/ComputationGraph.h"
+#include "memory/Workspace.h"
+
+namespace nnet {
+namespace api {
+enum ActivationType { kSigmoid, kSoftmax };
+
+inline const char* toString(ActivationType act) {
+  switch (act) {
+    case kSigmoid:
+      return "sigmoid";
+    case kSoftmax:
+      return "softmax";
+    default:
+      LOG(FATAL) << "Not supported act " << act;
+  }
+}
+
+class GraphBuilder {
+ public:
+  explicit inline GraphBuilder(memory::Workspace& workspace, graph::Graph* g) : graph_(g), workspace_(workspace) {}
+
+  void addOp(const std::string& type, const SmallVec<graph::VariableAttrPtr>& inputs,
+             const SmallVec<graph::VariableAttrPtr>& outputs,
+             const Map<std::string, Any>& attrs = Map<std::string, Any>()) {
+    this->graph_->ops_.emplace_back();
+    graph::Op& op = this->graph_->ops_.back();
+    op.type_ = type;
+    op.attrs_ = attrs;
+    op.inputs_ = inputs;
+    op.outputs_ = outputs;
+    graph::OpMeta& meta = graph::OpMeta::gAllOpMeta_[op.type_];
+    meta.shapeInferer_(inputs, outputs);
+    meta.checkAttrs(&op.attrs_);
+  }
+
+  graph::VariableAttrPtr crossEntropy(const std::string& paramPrefix, graph::VariableAttrPtr input,
+                                      graph::VariableAttrPtr label) {
+    auto loss = graph_->createOrResizeVar(paramPrefix + ".output", {0}, true, graph::kFLOAT32);
+    addOp("cross_entropy", {input, label}, {loss});
+    return loss;
+  }
+
+  graph::VariableAttrPtr errorRate(const std::string& paramPrefix, graph::VariableAttrPtr prediction,
+                                   graph::VariableAttrPtr label) {
+    auto errorRate = graph_->createOrResizeVar(paramPrefix, {0}, false, graph::kFLOAT32);
+    addOp("error_rate", {prediction, label}, {errorRate});
+    return errorRate;
+  }
+
+  graph::VariableAttrPtr mean(const std::string& paramPrefix, graph::VariableAttrPtr input) {
+    auto mean = graph_->createOrResizeVar(paramPrefix + ".output", {0}, true, graph::kFLOAT32);
+    addOp("mean", {input}, {mean});
+    return mean;
+  }
+
+  graph::VariableAttrPtr fullyConnected(const std::string& paramPrefix, graph::VariableAttrPtr input, size_t size,
+                                        bool withBias = true, const ActivationType& act = kSigmoid,
+                                        bool allocParam = true) {
+    CHECK_EQ(input->dims_.size(), 2UL);
+    auto layerWidth = input->dims_[1];
+
+    auto paramVar =
+        graph_->createOrResizeVar(paramPrefix + ".param.weight.0", {layerWidth, size}, true, graph::kFLOAT32);
+    workspace_(paramVar);
+    SmallVec<graph::VariableAttrPtr> inputs = {input, paramVar, nullptr};
+    if (withBias) {
+      auto biasVar = graph_->createOrResizeVar(paramPrefix + ".param.bias", {size, 1}, true, graph::kFLOAT32);
+      workspace_(biasVar);
+      inputs.back() = biasVar;
+    }
+
+    auto fcOpOut = graph_->createOrResizeVar(paramPrefix + "fc.output", {0}, true, graph::kFLOAT32);
+
+    addOp("fc", inputs, {fcOpOut});
+
+    auto finalOutput = graph_->createOrResizeVar(paramPrefix + ".output", {0}, true, graph::kFLOAT32);
+
+    addOp(toString(act), {fcOpOut}, {finalOutput});
+    return finalOutput;
+  }
+
+  // Look up a row of an embedding table per word. Its gradient is row-sparse, the optimizer only updates the rows of
+  // the words in the batch.
+  graph::VariableAttrPtr lookupTable(const std::string& paramPrefix, graph::VariableAttrPtr words, size_t numWords,
+                                     size_t size) {
+    auto tableVar = graph_->createOrResizeVar(paramPrefix + ".param.table", {numWords, size}, true, graph::kFLOAT32);
+    workspace_(tableVar);
+    auto output = graph_->createOrResizeVar(paramPrefix + ".output", {0}, true, graph::kFLOAT32);
+    addOp("lookup_table", {words, tableVar}, {output});
+    return output;
+  }
+
+  // backward
+  void backward(graph::VariableAttrPtr loss) {
+    Map<std::string, Any> attrs;
+    attrs.insert({"loss_name", loss->name_});
+    graph::compileGraph(graph_, {"backward"}, attrs);
+  };
+
+ private:
+  graph::Graph* graph_;
+  memory::Workspace& workspace_;
+};
+}
+}
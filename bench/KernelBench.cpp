@@ -0,0 +1,436 @@
+// Micro-benchmark every registered CPU kernel over a sweep of shapes.
+// Usage: nnet_bench [--filter substr] [--threads N] [--warmup N] [--repeat N] [--json path]
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <json.hpp>
+#include <random>
+#include "graph/ComputationGraph.h"
+#include "memory/Workspace.h"
+#include "misc/Half.h"
+#include "misc/Int8.h"
+#include "misc/InitFunction.h"
+#include "misc/ThreadPool.h"
+#include "misc/VecMath.h"
+
+using nnet::SmallVec;
+using nnet::graph::Graph;
+using nnet::graph::Op;
+using nnet::graph::OpMeta;
+using nnet::graph::VariableAttrPtr;
+
+namespace {
+constexpr auto F = nnet::graph::kFLOAT32;
+constexpr auto I = nnet::graph::kINT32;
+
+// A benchmark case is an op built for a (batch, width) point of the sweep. The int inputs are randomized in
+// [0, maxIndex_), e.g. labels are class ids and words are row ids of the table.
+struct Case {
+  Op op_;
+  int maxIndex_;
+};
+using BuildCaseFN = std::function<Case(Graph* g, size_t batch, size_t width)>;
+
+VariableAttrPtr var(Graph* g, const std::string& name, const SmallVec<size_t>& dims,
+                    nnet::graph::VariableType type = F) {
+  return g->createOrResizeVar(name, dims, false, type);
+}
+
+VariableAttrPtr out(Graph* g, const std::string& name, nnet::graph::VariableType type = F) {
+  return var(g, name, {0}, type);
+}
+
+// How to build the inputs of each kernel. A kernel registered in OpMeta::gAllOpMeta_ without an entry here is
+// reported as skipped, so adding an op without a benchmark is noticed.
+const nnet::Map<std::string, BuildCaseFN>& cases() {
+  static nnet::Map<std::string, BuildCaseFN> cases{
+      {"fc",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         return {Op("fc", {var(g, "X", {b, w}), var(g, "W", {w, w}), var(g, "B", {w, 1})}, {out(g, "O")}), 0};
+       }},
+      {"fc_grad",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         return {Op("fc_grad", {var(g, "X", {b, w}), var(g, "W", {w, w}), var(g, "GO", {b, w})},
+                    {out(g, "GW"), out(g, "GX"), out(g, "GB")}),
+                 0};
+       }},
+      {"fc_bias_act",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         return {Op("fc_bias_act", {var(g, "X", {b, w}), var(g, "W", {w, w}), var(g, "B", {w, 1})}, {out(g, "O")}),
+                 0};
+       }},
+      {"fc_bias_act_grad",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         return {Op("fc_bias_act_grad",
+                    {var(g, "X", {b, w}), var(g, "W", {w, w}), var(g, "O", {b, w}), var(g, "GO", {b, w})},
+                    {out(g, "GW"), out(g, "GX"), out(g, "GB")}),
+                 0};
+       }},
+      {"softmax_cross_entropy",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         return {Op("softmax_cross_entropy", {var(g, "X", {b, w}), var(g, "Label", {b, 1}, I)},
+                    {out(g, "P"), out(g, "Loss")}),
+                 (int)w};
+       }},
+      {"softmax_cross_entropy_grad",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         return {Op("softmax_cross_entropy_grad",
+                    {var(g, "P", {b, w}), var(g, "Label", {b, 1}, I), var(g, "GO", {b, 1})}, {out(g, "GX")}),
+                 (int)w};
+       }},
+      {"sigmoid",
+       [](Graph* g, size_t b, size_t w) -> Case { return {Op("sigmoid", {var(g, "X", {b, w})}, {out(g, "O")}), 0}; }},
+      {"sigmoid_grad",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         return {Op("sigmoid_grad", {var(g, "O", {b, w}), var(g, "GO", {b, w})}, {out(g, "GX")}), 0};
+       }},
+      {"softmax",
+       [](Graph* g, size_t b, size_t w) -> Case { return {Op("softmax", {var(g, "X", {b, w})}, {out(g, "O")}), 0}; }},
+      {"softmax_grad",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         return {Op("softmax_grad", {var(g, "O", {b, w}), var(g, "GO", {b, w})}, {out(g, "GX")}), 0};
+       }},
+      {"cross_entropy",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         return {Op("cross_entropy", {var(g, "P", {b, w}), var(g, "Label", {b, 1}, I)}, {out(g, "Loss")}), (int)w};
+       }},
+      {"cross_entropy_grad",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         return {Op("cross_entropy_grad", {var(g, "P", {b, w}), var(g, "Label", {b, 1}, I), var(g, "GO", {b, 1})},
+                    {out(g, "GP")}),
+                 (int)w};
+       }},
+      {"error_rate",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         return {Op("error_rate", {var(g, "P", {b, w}), var(g, "Label", {b, 1}, I)}, {out(g, "Rate")}), (int)w};
+       }},
+      {"mean",
+       [](Graph* g, size_t b, size_t w) -> Case { return {Op("mean", {var(g, "X", {b, w})}, {out(g, "O")}), 0}; }},
+      {"mean_grad",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         return {Op("mean_grad", {var(g, "X", {b, w}), var(g, "GO", {1, 1})}, {out(g, "GX")}), 0};
+       }},
+      {"sgd",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         auto p = var(g, "P", {b, w});
+         return {Op("sgd", {p, var(g, "G", {b, w})}, {p}), 0};
+       }},
+      {"lookup_table",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         return {Op("lookup_table", {var(g, "Word", {b, 1}, I), var(g, "Table", {1000, w})}, {out(g, "O")}), 1000};
+       }},
+      {"lookup_table_grad",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         return {Op("lookup_table_grad", {var(g, "Word", {b, 1}, I), var(g, "GO", {b, w})},
+                    {out(g, "GW"), out(g, "Rows", I)}),
+                 1000};
+       }},
+      {"sparse_sgd",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         auto p = var(g, "Table", {1000, w});
+         return {Op("sparse_sgd", {p, var(g, "G", {b, w}), var(g, "Rows", {b, 1}, I)}, {p}), 1000};
+       }},
+      {"cast",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         return {Op("cast", {var(g, "X", {b, w})}, {out(g, "Y", nnet::graph::kBF16)}), 0};
+       }},
+      {"cast_grad",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         return {Op("cast_grad", {var(g, "GY", {b, w})}, {out(g, "GX")}), 0};
+       }},
+      {"fc_int8",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         auto packed = var(g, "W", {nnet::util::roundUp(w, 4), nnet::util::roundUp(w, 16)}, nnet::graph::kINT8);
+         return {Op("fc_int8", {var(g, "X", {b, w}), packed, var(g, "B", {w, 1}), var(g, "S", {w, 1}),
+                                var(g, "Sum", {w, 1}, I)},
+                    {out(g, "O")}),
+                 0};
+       }},
+      {"momentum",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         auto p = var(g, "P", {b, w}), v = var(g, "V", {b, w});
+         return {Op("momentum", {p, var(g, "G", {b, w}), v}, {p, v}), 0};
+       }},
+      {"sparse_momentum",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         auto p = var(g, "Table", {1000, w}), v = var(g, "V", {1000, w});
+         return {Op("sparse_momentum", {p, var(g, "G", {b, w}), var(g, "Rows", {b, 1}, I), v}, {p, v}), 1000};
+       }},
+      {"adagrad",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         auto p = var(g, "P", {b, w}), a = var(g, "A", {b, w});
+         return {Op("adagrad", {p, var(g, "G", {b, w}), a}, {p, a}), 0};
+       }},
+      {"sparse_adagrad",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         auto p = var(g, "Table", {1000, w}), a = var(g, "A", {1000, w});
+         return {Op("sparse_adagrad", {p, var(g, "G", {b, w}), var(g, "Rows", {b, 1}, I), a}, {p, a}), 1000};
+       }},
+      {"adam",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         auto p = var(g, "P", {b, w}), m = var(g, "M", {b, w}), v = var(g, "V", {b, w}), t = var(g, "Step", {1});
+         return {Op("adam", {p, var(g, "G", {b, w}), m, v, t}, {p, m, v, t}), 0};
+       }},
+      {"sparse_adam",
+       [](Graph* g, size_t b, size_t w) -> Case {
+         auto p = var(g, "Table", {1000, w}), m = var(g, "M", {1000, w}), v = var(g, "V", {1000, w});
+         auto t = var(g, "Step", {1});
+         return {Op("sparse_adam", {p, var(g, "G", {b, w}), var(g, "Rows", {b, 1}, I), m, v, t}, {p, m, v, t}), 1000};
+       }},
+  };
+  return cases;
+}
+
+struct Options {
+  std::string filter_;
+  std::string jsonPath_;
+  size_t threads_{1};
+  size_t warmUp_{3};
+  size_t repeat_{15};
+  double minSampleUs_{200};  // a sample runs the kernel in a loop for at least this long
+};
+
+struct Stats {
+  double minNs_, medianNs_, meanNs_, stddevNs_;
+};
+
+Stats computeStats(nnet::Vec<double> samples) {
+  std::sort(samples.begin(), samples.end());
+  Stats s;
+  s.minNs_ = samples.front();
+  s.medianNs_ = samples[samples.size() / 2];
+  s.meanNs_ = 0;
+  for (double v : samples) s.meanNs_ += v;
+  s.meanNs_ /= samples.size();
+  double var = 0;
+  for (double v : samples) var += (v - s.meanNs_) * (v - s.meanNs_);
+  s.stddevNs_ = std::sqrt(var / samples.size());
+  return s;
+}
+
+std::string toString(const SmallVec<VariableAttrPtr>& vars) {
+  std::string retv;
+  for (auto& v : vars) {
+    retv += retv.empty() ? "" : " ";
+    if (v == nullptr) {
+      retv += "null";
+      continue;
+    }
+    for (size_t i = 0; i < v->dims_.size(); ++i) {
+      retv += (i == 0 ? "" : "x") + std::to_string(v->dims_[i]);
+    }
+  }
+  return retv;
+}
+
+// Time run() in samples of iters calls, iters is calibrated so the clock resolution does not matter for tiny
+// kernels. Return the ns per call of each sample.
+nnet::Vec<double> sampleNs(const std::function<void()>& run, const Options& opt, size_t* iters) {
+  using Clock = std::chrono::steady_clock;
+  auto timeNs = [&](size_t n) {
+    auto begin = Clock::now();
+    for (size_t i = 0; i < n; ++i) {
+      run();
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - begin).count();
+  };
+  *iters = 1;
+  for (size_t i = 0; i < opt.warmUp_; ++i) {
+    double ns = timeNs(*iters);
+    while (ns < opt.minSampleUs_ * 1000 && *iters < (1UL << 20)) {
+      *iters *= 2;
+      ns = timeNs(*iters);
+    }
+  }
+  nnet::Vec<double> samples;
+  for (size_t i = 0; i < opt.repeat_; ++i) {
+    samples.push_back(timeNs(*iters) / *iters);
+  }
+  return samples;
+}
+
+// The default kernel of an op, or one of its cpuVariants_, e.g. fc.small.
+nlohmann::json benchCase(const std::string& type, const std::string& variant, size_t batch, size_t width,
+                         const Options& opt) {
+  Graph g;
+  nnet::memory::Workspace w;
+  Case c = cases().at(type)(&g, batch, width);
+  auto& meta = OpMeta::gAllOpMeta_.at(type);
+  auto attrs = meta.bindAttrs(c.op_.attrs_);
+  meta.shapeInferer_(c.op_.inputs_, c.op_.outputs_);
+
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<float> dist(0.01f, 1.0f);
+  SmallVec<nnet::graph::Variable> inputs, outputs;
+  for (auto& attr : c.op_.inputs_) {
+    inputs.push_back(w.getVar(attr));
+    size_t n = nnet::details::product(attr->dims_);
+    if (attr->type_ == I) {
+      int* buf = (int*)inputs.back().buffer_->get();
+      for (size_t i = 0; i < n; ++i) buf[i] = c.maxIndex_ == 0 ? 0 : (int)(gen() % c.maxIndex_);
+    } else if (attr->type_ == nnet::graph::kINT8) {
+      auto buf = (int8_t*)inputs.back().buffer_->get();
+      for (size_t i = 0; i < n; ++i) buf[i] = (int8_t)(gen() % 255 - 127);
+    } else if (nnet::graph::isHalf(attr->type_)) {
+      auto buf = (uint16_t*)inputs.back().buffer_->get();
+      bool bf16 = attr->type_ == nnet::graph::kBF16;
+      for (size_t i = 0; i < n; ++i) {
+        float v = dist(gen);
+        buf[i] = bf16 ? nnet::util::floatToBF16(v) : nnet::util::floatToFP16(v);
+      }
+    } else {
+      float* buf = (float*)inputs.back().buffer_->get();
+      for (size_t i = 0; i < n; ++i) buf[i] = dist(gen);
+    }
+  }
+  for (auto& attr : c.op_.outputs_) {
+    outputs.push_back(w.getVar(attr));
+  }
+
+  auto kernel = meta.kernels[nnet::graph::kDEVICE_CPU];
+  for (auto& v : meta.cpuVariants_) {
+    if (v.name_ == variant) kernel = v.kernel_;
+  }
+  size_t iters;
+  auto samples = sampleNs([&] { kernel(inputs, outputs, attrs); }, opt, &iters);
+  Stats s = computeStats(samples);
+  auto cost = meta.cost_(c.op_.inputs_, c.op_.outputs_);
+
+  nlohmann::json result;
+  result["op"] = variant == "default" ? type : type + "." + variant;
+  result["batch"] = batch;
+  result["width"] = width;
+  result["inputs"] = toString(c.op_.inputs_);
+  result["outputs"] = toString(c.op_.outputs_);
+  result["iterations"] = iters;
+  result["samples"] = samples.size();
+  result["ns_min"] = s.minNs_;
+  result["ns_median"] = s.medianNs_;
+  result["ns_mean"] = s.meanNs_;
+  result["ns_stddev"] = s.stddevNs_;
+  result["flops"] = cost.flops_;
+  result["bytes"] = cost.bytes_;
+  result["gflops"] = cost.flops_ / s.medianNs_;
+  result["gbps"] = cost.bytes_ / s.medianNs_;
+  return result;
+}
+
+// The vectorized math functions of each instruction set the CPU runs, e.g. vec_exp.avx2, over n floats in [-4, 4].
+nlohmann::json benchVecMath(nnet::util::SimdIsa isa, const std::string& function, size_t n, const Options& opt) {
+  auto& kernels = nnet::util::vecMathKernels(isa);
+  nnet::Map<std::string, nnet::util::VecMathFN> functions = {
+      {"exp", kernels.exp_}, {"log", kernels.log_}, {"tanh", kernels.tanh_}, {"sigmoid", kernels.sigmoid_}};
+  auto fn = functions.at(function);
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<float> dist(function == "log" ? 0.01f : -4.0f, 4.0f);
+  nnet::Vec<float> x(n), y(n);
+  for (auto& v : x) v = dist(gen);
+  size_t iters;
+  Stats s = computeStats(sampleNs([&] { fn(x.data(), y.data(), n); }, opt, &iters));
+  nlohmann::json result;
+  result["op"] = "vec_" + function + "." + nnet::util::simdIsaName(isa);
+  result["batch"] = 1;
+  result["width"] = n;
+  result["iterations"] = iters;
+  result["ns_min"] = s.minNs_;
+  result["ns_median"] = s.medianNs_;
+  result["ns_mean"] = s.meanNs_;
+  result["ns_stddev"] = s.stddevNs_;
+  result["flops"] = n;  // a function value per element
+  result["bytes"] = 2 * n * sizeof(float);
+  result["gflops"] = n / s.medianNs_;
+  result["gbps"] = 2 * n * sizeof(float) / s.medianNs_;
+  return result;
+}
+
+Options parseOptions(int argc, char** argv) {
+  Options opt;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    CHECK_LT(i + 1, argc) << arg << " needs a value";
+    std::string value = argv[++i];
+    if (arg == "--filter") {
+      opt.filter_ = value;
+    } else if (arg == "--json") {
+      opt.jsonPath_ = value;
+    } else if (arg == "--threads") {
+      opt.threads_ = std::stoul(value);
+    } else if (arg == "--warmup") {
+      opt.warmUp_ = std::stoul(value);
+    } else if (arg == "--repeat") {
+      opt.repeat_ = std::max(1UL, std::stoul(value));
+    } else {
+      LOG(FATAL) << "Unknown option " << arg;
+    }
+  }
+  return opt;
+}
+}
+
+int main(int argc, char** argv) {
+  nnet::util::InitFunction::apply();
+  Options opt = parseOptions(argc, argv);
+  const size_t batches[] = {32, 256};
+  const size_t widths[] = {64, 256, 1024};
+
+  std::unique_ptr<nnet::util::ThreadPool> pool;
+  if (opt.threads_ > 1) {
+    pool.reset(new nnet::util::ThreadPool(opt.threads_));
+  }
+  nnet::util::ThreadPool::Scope scope(pool.get());
+
+  nlohmann::json report;
+  report["threads"] = opt.threads_;
+  report["warmup"] = opt.warmUp_;
+  report["repeat"] = opt.repeat_;
+  report["compiler"] = __VERSION__;
+  report["results"] = nlohmann::json::array();
+  printf("%-24s %6s %6s %14s %10s %8s %10s %10s\n", "op", "batch", "width", "ns/op", "min", "stddev%", "GFLOP/s",
+         "GB/s");
+  auto print = [&](const nlohmann::json& r) {
+    double median = r["ns_median"];
+    double stddev = r["ns_stddev"];
+    printf("%-24s %6zu %6zu %14.1f %10.1f %7.1f%% %10.3f %10.3f\n", ((std::string)r["op"]).c_str(), (size_t)r["batch"],
+           (size_t)r["width"], median, (double)r["ns_min"], 100 * stddev / median, (double)r["gflops"],
+           (double)r["gbps"]);
+    fflush(stdout);
+    report["results"].push_back(r);
+  };
+  for (auto& item : OpMeta::gAllOpMeta_) {
+    auto& type = item.first;
+    if (!opt.filter_.empty() && type.find(opt.filter_) == std::string::npos) continue;
+    if (!item.second.kernels[nnet::graph::kDEVICE_CPU]) continue;
+    if (cases().find(type) == cases().end()) {
+      fprintf(stderr, "%-24s skipped, no benchmark case\n", type.c_str());
+      report["skipped"].push_back(type);
+      continue;
+    }
+    nnet::Vec<std::string> variants = {"default"};
+    for (auto& v : item.second.cpuVariants_) {
+      variants.push_back(v.name_);
+    }
+    for (auto& variant : variants) {
+      for (size_t batch : batches) {
+        for (size_t width : widths) {
+          print(benchCase(type, variant, batch, width, opt));
+        }
+      }
+    }
+  }
+  for (int isa = nnet::util::kISA_SCALAR; isa < nnet::util::kNUM_ISAS; ++isa) {
+    if (!nnet::util::hasSimdIsa((nnet::util::SimdIsa)isa)) continue;
+    for (auto function : {"exp", "log", "tanh", "sigmoid"}) {
+      std::string name = std::string("vec_") + function + "." + nnet::util::simdIsaName((nnet::util::SimdIsa)isa);
+      if (!opt.filter_.empty() && name.find(opt.filter_) == std::string::npos) continue;
+      print(benchVecMath((nnet::util::SimdIsa)isa, function, 4096, opt));
+    }
+  }
+  if (!opt.jsonPath_.empty()) {
+    std::ofstream fout(opt.jsonPath_);
+    CHECK(fout.good()) << "Cannot open " << opt.jsonPath_;
+    fout << report.dump(2) << std::endl;
+  }
+  return 0;
+}
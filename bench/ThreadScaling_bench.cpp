@@ -0,0 +1,68 @@
+// Measure how a training step of the MNIST MLP scales with the number of threads of the engine.
+// Usage: scaling_bench [maxThreads] [batchSize]
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include "api/GraphBuilder.h"
+#include "engine/Engine.h"
+#include "misc/CastEigen.h"
+#include "misc/InitFunction.h"
+
+static double timeTrainingStep(nnet::engine::Engine& engine, size_t repeat) {
+  using Clock = std::chrono::steady_clock;
+  auto begin = Clock::now();
+  for (size_t i = 0; i < repeat; ++i) {
+    engine.resetOrCreateGradient();
+    engine.run();
+  }
+  return std::chrono::duration<double, std::milli>(Clock::now() - begin).count() / repeat;
+}
+
+int main(int argc, char** argv) {
+  nnet::util::InitFunction::apply();
+  size_t maxThreads = argc > 1 ? std::stoul(argv[1]) : std::max(1U, std::thread::hardware_concurrency());
+  size_t batchSize = argc > 2 ? std::stoul(argv[2]) : 1000;
+  constexpr size_t kWarmUp = 3;
+  constexpr size_t kRepeat = 20;
+
+  nnet::graph::Graph g;
+  nnet::memory::Workspace w;
+  nnet::api::GraphBuilder builder(w, &g);
+  auto xVar = g.createOrResizeVar("X", {batchSize, 784}, false, nnet::graph::kFLOAT32);
+  auto hidden = builder.fullyConnected("fc1", xVar, 100, true);
+  hidden = builder.fullyConnected("fc2", hidden, 100, true);
+  auto prediction = builder.fullyConnected("prediction", hidden, 10, true, nnet::api::kSoftmax);
+  auto labelVar = g.createOrResizeVar("Label", {batchSize, 1}, false, nnet::graph::kINT32);
+  auto loss = builder.crossEntropy("xe_loss", prediction, labelVar);
+  builder.errorRate("error_rate", prediction, labelVar);
+  auto avgLoss = builder.mean("avg_loss", loss);
+  builder.backward(avgLoss);
+  nnet::graph::compileGraph(&g, {"optimizer"}, {{"optimizer", std::string("sgd")}, {"learning_rate", 0.01f}});
+
+  nnet::eigen::cast<nnet::eigen::Matrix>(w.getVar(xVar)).setRandom();
+  auto labels = (int*)w(labelVar)->get();
+  std::mt19937 gen;
+  for (size_t i = 0; i < batchSize; ++i) {
+    labels[i] = gen() % 10;
+  }
+
+  double base = 0;
+  printf("%-10s %-10s %-14s %-10s\n", "engine", "threads", "ms/step", "speedup");
+  for (auto type : {"naive", "threaded"}) {
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+      auto engine = nnet::engine::createEngine(type, w, g, threads);
+      engine->randomize();
+      timeTrainingStep(*engine, kWarmUp);
+      double ms = timeTrainingStep(*engine, kRepeat);
+      if (base == 0) {
+        base = ms;
+      }
+      printf("%-10s %-10zu %-14.3f %-10.2f\n", type, threads, ms, base / ms);
+      if (threads < maxThreads && threads * 2 > maxThreads) {
+        threads = maxThreads / 2;  // always measure maxThreads
+      }
+    }
+  }
+  return 0;
+}
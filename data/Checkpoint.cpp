@@ -0,0 +1,112 @@
+#include "Checkpoint.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include "MappedDataset.h"
+
+namespace nnet {
+namespace data {
+
+constexpr char CheckpointHeader::kMagic[8];
+
+static constexpr size_t kAlignment = 64;
+
+static size_t alignSize(size_t size) { return (size + kAlignment - 1) / kAlignment * kAlignment; }
+
+// The parameters and the optimizer states of the graph, sorted by name so a graph always writes the same file.
+static Vec<graph::VariableAttrPtr> params(const graph::Graph& g) {
+  Vec<graph::VariableAttrPtr> retv;
+  for (auto& item : g.variables_) {
+    if (graph::isParamName(item.first) || graph::isStateName(item.first)) {
+      retv.push_back(item.second);
+    }
+  }
+  std::sort(retv.begin(), retv.end(),
+            [](const graph::VariableAttrPtr& a, const graph::VariableAttrPtr& b) { return a->name_ < b->name_; });
+  return retv;
+}
+
+static void writeFile(const std::string& path, const char* data, size_t size) {
+  std::string tmpPath = path + ".tmp";
+  int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  CHECK_GE(fd, 0) << "Cannot open " << tmpPath << ": " << strerror(errno);
+  for (size_t done = 0; done < size;) {
+    ssize_t n = write(fd, data + done, size - done);
+    CHECK_GT(n, 0) << "Cannot write " << tmpPath << ": " << strerror(errno);
+    done += n;
+  }
+  CHECK_EQ(fsync(fd), 0) << "Cannot sync " << tmpPath << ": " << strerror(errno);
+  close(fd);
+  CHECK_EQ(rename(tmpPath.c_str(), path.c_str()), 0) << "Cannot rename " << tmpPath << ": " << strerror(errno);
+}
+
+std::future<void> saveCheckpoint(const graph::Graph& g, memory::Workspace& w, const std::string& path) {
+  auto vars = params(g);
+  Vec<CheckpointEntry> entries(vars.size());
+  size_t offset = alignSize(sizeof(CheckpointHeader) + entries.size() * sizeof(CheckpointEntry));
+  for (size_t i = 0; i < vars.size(); ++i) {
+    auto& var = *vars[i];
+    auto& e = entries[i];
+    CHECK_LT(var.name_.size(), sizeof(e.name_)) << "Name too long: " << var.name_;
+    CHECK_LE(var.dims_.size(), CheckpointEntry::kMaxDims) << var.name_;
+    std::memset(&e, 0, sizeof(e));
+    std::strcpy(e.name_, var.name_.c_str());
+    e.type_ = var.type_;
+    e.numDims_ = var.dims_.size();
+    std::copy(var.dims_.begin(), var.dims_.end(), e.dims_);
+    e.offset_ = offset;
+    e.bytes_ = var.bytes();
+    offset = alignSize(offset + e.bytes_);
+  }
+
+  // the snapshot is the image of the file, one memcpy per parameter.
+  auto snapshot = std::make_shared<memory::CpuVariableBuffer>(offset);
+  auto base = (char*)snapshot->get();
+  std::memset(base, 0, offset);
+  CheckpointHeader header;
+  std::memcpy(header.magic_, CheckpointHeader::kMagic, sizeof(header.magic_));
+  header.numVars_ = entries.size();
+  std::memcpy(base, &header, sizeof(header));
+  std::memcpy(base + sizeof(header), entries.data(), entries.size() * sizeof(CheckpointEntry));
+  for (size_t i = 0; i < vars.size(); ++i) {
+    auto buf = w.findBuffer(vars[i]->name_);
+    CHECK(buf != nullptr && buf->getSize() >= entries[i].bytes_) << vars[i]->name_ << " has no value";
+    std::memcpy(base + entries[i].offset_, buf->get(), entries[i].bytes_);
+  }
+  return std::async(std::launch::async, [snapshot, path] {
+    writeFile(path, (const char*)snapshot->get(), snapshot->getSize());
+    LOG(INFO) << "Save checkpoint " << path << ", " << snapshot->getSize() << " bytes";
+  });
+}
+
+void restoreCheckpoint(const graph::Graph& g, memory::Workspace& w, const std::string& path) {
+  size_t size;
+  char* base = (char*)mapFile(path, false, &size);
+  std::shared_ptr<char> mapping(base, [size](char* ptr) { munmap(ptr, size); });
+  CHECK_GE(size, sizeof(CheckpointHeader));
+  auto header = (const CheckpointHeader*)base;
+  CHECK_EQ(std::memcmp(header->magic_, CheckpointHeader::kMagic, sizeof(header->magic_)), 0)
+      << path << " is not a checkpoint";
+  CHECK_LE(sizeof(CheckpointHeader) + header->numVars_ * sizeof(CheckpointEntry), size) << path << " is truncated";
+  auto entries = (const CheckpointEntry*)(base + sizeof(CheckpointHeader));
+  Map<std::string, const CheckpointEntry*> byName;
+  for (size_t i = 0; i < header->numVars_; ++i) {
+    CHECK_LE(entries[i].offset_ + entries[i].bytes_, size) << path << " is truncated";
+    byName[entries[i].name_] = &entries[i];
+  }
+
+  for (auto& var : params(g)) {
+    auto it = byName.find(var->name_);
+    CHECK(it != byName.end()) << "No " << var->name_ << " in " << path;
+    auto& e = *it->second;
+    CHECK_EQ(e.type_, var->type_) << "Type mismatch of " << var->name_;
+    CHECK(e.numDims_ == var->dims_.size() && std::equal(var->dims_.begin(), var->dims_.end(), e.dims_))
+        << "Dims mismatch of " << var->name_;
+    w.setExternal(var->name_, mapping, base + e.offset_, e.bytes_);
+  }
+  LOG(INFO) << "Restore checkpoint " << path << ", " << header->numVars_ << " variables";
+}
+}
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+#include <future>
+#include "graph/ComputationGraph.h"
+#include "memory/Workspace.h"
+
+namespace nnet {
+namespace data {
+
+/**
+ * A checkpoint file holds the parameters of a workspace: the variables named .param, which include the optimizer
+ * states. It is a header, an entry per variable, and the values of the variables, each 64 bytes aligned. The file is
+ * laid out so it could be mapped and read in place.
+ */
+struct CheckpointHeader {
+  static constexpr char kMagic[8] = {'N', 'N', 'E', 'T', 'C', 'K', '0', '1'};
+  char magic_[8];
+  uint64_t numVars_;
+};
+
+struct CheckpointEntry {
+  static constexpr size_t kMaxDims = 4;
+  char name_[128];
+  uint64_t type_;  // graph::VariableType
+  uint64_t numDims_;
+  uint64_t dims_[kMaxDims];
+  uint64_t offset_;  // of the values, from the beginning of the file
+  uint64_t bytes_;
+};
+
+/**
+ * @brief saveCheckpoint write the parameters of the graph to a file in the background. The values are copied into a
+ * snapshot before returning, so the caller could go on training at once. The file is written to <path>.tmp and
+ * renamed when complete, a crash never leaves a partial checkpoint at path.
+ *
+ * The returned future is ready when the file is written. Like any future of std::async, destroying it waits for the
+ * write, keep it while training.
+ */
+std::future<void> saveCheckpoint(const graph::Graph& g, memory::Workspace& w, const std::string& path);
+
+/**
+ * @brief restoreCheckpoint load the parameters of the graph from a checkpoint. The file is mapped and the parameters
+ * read their values in place: pages are loaded when touched and copied by the kernel when updated, the file is never
+ * changed. Nothing is copied, restoring takes the same time for any model. Parameters are feeds of the plans, a plan
+ * compiled before is recompiled on the next run. Variables of the checkpoint not in the graph are ignored.
+ */
+void restoreCheckpoint(const graph::Graph& g, memory::Workspace& w, const std::string& path);
+}
+}
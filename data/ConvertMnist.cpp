@@ -0,0 +1,13 @@
+// Convert MNIST to dataset files, see data/MappedDataset.h.
+// Usage: nnet_convert_mnist [mnist dir] [output dir] [uint8]
+#include "data/Mnist.h"
+#include "misc/InitFunction.h"
+
+int main(int argc, char** argv) {
+  nnet::util::InitFunction::apply();
+  std::string mnistDir = argc > 1 ? argv[1] : "./3rdparty/mnist/";
+  std::string outDir = argc > 2 ? argv[2] : ".";
+  bool uint8 = argc > 3 && std::string(argv[3]) == "uint8";  // keep the pixels as bytes
+  nnet::data::convertMnist(mnistDir, outDir, uint8);
+  return 0;
+}
@@ -0,0 +1,125 @@
+#include "DataLoader.h"
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+namespace nnet {
+namespace data {
+
+DataLoader::DataLoader(const MappedDataset& dataset, const Vec<std::pair<graph::VariableAttrPtr, std::string>>& feeds,
+                       const DataLoaderOptions& options)
+    : dataset_(dataset), options_(options), tasks_(options.prefetch_ + 1), rng_(options.seed_) {
+  CHECK_GT(options_.batchSize_, 0UL);
+  CHECK_GT(options_.numWorkers_, 0UL);
+  numBatches_ = dataset_.numRecords() / options_.batchSize_;
+  CHECK_GT(numBatches_, 0UL) << "Less records than a batch";
+  for (auto& feed : feeds) {
+    auto& f = dataset_.field(feed.second);
+    auto& var = *feed.first;
+    CHECK_EQ(f.type_, var.type_) << "Type mismatch of " << var.name_ << " and field " << feed.second;
+    CHECK_EQ(var.dims_[0], options_.batchSize_) << var.name_ << " is not a batch";
+    CHECK_EQ(details::product(var.dims_), options_.batchSize_ * f.width_) << "Width mismatch of " << var.name_;
+    feeds_.push_back({feed.first, &f});
+  }
+  slots_.resize(options_.prefetch_ + 1);
+  for (auto& slot : slots_) {
+    slot.reset(new Slot());
+    for (auto& feed : feeds_) {
+      slot->buffers_.push_back(std::make_shared<memory::CpuVariableBuffer>(feed.first->bytes()));
+    }
+  }
+  for (size_t b = 0; b < slots_.size(); ++b) {
+    schedule(b);
+  }
+  for (size_t i = 0; i < options_.numWorkers_; ++i) {
+    workers_.emplace_back([this] { work(); });
+  }
+}
+
+DataLoader::~DataLoader() {
+  {
+    std::lock_guard<std::mutex> g(mu_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto& t : workers_) {
+    t.join();
+  }
+}
+
+void DataLoader::schedule(size_t batch) {
+  if (options_.shuffle_ && batch % numBatches_ == 0) {
+    auto order = std::make_shared<Vec<uint32_t>>(dataset_.numRecords());
+    std::iota(order->begin(), order->end(), 0);
+    std::shuffle(order->begin(), order->end(), rng_);
+    order_ = order;
+  }
+  // at most one task per slot is pending, the queue never overflows.
+  CHECK(tasks_.tryPush({batch, order_}));
+  {
+    std::lock_guard<std::mutex> g(mu_);
+  }
+  cv_.notify_all();
+}
+
+void DataLoader::next(memory::Workspace& w) {
+  if (current_ != -1UL) {
+    schedule(current_ + slots_.size());  // the engine is done with the slot of the current batch
+  }
+  auto& slot = *slots_[++current_ % slots_.size()];
+  if (slot.ready_.load(std::memory_order_acquire) != current_) {
+    ++numStalls_;
+    std::unique_lock<std::mutex> l(mu_);
+    cv_.wait(l, [&] { return slot.ready_.load(std::memory_order_acquire) == current_; });
+  }
+  for (size_t i = 0; i < feeds_.size(); ++i) {
+    auto& buf = slot.buffers_[i];
+    w.setExternal(feeds_[i].first->name_, buf, buf->get(), buf->getSize());
+  }
+}
+
+void DataLoader::work() {
+  Task task;
+  while (true) {
+    if (!tasks_.tryPop(&task)) {
+      std::unique_lock<std::mutex> l(mu_);
+      cv_.wait(l, [this] { return stop_ || !tasks_.empty(); });
+      if (stop_) return;
+      continue;
+    }
+    auto& slot = *slots_[task.batch_ % slots_.size()];
+    gather(task, slot);
+    slot.ready_.store(task.batch_, std::memory_order_release);
+    {
+      std::lock_guard<std::mutex> g(mu_);
+    }
+    cv_.notify_all();
+  }
+}
+
+void DataLoader::gather(const Task& task, Slot& slot) const {
+  size_t batchSize = options_.batchSize_;
+  size_t first = task.batch_ % numBatches_ * batchSize;
+  for (size_t i = 0; i < feeds_.size(); ++i) {
+    auto& f = *feeds_[i].second;
+    auto src = dataset_.data(f);
+    auto dst = (char*)slot.buffers_[i]->get();
+    size_t width = f.width_;
+    size_t recordSize = width * valueSize(f);
+    if (task.order_ == nullptr && f.storage_ == kSTORE_AS_TYPE) {
+      std::memcpy(dst, src + first * recordSize, batchSize * recordSize);  // consecutive records
+      continue;
+    }
+    for (size_t k = 0; k < batchSize; ++k) {
+      size_t record = task.order_ == nullptr ? first + k : (*task.order_)[first + k];
+      auto from = src + record * recordSize;
+      if (f.storage_ == kSTORE_UINT8) {
+        convertUint8((const uint8_t*)from, (float*)dst + k * width, width, (float)f.scale_);
+      } else {
+        std::memcpy(dst + k * recordSize, from, recordSize);
+      }
+    }
+  }
+}
+}
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <thread>
+#include "MappedDataset.h"
+#include "misc/MPMCQueue.h"
+
+namespace nnet {
+namespace data {
+
+struct DataLoaderOptions {
+  size_t batchSize_{1};
+  size_t numWorkers_{1};
+  size_t prefetch_{2};  // batches prepared ahead of the one the engine is running
+  bool shuffle_{true};  // a new permutation of the records every epoch
+  uint64_t seed_{0};
+};
+
+/**
+ * DataLoader gathers batches of a MappedDataset in background threads, so the next batch is ready when the engine
+ * finishes the current one.
+ *
+ * A batch is assembled in one of prefetch_ + 1 slots, which hold a buffer per fed variable. next() points the
+ * variables at the slot of the next batch (the buffers of the variables are retargeted, an execution plan stays
+ * valid), and hands the slot of the previous batch back to the workers. Batch b always uses slot b % numSlots, so the
+ * batches are fed in order whatever the number of workers, and the same seed gives the same batches.
+ *
+ * Records are gathered through the shuffled order, with a memcpy per record, and kSTORE_UINT8 fields are converted to
+ * float with SIMD. The records left after the last full batch of an epoch are skipped.
+ */
+class DataLoader final {
+ public:
+  /**
+   * @param feeds the variables and the fields they read, dims_[0] of each variable is the batch size.
+   * The dataset must outlive the loader.
+   */
+  DataLoader(const MappedDataset& dataset, const Vec<std::pair<graph::VariableAttrPtr, std::string>>& feeds,
+             const DataLoaderOptions& options);
+  DataLoader(const DataLoader&) = delete;
+  ~DataLoader();
+
+  size_t numBatches() const { return numBatches_; }  // per epoch
+
+  // The epoch of the batch fed by the last next().
+  size_t epoch() const { return (current_ == -1UL ? 0 : current_) / numBatches_; }
+
+  // Feed the next batch into the workspace, which must not be used by a running engine.
+  void next(memory::Workspace& w);
+
+  // The number of next() calls which waited for their batch.
+  size_t numStalls() const { return numStalls_; }
+
+ private:
+  struct Task {
+    size_t batch_;
+    std::shared_ptr<const Vec<uint32_t>> order_;  // of the records in the epoch, nullptr when not shuffled
+  };
+
+  struct Slot {
+    Vec<std::shared_ptr<memory::CpuVariableBuffer>> buffers_;  // one per feed
+    std::atomic<size_t> ready_{-1UL};                           // the batch in the buffers
+  };
+
+  void schedule(size_t batch);
+  void work();
+  void gather(const Task& task, Slot& slot) const;
+
+  const MappedDataset& dataset_;
+  Vec<std::pair<graph::VariableAttrPtr, const FieldHeader*>> feeds_;
+  DataLoaderOptions options_;
+  size_t numBatches_;
+  Vec<std::unique_ptr<Slot>> slots_;
+  util::MPMCQueue<Task> tasks_;
+  std::mt19937_64 rng_;
+  std::shared_ptr<const Vec<uint32_t>> order_;  // of the epoch being scheduled
+  size_t current_{-1UL};
+  size_t numStalls_{0};
+
+  // only to sleep when there is no task, or the batch is not ready yet.
+  std::mutex mu_;
+  std::condition_variable cv_;
+  bool stop_{false};
+  Vec<std::thread> workers_;
+};
+}
+}
@@ -0,0 +1,170 @@
+#include "MappedDataset.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+namespace nnet {
+namespace data {
+
+constexpr char DatasetHeader::kMagic[8];
+
+static constexpr size_t kPageSize = 4096;
+
+static size_t alignPage(size_t size) { return (size + kPageSize - 1) / kPageSize * kPageSize; }
+
+void* mapFile(const std::string& path, bool write, size_t* size) {
+  int fd = open(path.c_str(), write ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644);
+  CHECK_GE(fd, 0) << "Cannot open " << path << ": " << strerror(errno);
+  if (write) {
+    CHECK_EQ(ftruncate(fd, *size), 0) << "Cannot resize " << path << ": " << strerror(errno);
+  } else {
+    struct stat st;
+    CHECK_EQ(fstat(fd, &st), 0);
+    *size = st.st_size;
+  }
+  // a private mapping of a dataset is writable, kernels may treat the feeds as ordinary buffers.
+  void* ptr = mmap(nullptr, *size, PROT_READ | PROT_WRITE, write ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+  close(fd);
+  CHECK_NE(ptr, MAP_FAILED) << "Cannot map " << path << ": " << strerror(errno);
+  return ptr;
+}
+
+void convertUint8(const uint8_t* src, float* dst, size_t n, float scale) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  auto s = _mm256_set1_ps(scale);
+  for (; i + 8 <= n; i += 8) {
+    auto bytes = _mm_loadl_epi64((const __m128i*)(src + i));
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes)), s));
+  }
+#elif defined(__SSE2__)
+  auto s = _mm_set1_ps(scale);
+  auto zero = _mm_setzero_si128();
+  for (; i + 16 <= n; i += 16) {
+    auto bytes = _mm_loadu_si128((const __m128i*)(src + i));
+    auto lo = _mm_unpacklo_epi8(bytes, zero);
+    auto hi = _mm_unpackhi_epi8(bytes, zero);
+    _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), s));
+    _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), s));
+    _mm_storeu_ps(dst + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), s));
+    _mm_storeu_ps(dst + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), s));
+  }
+#endif
+  for (; i < n; ++i) {
+    dst[i] = src[i] * scale;
+  }
+}
+
+DatasetWriter::DatasetWriter(const std::string& path, size_t numRecords, const Vec<FieldDesc>& fields) {
+  size_t offset = alignPage(sizeof(DatasetHeader) + fields.size() * sizeof(FieldHeader));
+  Vec<FieldHeader> headers(fields.size());
+  for (size_t i = 0; i < fields.size(); ++i) {
+    CHECK_LT(fields[i].name_.size(), sizeof(headers[i].name_));
+    CHECK(fields[i].type_ == graph::kFLOAT32 || fields[i].type_ == graph::kINT32);
+    CHECK(fields[i].storage_ == kSTORE_AS_TYPE || fields[i].type_ == graph::kFLOAT32);
+    std::memset(&headers[i], 0, sizeof(FieldHeader));
+    std::strcpy(headers[i].name_, fields[i].name_.c_str());
+    headers[i].type_ = fields[i].type_;
+    headers[i].width_ = fields[i].width_;
+    headers[i].offset_ = offset;
+    headers[i].storage_ = fields[i].storage_;
+    headers[i].scale_ = fields[i].scale_;
+    offset = alignPage(offset + numRecords * fields[i].width_ * valueSize(headers[i]));
+  }
+  size_ = offset;
+  base_ = (char*)mapFile(path, true, &size_);
+  DatasetHeader header;
+  std::memcpy(header.magic_, DatasetHeader::kMagic, sizeof(header.magic_));
+  header.numRecords_ = numRecords;
+  header.numFields_ = fields.size();
+  std::memcpy(base_, &header, sizeof(header));
+  std::memcpy(base_ + sizeof(header), headers.data(), headers.size() * sizeof(FieldHeader));
+}
+
+DatasetWriter::~DatasetWriter() { munmap(base_, size_); }
+
+void* DatasetWriter::data(const std::string& field) {
+  auto header = (const DatasetHeader*)base_;
+  auto fields = (const FieldHeader*)(base_ + sizeof(DatasetHeader));
+  for (size_t i = 0; i < header->numFields_; ++i) {
+    if (field == fields[i].name_) {
+      return base_ + fields[i].offset_;
+    }
+  }
+  LOG(FATAL) << "No field " << field;
+  return nullptr;
+}
+
+bool MappedDataset::readable(const std::string& path) {
+  char magic[sizeof(DatasetHeader::kMagic)];
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  bool current = read(fd, magic, sizeof(magic)) == (ssize_t)sizeof(magic) &&
+                 std::memcmp(magic, DatasetHeader::kMagic, sizeof(magic)) == 0;
+  close(fd);
+  return current;
+}
+
+MappedDataset::MappedDataset(const std::string& path) {
+  char* base = (char*)mapFile(path, false, &size_);
+  size_t size = size_;
+  mapping_.reset(base, [size](char* ptr) { munmap(ptr, size); });
+  CHECK_GE(size_, sizeof(DatasetHeader));
+  header_ = (const DatasetHeader*)base;
+  CHECK_EQ(std::memcmp(header_->magic_, DatasetHeader::kMagic, sizeof(header_->magic_)), 0)
+      << path << " is not a dataset";
+  fields_ = (const FieldHeader*)(base + sizeof(DatasetHeader));
+  for (size_t i = 0; i < header_->numFields_; ++i) {
+    CHECK_LE(fields_[i].offset_ + header_->numRecords_ * fields_[i].width_ * valueSize(fields_[i]), size_)
+        << path << " is truncated";
+  }
+}
+
+const FieldHeader& MappedDataset::field(const std::string& name) const {
+  for (size_t i = 0; i < header_->numFields_; ++i) {
+    if (name == fields_[i].name_) {
+      return fields_[i];
+    }
+  }
+  LOG(FATAL) << "No field " << name;
+  return fields_[0];
+}
+
+std::pair<char*, size_t> MappedDataset::slice(const graph::VariableAttr& var, const FieldHeader& f,
+                                              size_t firstRecord) const {
+  CHECK_EQ(f.type_, var.type_) << "Type mismatch of " << var.name_ << " and field " << f.name_;
+  size_t numRecords = var.dims_[0];
+  CHECK_EQ(details::product(var.dims_), numRecords * f.width_) << "Width mismatch of " << var.name_;
+  CHECK_LE(firstRecord + numRecords, header_->numRecords_);
+  size_t recordSize = f.width_ * valueSize(f);
+  return {mapping_.get() + f.offset_ + firstRecord * recordSize, numRecords * recordSize};
+}
+
+void MappedDataset::feed(memory::Workspace& w, const graph::VariableAttrPtr& var, const std::string& field,
+                         size_t firstRecord) const {
+  auto& f = this->field(field);
+  CHECK_EQ(f.storage_, kSTORE_AS_TYPE) << "Field " << field << " is stored as bytes, it cannot be fed in place";
+  auto records = slice(*var, f, firstRecord);
+  w.setExternal(var->name_, mapping_, records.first, records.second);
+}
+
+void MappedDataset::copy(const graph::Variable& var, const std::string& field, size_t firstRecord) const {
+  auto& f = this->field(field);
+  auto records = slice(*var.attr_, f, firstRecord);
+  if (f.storage_ == kSTORE_UINT8) {
+    CHECK_GE(var.buffer_->getSize(), records.second * sizeof(float));
+    convertUint8((const uint8_t*)records.first, (float*)var.buffer_->get(), records.second, f.scale_);
+  } else {
+    CHECK_GE(var.buffer_->getSize(), records.second);
+    std::memcpy(var.buffer_->get(), records.first, records.second);
+  }
+}
+}
+}
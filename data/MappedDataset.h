@@ -0,0 +1,119 @@
+#pragma once
+#include <cstdint>
+#include "graph/ComputationGraph.h"
+#include "memory/Workspace.h"
+
+namespace nnet {
+namespace data {
+
+/**
+ * A dataset file is a header, followed by one section per field. A section holds the field of every record, record
+ * after record, so a batch of consecutive records is one contiguous slice of it. Sections are page aligned. Values are
+ * stored as they are fed, e.g. images already normalized to float, or as bytes which a DataLoader scales to float
+ * while gathering a batch (see kSTORE_UINT8).
+ */
+struct DatasetHeader {
+  static constexpr char kMagic[8] = {'N', 'N', 'E', 'T', 'D', 'S', '0', '2'};
+  char magic_[8];
+  uint64_t numRecords_;
+  uint64_t numFields_;
+};
+
+struct FieldHeader {
+  char name_[48];
+  uint64_t type_;    // graph::VariableType, kFLOAT32 or kINT32
+  uint64_t width_;   // values per record
+  uint64_t offset_;  // of the section, from the beginning of the file
+  uint64_t storage_;  // FieldStorage
+  double scale_;      // of the kSTORE_UINT8 values
+};
+
+enum FieldStorage : uint64_t {
+  kSTORE_AS_TYPE = 0,  // 4 bytes values of the type
+  kSTORE_UINT8 = 1,    // kFLOAT32 values stored as bytes, the value is byte * scale_
+};
+
+// The bytes of one value of a field in its section.
+inline size_t valueSize(const FieldHeader& f) { return f.storage_ == kSTORE_UINT8 ? 1 : sizeof(float); }
+
+struct FieldDesc {
+  std::string name_;
+  graph::VariableType type_;
+  size_t width_;
+  FieldStorage storage_{kSTORE_AS_TYPE};
+  float scale_{1};
+};
+
+/**
+ * DatasetWriter creates a dataset file and maps it, the sections are filled through data(). The file is complete
+ * when the writer is destroyed.
+ */
+class DatasetWriter final {
+ public:
+  DatasetWriter(const std::string& path, size_t numRecords, const Vec<FieldDesc>& fields);
+  DatasetWriter(const DatasetWriter&) = delete;
+  ~DatasetWriter();
+
+  // The section of a field, numRecords * width values, bytes for a kSTORE_UINT8 field.
+  void* data(const std::string& field);
+
+ private:
+  char* base_;
+  size_t size_;
+};
+
+/**
+ * MappedDataset maps a dataset file. Opening it only reads the header, the pages of the records are loaded by the
+ * kernel when a batch touches them.
+ *
+ * A batch is fed either by feed(), which points the buffer of the variable at the records without copying, or by
+ * copy(), one memcpy into the buffer of the variable.
+ */
+class MappedDataset final {
+ public:
+  explicit MappedDataset(const std::string& path);
+  MappedDataset(const MappedDataset&) = delete;
+
+  /**
+   * @brief readable return true if path is a dataset file of the current format, i.e. it exists and has the magic of
+   * this version. A file written by an older version should be converted again.
+   */
+  static bool readable(const std::string& path);
+
+  size_t numRecords() const { return header_->numRecords_; }
+
+  const FieldHeader& field(const std::string& name) const;
+
+  const char* data(const FieldHeader& f) const { return mapping_.get() + f.offset_; }
+
+  /**
+   * @brief feed let the variable read dims_[0] records of the field, from firstRecord, in place. The buffer of the
+   * variable is replaced by a view of the mapping on the first call, and retargeted by the next ones. The records are
+   * private to the process, writing them does not change the file. A kSTORE_UINT8 field cannot be fed in place.
+   */
+  void feed(memory::Workspace& w, const graph::VariableAttrPtr& var, const std::string& field,
+            size_t firstRecord) const;
+
+  // Copy dims_[0] records of the field, from firstRecord, into the buffer of the variable. Bytes are scaled to float.
+  void copy(const graph::Variable& var, const std::string& field, size_t firstRecord) const;
+
+ private:
+  // The records of a field for the variable, and their bytes.
+  std::pair<char*, size_t> slice(const graph::VariableAttr& var, const FieldHeader& f, size_t firstRecord) const;
+
+  std::shared_ptr<char> mapping_;  // unmapped when the last view of it is destroyed
+  size_t size_;
+  const DatasetHeader* header_;
+  const FieldHeader* fields_;
+};
+
+/**
+ * Map a whole file. With write, the file is created or truncated to *size and mapped shared. Otherwise *size is set to
+ * the size of the file, which is mapped privately and writable: writes are copied on write, never reach the file.
+ */
+void* mapFile(const std::string& path, bool write, size_t* size);
+
+// dst[i] = src[i] * scale, vectorized.
+void convertUint8(const uint8_t* src, float* dst, size_t n, float scale);
+}
+}
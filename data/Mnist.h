@@ -0,0 +1,42 @@
+#pragma once
+#include <mnist/mnist_reader.hpp>
+#include "MappedDataset.h"
+
+namespace nnet {
+namespace data {
+
+/**
+ * Convert MNIST to the dataset files <outDir>/mnist-train.nnet and <outDir>/mnist-test.nnet. The field X is the image
+ * normalized to [0, 1], Label is the digit. With uint8, X keeps the pixels as bytes, 4x smaller, and is normalized by
+ * a DataLoader.
+ */
+inline void convertMnist(const std::string& mnistDir, const std::string& outDir, bool uint8 = false) {
+  auto dataset = mnist::read_dataset_direct<std::vector, std::vector<uint8_t>>(mnistDir);
+  for (bool test : {false, true}) {
+    auto& images = test ? dataset.test_images : dataset.training_images;
+    auto& labels = test ? dataset.test_labels : dataset.training_labels;
+    std::string path = outDir + (test ? "/mnist-test.nnet" : "/mnist-train.nnet");
+    FieldDesc x{"X", graph::kFLOAT32, 784};
+    if (uint8) {
+      x.storage_ = kSTORE_UINT8;
+      x.scale_ = 1 / 255.0f;
+    }
+    DatasetWriter writer(path, images.size(), {x, {"Label", graph::kINT32, 1}});
+    auto pixels = writer.data("X");
+    auto label = (int*)writer.data("Label");
+    for (size_t i = 0; i < images.size(); ++i) {
+      CHECK_EQ(images[i].size(), 784UL);
+      for (size_t k = 0; k < 784; ++k) {
+        if (uint8) {
+          ((uint8_t*)pixels)[i * 784 + k] = images[i][k];
+        } else {
+          ((float*)pixels)[i * 784 + k] = images[i][k] / 255.0f;
+        }
+      }
+      label[i] = labels[i];
+    }
+    LOG(INFO) << "Write " << images.size() << " records to " << path;
+  }
+}
+}
+}
@@ -0,0 +1,168 @@
+#include "Autotuner.h"
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include "memory/VariableBuffer.h"
+#include "misc/ThreadPool.h"
+#ifdef __x86_64__
+#include <cpuid.h>
+#endif
+
+namespace nnet {
+namespace engine {
+
+void Autotuner::setCachePath(const std::string& path) {
+  std::lock_guard<std::mutex> g(mu_);
+  cachePath_ = path;
+  if (path.empty()) return;
+  std::ifstream fin(path);
+  std::string line;
+  size_t numLoaded = 0;
+  while (std::getline(fin, line)) {
+    auto tab = line.rfind('\t');
+    if (tab == std::string::npos) continue;
+    winners_[line.substr(0, tab)] = line.substr(tab + 1);
+    ++numLoaded;
+  }
+  LOG(INFO) << "Autotuner loads " << numLoaded << " kernels from " << path;
+}
+
+std::string Autotuner::winner(const std::string& key) const {
+  std::lock_guard<std::mutex> g(mu_);
+  auto it = winners_.find(key);
+  return it == winners_.end() ? "" : it->second;
+}
+
+static const char* typeName(graph::VariableType type) {
+  static const char* names[] = {"f32", "i32", "csr", "bf16", "fp16", "i8"};
+  return type < sizeof(names) / sizeof(names[0]) ? names[type] : "?";
+}
+
+std::string Autotuner::key(const graph::Op& op) {
+  auto pool = util::ThreadPool::current();
+  std::ostringstream sout;
+  sout << cpuModel() << "|threads=" << (pool == nullptr ? 1 : pool->size() + 1) << "|" << op.type_;
+  for (auto vars : {&op.inputs_, &op.outputs_}) {
+    sout << "|";
+    for (size_t i = 0; i < vars->size(); ++i) {
+      auto& v = (*vars)[i];
+      sout << (i == 0 ? "" : ",");
+      if (v == nullptr) {
+        sout << "-";
+        continue;
+      }
+      sout << typeName(v->type_);
+      for (size_t j = 0; j < v->dims_.size(); ++j) {
+        sout << (j == 0 ? "[" : "x") << v->dims_[j];
+      }
+      sout << (v->type_ == graph::kCSR_FLOAT32 ? "~" + std::to_string(v->maxNnz_) : "") << "]";
+    }
+  }
+  return sout.str();
+}
+
+const std::string& Autotuner::cpuModel() {
+  static std::string model = [] {
+    std::string retv;
+#ifdef __x86_64__
+    unsigned int regs[12];
+    if (__get_cpuid(0x80000000, &regs[0], &regs[1], &regs[2], &regs[3]) && regs[0] >= 0x80000004) {
+      char brand[49] = {0};
+      for (unsigned int i = 0; i < 3; ++i) {
+        __get_cpuid(0x80000002 + i, &regs[0], &regs[1], &regs[2], &regs[3]);
+        std::memcpy(brand + 16 * i, regs, 16);
+      }
+      retv = brand;
+    }
+#endif
+    retv.erase(0, retv.find_first_not_of(' '));
+    retv.erase(retv.find_last_not_of(' ') + 1);
+    return retv.empty() ? std::string("unknown") : retv;
+  }();
+  return model;
+}
+
+// The fastest ns of a call of kernel, over at least 3 calls and 2ms after a warm-up call.
+static double timeKernel(const graph::OpMeta::RunOnDeviceFN& kernel, const SmallVec<Variable>& inputs,
+                         SmallVec<Variable>& outputs, const graph::OpAttrs& attrs) {
+  using Clock = std::chrono::steady_clock;
+  kernel(inputs, outputs, attrs);
+  double best = std::numeric_limits<double>::max(), total = 0;
+  for (size_t i = 0; i < 100 && (i < 3 || total < 2e6); ++i) {
+    auto begin = Clock::now();
+    kernel(inputs, outputs, attrs);
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - begin).count();
+    best = std::min(best, ns);
+    total += ns;
+  }
+  return best;
+}
+
+const graph::OpMeta::RunOnDeviceFN* Autotuner::select(const graph::Op& op, const graph::OpAttrs& attrs,
+                                                      const SmallVec<Variable>& inputs,
+                                                      const SmallVec<Variable>& outputs) {
+  auto& meta = graph::OpMeta::gAllOpMeta_.at(op.type_);
+  auto defaultKernel = &meta.kernels[graph::kDEVICE_CPU];
+  if (meta.cpuVariants_.empty()) {
+    return defaultKernel;
+  }
+  SmallVec<const graph::OpMeta::KernelVariant*> candidates;
+  for (auto& variant : meta.cpuVariants_) {
+    if (!variant.supports_ || variant.supports_(op.inputs_, op.outputs_)) {
+      candidates.push_back(&variant);
+    }
+  }
+  if (candidates.empty()) {
+    return defaultKernel;
+  }
+
+  auto k = key(op);
+  std::lock_guard<std::mutex> g(mu_);
+  auto it = winners_.find(k);
+  if (it != winners_.end()) {
+    if (it->second == "default") return defaultKernel;
+    for (auto variant : candidates) {
+      if (variant->name_ == it->second) return &variant->kernel_;
+    }
+    // a variant which is not registered anymore, tune again.
+  }
+
+  SmallVec<Variable> scratch;
+  for (auto& o : outputs) {
+    scratch.push_back(o);
+    if (o.buffer_ == nullptr) continue;
+    auto buf = std::make_shared<memory::CpuVariableBuffer>(o.buffer_->getSize());
+    std::memcpy(buf->get(), o.buffer_->get(), o.buffer_->getSize());  // e.g. a gradient kernels add to
+    scratch.back().buffer_ = buf;
+  }
+  std::string bestName = "default";
+  const graph::OpMeta::RunOnDeviceFN* best = defaultKernel;
+  double bestNs = timeKernel(*defaultKernel, inputs, scratch, attrs);
+  std::ostringstream sout;
+  sout << "default " << bestNs / 1000 << "us";
+  for (auto variant : candidates) {
+    double ns = timeKernel(variant->kernel_, inputs, scratch, attrs);
+    sout << ", " << variant->name_ << " " << ns / 1000 << "us";
+    if (ns < bestNs) {
+      bestNs = ns;
+      bestName = variant->name_;
+      best = &variant->kernel_;
+    }
+  }
+  ++numTuned_;
+  winners_[k] = bestName;
+  LOG(INFO) << "Autotune " << k << ": " << sout.str() << ", pick " << bestName;
+  if (!cachePath_.empty()) {
+    std::ofstream fout(cachePath_, std::ios::app);
+    if (fout.good()) {
+      fout << k << '\t' << bestName << '\n';
+    } else {
+      LOG(WARNING) << "Cannot write the autotuning cache " << cachePath_;
+    }
+  }
+  return best;
+}
+}
+}
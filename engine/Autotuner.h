@@ -0,0 +1,53 @@
+#pragma once
+#include <mutex>
+#include "graph/ComputationGraph.h"
+
+namespace nnet {
+namespace engine {
+using graph::Variable;
+
+/**
+ * Autotuner picks the fastest CPU kernel of an op with variants (OpMeta::cpuVariants_) for each shape. The first time a
+ * shape is seen, every variant supporting it is timed on the buffers of the op, writing to scratch copies of its
+ * outputs so the op still reads and writes its own memory afterwards. The winner is kept by key(), i.e. by the CPU
+ * model, the number of threads, the op type and the types and dims of the inputs and outputs.
+ *
+ * With a cache path, winners are loaded from it and appended to it, so later runs on the same machine do not measure
+ * again. The file has a line per winner, `key<TAB>variant`, the last line of a key wins.
+ *
+ * Set it with Engine::setAutotuner. Variants round differently, so a tuned run is not bit-identical to another one.
+ */
+class Autotuner final {
+ public:
+  explicit Autotuner(const std::string& cachePath = "") { setCachePath(cachePath); }
+
+  // Load the winners of a cache file (it may not exist yet), and append the next winners to it. Empty keeps them in
+  // memory only.
+  void setCachePath(const std::string& path);
+
+  /**
+   * @brief select return the kernel to run op with, tuning it if its key has no winner yet. attrs are the attributes
+   * of op bound for its kernels. It is thread-safe, concurrent tunings are serialized.
+   */
+  const graph::OpMeta::RunOnDeviceFN* select(const graph::Op& op, const graph::OpAttrs& attrs,
+                                             const SmallVec<Variable>& inputs, const SmallVec<Variable>& outputs);
+
+  // The name of the variant picked for a key, empty if none.
+  std::string winner(const std::string& key) const;
+
+  // How many ops were timed, e.g. to check that a cached shape is not measured again.
+  size_t numTuned() const { return numTuned_; }
+
+  static std::string key(const graph::Op& op);
+
+  // The brand string of the CPU, "unknown" if it cannot be read.
+  static const std::string& cpuModel();
+
+ private:
+  mutable std::mutex mu_;
+  std::string cachePath_;
+  Map<std::string, std::string> winners_;
+  size_t numTuned_{0};
+};
+}
+}
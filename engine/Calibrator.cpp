@@ -0,0 +1,48 @@
+#include "Calibrator.h"
+#include "misc/CastEigen.h"
+#include "misc/Int8.h"
+
+namespace nnet {
+namespace engine {
+
+Calibrator::Calibrator(const graph::Graph& g) {
+  Set<std::string> weights;
+  for (auto& op : g.ops_) {
+    auto type = op.inputs_[0]->type_;
+    if ((op.type_ != "fc" && op.type_ != "fc_bias_act") || (type != graph::kFLOAT32 && !graph::isHalf(type))) {
+      continue;
+    }
+    if (ranges_.insert({op.inputs_[0]->name_, 0.0f}).second) {
+      inputs_.push_back(op.inputs_[0]);
+    }
+    if (weights.insert(op.inputs_[1]->name_).second) {
+      weights_.push_back(op.inputs_[1]);
+    }
+  }
+}
+
+void Calibrator::observe(memory::Workspace& w) {
+  for (auto& input : inputs_) {
+    float& range = ranges_.at(input->name_);
+    static thread_local eigen::Matrix gScratch;  // for a 16-bit input
+    auto values = eigen::castRows(w.getVar(input), 0, input->dims_[0], &gScratch);
+    range = std::max(range, values.cwiseAbs().maxCoeff());
+  }
+}
+
+Set<std::string> Calibrator::packWeights(memory::Workspace& w) const {
+  Set<std::string> retv;
+  for (auto& weight : weights_) {
+    size_t k = weight->dims_[0], n = weight->dims_[1];
+    size_t packedSize = util::roundUp(k, util::kInt8GroupRows) * util::roundUp(n, util::kInt8PanelCols);
+    auto packed = w.createOrResizeBuffer(weight->name_ + ".int8", packedSize, memory::kDEVICE_CPU);
+    auto scales = w.createOrResizeBuffer(weight->name_ + ".int8_scale", n * sizeof(float), memory::kDEVICE_CPU);
+    auto sums = w.createOrResizeBuffer(weight->name_ + ".int8_sum", n * sizeof(int32_t), memory::kDEVICE_CPU);
+    util::packInt8Weights((const float*)w(weight)->get(), k, n, (int8_t*)packed->get(), (float*)scales->get(),
+                          (int32_t*)sums->get());
+    retv.insert(weight->name_);
+  }
+  return retv;
+}
+}
+}
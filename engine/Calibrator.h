@@ -0,0 +1,35 @@
+#pragma once
+#include "graph/ComputationGraph.h"
+#include "memory/Workspace.h"
+
+namespace nnet {
+namespace engine {
+
+/**
+ * Calibrator records the largest magnitude of the dense inputs of the fc and fc_bias_act ops of a graph over sample
+ * batches, the calibration of the quantize stage. Call observe() after each run of the float graph, without
+ * setPlanMemory, so the inputs are not overwritten by then. It also packs the weights of these ops for the int8
+ * kernels, so the quantize stage only rewrites the graph.
+ */
+class Calibrator final {
+ public:
+  explicit Calibrator(const graph::Graph& g);
+
+  void observe(memory::Workspace& w);
+
+  const Map<std::string, float>& ranges() const { return ranges_; }
+
+  /**
+   * @brief packWeights quantize the weights of the calibrated ops per output channel into the buffers <weight>.int8,
+   * <weight>.int8_scale and <weight>.int8_sum of w, see util::packInt8Weights. Return the names of the weights, the
+   * attr packed_weights of the quantize stage.
+   */
+  Set<std::string> packWeights(memory::Workspace& w) const;
+
+ private:
+  SmallVec<graph::VariableAttrPtr> inputs_;
+  SmallVec<graph::VariableAttrPtr> weights_;
+  Map<std::string, float> ranges_;
+};
+}
+}
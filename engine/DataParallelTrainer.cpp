@@ -0,0 +1,185 @@
+#include "DataParallelTrainer.h"
+#include <cstring>
+#include "misc/CastEigen.h"
+
+namespace nnet {
+namespace engine {
+
+DataParallelTrainer::DataParallelTrainer(const graph::Graph& g, size_t numReplicas,
+                                         const SmallVec<std::string>& batchVars)
+    : stepBarrier_(numReplicas + 1), replicaBarrier_(numReplicas) {
+  CHECK_GT(numReplicas, 0UL);
+  CHECK_GT(batchVars.size(), 0UL);
+  size_t batchSize = g.variables_.at(batchVars[0])->dims_[0];
+  for (auto& name : batchVars) {
+    CHECK_EQ(g.variables_.at(name)->dims_[0], batchSize) << "Batch variables must have the same batch size";
+    CHECK_NE(g.variables_.at(name)->type_, graph::kCSR_FLOAT32) << "Sparse batch variables could not be split";
+  }
+  CHECK_GE(batchSize, numReplicas);
+
+  // The optimizer ops are the ops writing parameters, they are appended at the end of the graph.
+  size_t splitPoint = g.ops_.size();
+  for (size_t i = 0; i < g.ops_.size(); ++i) {
+    bool writeParam = false;
+    for (auto& o : g.ops_[i].outputs_) {
+      writeParam |= o != nullptr && graph::isParamName(o->name_);
+    }
+    if (writeParam && splitPoint == g.ops_.size()) {
+      splitPoint = i;
+    }
+    CHECK(writeParam || splitPoint == g.ops_.size()) << "Only optimizer ops could follow an optimizer op";
+  }
+
+  Vec<std::string> gradNames;
+  for (auto& var : g.variables_) {
+    if (graph::isGradName(var.first) && var.first.find(".param") != std::string::npos) {
+      CHECK(var.second->sparseRows_.empty()) << "Row-sparse gradients could not be all-reduced, " << var.first;
+      gradNames.push_back(var.first);
+    }
+  }
+  for (auto& name : batchVars) {
+    feedVars_.push_back(feeds_.getVar(g.variables_.at(name)));
+  }
+
+  size_t offset = 0;
+  for (size_t i = 0; i < numReplicas; ++i) {
+    replicas_.emplace_back(new Replica());
+    auto& replica = *replicas_.back();
+    replica.batchOffset_ = offset;
+    replica.batchSize_ = batchSize / numReplicas + (i < batchSize % numReplicas ? 1 : 0);
+    replica.weight_ = (float)replica.batchSize_ / batchSize;
+    offset += replica.batchSize_;
+
+    replica.computeGraph_ = g.clone();
+    for (auto& name : batchVars) {
+      replica.computeGraph_.variables_.at(name)->dims_[0] = replica.batchSize_;
+    }
+    replica.updateGraph_.variables_ = replica.computeGraph_.variables_;
+    auto& ops = replica.computeGraph_.ops_;
+    replica.updateGraph_.ops_.insert(replica.updateGraph_.ops_.end(), ops.begin() + splitPoint, ops.end());
+    ops.erase(ops.begin() + splitPoint, ops.end());
+
+    replica.computeEngine_.reset(new NaiveEngine(replica.workspace_, replica.computeGraph_));
+    replica.updateEngine_.reset(new NaiveEngine(replica.workspace_, replica.updateGraph_));
+
+    // Variables touched across replicas are resolved here, the replica threads never look up workspaces.
+    for (auto& name : batchVars) {
+      replica.batchVars_.push_back(replica.workspace_.getVar(replica.computeGraph_.variables_.at(name)));
+    }
+    // The gradients are packed in one arena, which is all-reduced as one array.
+    graph::compileGraph(&replica.computeGraph_, {"packParameters"}, {{"workspace", &replica.workspace_}});
+    auto arena = replica.workspace_.arena("grad");
+    size_t gradBytes = 0;
+    for (auto& name : gradNames) {
+      gradBytes += replica.computeGraph_.variables_.at(name)->bytes();
+    }
+    CHECK(arena != nullptr && arena->getSize() == gradBytes) << "Every gradient must be in the arena";
+    grads_.push_back(arena);
+  }
+
+  for (size_t i = 0; i < numReplicas; ++i) {
+    threads_.emplace_back([this, i] { this->loop(i); });
+  }
+}
+
+DataParallelTrainer::~DataParallelTrainer() {
+  stop_ = true;
+  stepBarrier_.wait();
+  for (auto& t : threads_) {
+    t.join();
+  }
+}
+
+void DataParallelTrainer::randomize() {
+  auto& first = *replicas_[0];
+  first.computeEngine_->randomize();
+  for (auto& var : first.computeGraph_.variables_) {
+    if (!graph::isParamName(var.first) && !graph::isStateName(var.first)) continue;
+    auto src = first.workspace_.getVar(var.second);
+    for (size_t i = 1; i < replicas_.size(); ++i) {
+      auto& replica = *replicas_[i];
+      auto dst = replica.workspace_.getVar(replica.computeGraph_.variables_.at(var.first));
+      std::memcpy(dst.buffer_->get(), src.buffer_->get(), src.buffer_->getSize());
+    }
+  }
+}
+
+Variable DataParallelTrainer::getFeed(const std::string& name) {
+  auto it = std::find_if(feedVars_.begin(), feedVars_.end(),
+                         [&name](const Variable& var) { return var.attr_->name_ == name; });
+  CHECK(it != feedVars_.end()) << name << " is not a batch variable";
+  return *it;
+}
+
+void DataParallelTrainer::run() {
+  stepBarrier_.wait();  // start step
+  stepBarrier_.wait();  // wait step done
+}
+
+float DataParallelTrainer::fetchMean(const std::string& name) const {
+  float mean = 0;
+  for (auto& replica : replicas_) {
+    auto var = replica->workspace_.getVar(replica->computeGraph_.variables_.at(name));
+    mean += replica->weight_ * *(float*)var.buffer_->get();
+  }
+  return mean;
+}
+
+void DataParallelTrainer::loop(size_t replicaId) {
+  auto& replica = *replicas_[replicaId];
+  while (true) {
+    stepBarrier_.wait();
+    if (stop_) {
+      return;
+    }
+    scatter(replicaId);
+    replica.computeEngine_->resetOrCreateGradient();
+    replica.computeEngine_->run();
+    replicaBarrier_.wait();
+    allReduce(replicaId);
+    replicaBarrier_.wait();
+    replica.updateEngine_->run();
+    stepBarrier_.wait();
+  }
+}
+
+void DataParallelTrainer::scatter(size_t replicaId) {
+  auto& replica = *replicas_[replicaId];
+  for (size_t i = 0; i < feedVars_.size(); ++i) {
+    auto& src = feedVars_[i];
+    auto& dst = replica.batchVars_[i];
+    size_t rowSize = src.buffer_->getSize() / src.attr_->dims_[0];
+    std::memcpy(dst.buffer_->get(), (char*)src.buffer_->get() + replica.batchOffset_ * rowSize,
+                replica.batchSize_ * rowSize);
+  }
+}
+
+/**
+ * The gradients are one flat array, the arena of packParameters, split into one segment per replica. Each replica
+ * reduces its segment over all replicas and writes the result back to all of them, i.e. a reduce-scatter followed by
+ * an all-gather through shared memory. The reduction order is fixed, so all replicas get bit-identical gradients.
+ */
+void DataParallelTrainer::allReduce(size_t replicaId) {
+  size_t numReplicas = replicas_.size();
+  if (numReplicas == 1) {
+    return;
+  }
+  size_t gradSize = grads_[0]->getSize() / sizeof(float);
+  size_t begin = gradSize * replicaId / numReplicas;
+  size_t end = gradSize * (replicaId + 1) / numReplicas;
+  if (begin < end) {
+    auto segment = [&](size_t r) {
+      return Eigen::Map<eigen::Vector>((float*)grads_[r]->get() + begin, end - begin).array();
+    };
+    auto sum = segment(0);
+    sum *= replicas_[0]->weight_;
+    for (size_t r = 1; r < numReplicas; ++r) {
+      sum += replicas_[r]->weight_ * segment(r);
+    }
+    for (size_t r = 1; r < numReplicas; ++r) {
+      segment(r) = sum;
+    }
+  }
+}
+}
+}
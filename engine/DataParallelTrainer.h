@@ -0,0 +1,67 @@
+#pragma once
+#include <thread>
+#include "Engine.h"
+#include "misc/Barrier.h"
+
+namespace nnet {
+namespace engine {
+
+/**
+ * DataParallelTrainer trains N replicas of a graph synchronously, each replica with its own workspace and thread.
+ *
+ * The graph must already contain the backward and optimizer ops. Each step, every batch variable (X, Label, ...) is
+ * split by rows across the replicas, the replicas run forward and backward, all parameter gradients are all-reduced,
+ * and then every replica runs the optimizer ops. Gradients are weighted by shard size, so the update equals the one of
+ * a single graph on the whole batch, and the parameters of the replicas stay identical.
+ */
+class DataParallelTrainer final {
+ public:
+  DataParallelTrainer(const graph::Graph& g, size_t numReplicas,
+                      const SmallVec<std::string>& batchVars = {"X", "Label"});
+  DataParallelTrainer(const DataParallelTrainer&) = delete;
+  ~DataParallelTrainer();
+
+  // Randomize the parameters of the first replica, and broadcast them to the others.
+  void randomize();
+
+  // Get the whole-batch buffer of a batch variable. Write the batch into it before calling run().
+  Variable getFeed(const std::string& name);
+
+  // Run one synchronous training step.
+  void run();
+
+  // Get the mean of a per-replica scalar output (e.g. the loss), weighted by shard size.
+  float fetchMean(const std::string& name) const;
+
+  size_t numReplicas() const { return replicas_.size(); }
+
+  memory::Workspace& replicaWorkspace(size_t i) { return replicas_[i]->workspace_; }
+
+ private:
+  struct Replica {
+    graph::Graph computeGraph_;  // forward and backward ops
+    graph::Graph updateGraph_;   // optimizer ops, sharing variables with computeGraph_
+    memory::Workspace workspace_;
+    std::unique_ptr<NaiveEngine> computeEngine_;
+    std::unique_ptr<NaiveEngine> updateEngine_;
+    SmallVec<Variable> batchVars_;
+    size_t batchOffset_;
+    size_t batchSize_;
+    float weight_;
+  };
+
+  void loop(size_t replicaId);
+  void scatter(size_t replicaId);
+  void allReduce(size_t replicaId);
+
+  memory::Workspace feeds_;
+  SmallVec<Variable> feedVars_;
+  Vec<memory::VariableBufferPtr> grads_;  // the arena of the gradients of each replica
+  Vec<std::unique_ptr<Replica>> replicas_;
+  Vec<std::thread> threads_;
+  util::Barrier stepBarrier_;     // main thread and replicas
+  util::Barrier replicaBarrier_;  // replicas only
+  bool stop_{false};
+};
+}
+}
@@ -1,6 +1,8 @@
 #include "Engine.h"
+#include <cstring>
 #include <random>
 #include "misc/CastEigen.h"
+#include "misc/InitFunction.h"
 namespace nnet {
 namespace engine {
 static thread_local std::default_random_engine* gGenerator;
@@ -11,14 +13,29 @@ std::default_random_engine& getGenerator() {
   return *gGenerator;
 }
 
+NaiveEngine::NaiveEngine(memory::Workspace& w, const graph::Graph& graph, size_t numThreads) : Engine(w, graph) {
+  if (numThreads == 0) {
+    numThreads = std::max(1U, std::thread::hardware_concurrency());
+  }
+  if (numThreads > 1) {
+    pool_.reset(new util::ThreadPool(numThreads));
+  }
+}
+
 #define castFN(__fn__) (std::bind(std::mem_fn(__fn__), this, std::placeholders::_1))
 
 void NaiveEngine::randomize(Engine::NameMappingFN fn) const {
-  if (!fn) {
-    fn = castFN(&Engine::getParamInGraph);
+  if (!fn) {  // the parameters, and the optimizer states they are trained with
+    fn = [this](const std::string& name) {
+      return graph::isStateName(name) ? getStateInGraph(name) : getParamInGraph(name);
+    };
   }
 
   this->accessVar(fn, [](Variable& var) {
+    if (var.attr_->specialResetFunction_) {  // e.g. the state of an optimizer
+      var.attr_->specialResetFunction_(var);
+      return;
+    }
     std::uniform_real_distribution<float> generator(-1.0, 1.0);
     LOG(INFO) << "Randomize " << var.attr_->name_;
     float* buf = (float*)var.buffer_->get();
@@ -29,69 +46,51 @@ void NaiveEngine::randomize(Engine::NameMappingFN fn) const {
 }
 
 void NaiveEngine::resetOrCreateGradient(Engine::NameMappingFN fn) const {
+  getPlan();  // gradients could be placed in the arena of the plan
   if (!fn) {
     fn = castFN(&Engine::getGradInGraph);
+    auto packed = workspace_.arena("grad");
+    if (packed != nullptr) {  // every packed gradient at once, the loop only visits the others
+      std::memset(packed->get(), 0, packed->getSize());
+      fn = [this](const std::string& name) { return workspace_.inArena(name) ? nullptr : getGradInGraph(name); };
+    }
   }
   this->accessVar(fn, [](Variable& var) {
     if (var.attr_->specialResetFunction_) {
       var.attr_->specialResetFunction_(var);
-    } else {
+    } else if (var.attr_->accumulateGrad_) {  // the others are overwritten by their only writer
       auto varArr = eigen::cast<eigen::Vector>(var).array();
       varArr = 0.0;
     }
   });
 }
 
-static SmallVec<Variable> toVar(memory::Workspace& workspace, const SmallVec<graph::VariableAttrPtr>& vars) {
-  SmallVec<Variable> retv;
-  for (auto iptAttr : vars) {
-    retv.emplace_back();
-    auto& ipt = retv.back();
-    ipt.attr_ = iptAttr;
-    if (ipt.attr_ == nullptr) {
-      ipt.buffer_ = nullptr;
+ExecutionPlan& NaiveEngine::getPlan() const {
+  // Every mini-batch, shape could be changed.
+  if (plan_ == nullptr || !plan_->isValid() || planMemoryCompiled_ != planMemory_ ||
+      packParametersCompiled_ != packParameters_) {
+    SmallVec<std::string> stages = {"inferenceShape"};
+    if (packParameters_) {
+      stages.push_back("packParameters");
+    }
+    if (planMemory_) {
+      stages.insert(stages.end(), {"inplace", "planMemory"});
     } else {
-      ipt.buffer_ = workspace(ipt.attr_);
+      stages.push_back("requestResource");
     }
+    plan_.reset(new ExecutionPlan(workspace_, graph_, stages));
+    planMemoryCompiled_ = planMemory_;
+    packParametersCompiled_ = packParameters_;
   }
-  return retv;
+  if (plan_->autotuner() != autotuner_) {
+    plan_->setAutotuner(autotuner_);
+  }
+  return *plan_;
 }
 
 void NaiveEngine::run(bool debug) const {
-  graph::Graph g = graph_;
-  // Every mini-batch, shape could be changed.
-  Map<std::string, Any> attrs;
-  attrs["workspace"] = &this->workspace_;
-  graph::compileGraph(&g, {"inferenceShape", "requestResource"}, attrs);
-
-  for (auto& op : g.ops_) {
-    auto& meta = graph::OpMeta::gAllOpMeta_[op.type_];
-    auto ipt = toVar(workspace_, op.inputs_);
-    auto opt = toVar(workspace_, op.outputs_);
-
-    if (debug) {
-      std::ostringstream sout;
-      sout << " From: ";
-      for (auto& i : op.inputs_) {
-        if (i == nullptr) {
-          sout << "nullptr";
-        } else {
-          sout << i->name_ << i->dims_ << " ";
-        }
-      }
-      sout << "-> ";
-      for (auto& o : op.outputs_) {
-        if (o == nullptr) {
-          sout << "nullptr";
-        } else {
-          sout << o->name_ << o->dims_ << " ";
-        }
-      }
-      LOG(DEBUG) << "Performing " << op.type_ << sout.str();
-    }
-
-    meta.kernels[graph::kDEVICE_CPU](ipt, opt, op.attrs_);
-  }
+  util::ThreadPool::Scope scope(pool_.get());
+  getPlan().run(debug, profiler_);
 }
 
 void NaiveEngine::printMean(NameMappingFN fn) const {
@@ -113,5 +112,16 @@ void NaiveEngine::accessVar(NameMappingFN fn, std::function<void(Variable&)> ten
     }
   }
 }
+
+extern Map<std::string, CreateEngineFN>& engines() {
+  static Map<std::string, CreateEngineFN> gEngines;
+  return gEngines;
+}
+
+static util::InitFunction init([] {
+  engines().insert({"naive", [](memory::Workspace& w, const graph::Graph& g, size_t numThreads) {
+                      return std::unique_ptr<Engine>(new NaiveEngine(w, g, numThreads));
+                    }});
+});
 }
 }
\ No newline at end of file
@@ -1,8 +1,10 @@
 #pragma once
 #include <Eigen/Dense>
 #include <boost/algorithm/string.hpp>
+#include "ExecutionPlan.h"
 #include "graph/ComputationGraph.h"
 #include "memory/Workspace.h"
+#include "misc/ThreadPool.h"
 
 namespace nnet {
 namespace engine {
@@ -19,9 +21,41 @@ class Engine {
   virtual void printMean(NameMappingFN fn = nullptr) const = 0;
   virtual void run(bool debug = false) const = 0;
 
+  // Profile every kernel invocation of run(). nullptr disables profiling.
+  void setProfiler(Profiler* profiler) { profiler_ = profiler; }
+
+  // Run the fastest kernel variant of each op for its shape, as measured by the autotuner. nullptr (the default) runs
+  // the default kernels.
+  void setAutotuner(Autotuner* autotuner) { autotuner_ = autotuner; }
+
+  /**
+   * Let outputs overwrite dead inputs (the inplace stage), and pack the intermediate variables whose live ranges do
+   * not overlap into one arena (the planMemory stage), instead of giving every variable its own buffer. Intermediate
+   * values are then overwritten during run(), only parameters, gradients of parameters, feeds and outputs no op reads
+   * could be read after it.
+   */
+  void setPlanMemory(bool planMemory) { planMemory_ = planMemory; }
+
+  /**
+   * Place the parameters, their gradients and the optimizer states in contiguous arenas of the workspace (the
+   * packParameters stage). Gradients are then zeroed by a single memset, and a fused optimizer updates every parameter
+   * as one array.
+   */
+  void setPackParameters(bool packParameters) { packParameters_ = packParameters; }
+
  public:
-  std::unique_ptr<Variable> getParamInGraph(const std::string& name) {
-    if (boost::algorithm::contains(name, ".param") && !boost::algorithm::contains(name, ".grad")) {
+  std::unique_ptr<Variable> getParamInGraph(const std::string& name) const {
+    if (graph::isParamName(name)) {
+      auto t = new Variable();
+      *t = workspace_.getVar(graph_.variables_.at(name));
+      return std::unique_ptr<Variable>(t);
+    } else {
+      return nullptr;
+    }
+  }
+
+  std::unique_ptr<Variable> getStateInGraph(const std::string& name) const {
+    if (graph::isStateName(name)) {
       auto t = new Variable();
       *t = workspace_.getVar(graph_.variables_.at(name));
       return std::unique_ptr<Variable>(t);
@@ -30,8 +64,9 @@ class Engine {
     }
   }
 
-  std::unique_ptr<Variable> getGradInGraph(const std::string& name) {
-    if (boost::algorithm::contains(name, ".grad")) {
+  // The gradients are float, the int32 rows of a row-sparse gradient (<grad>.rows) are not one.
+  std::unique_ptr<Variable> getGradInGraph(const std::string& name) const {
+    if (graph::isGradName(name) && graph_.variables_.at(name)->type_ == graph::kFLOAT32) {
       auto t = new Variable();
       *t = workspace_.getVar(graph_.variables_.at(name));
       return std::unique_ptr<Variable>(t);
@@ -43,19 +78,45 @@ class Engine {
  protected:
   const graph::Graph& graph_;
   memory::Workspace& workspace_;
+  Profiler* profiler_{nullptr};
+  Autotuner* autotuner_{nullptr};
+  bool planMemory_{false};
+  bool packParameters_{false};
 };
 
 class NaiveEngine : public Engine {
  public:
-  NaiveEngine(memory::Workspace& w, const graph::Graph& graph) : Engine(w, graph) {}
+  /**
+   * @param numThreads size of the thread pool kernels use for intra-op parallelism. 1 means single-threaded, 0 means
+   * one thread per hardware core.
+   */
+  NaiveEngine(memory::Workspace& w, const graph::Graph& graph, size_t numThreads = 1);
 
   void randomize(Engine::NameMappingFN fn = nullptr) const override;
   void resetOrCreateGradient(NameMappingFN fn = nullptr) const override;
   void run(bool debug = false) const override;
   void printMean(NameMappingFN fn = nullptr) const override;
 
+ protected:
+  // Get the cached execution plan, compile a new one if the feed shapes changed.
+  ExecutionPlan& getPlan() const;
+
+  std::unique_ptr<util::ThreadPool> pool_;
+
  private:
   void accessVar(NameMappingFN fn, std::function<void(Variable&)> tensorFN) const;
+
+  mutable std::unique_ptr<ExecutionPlan> plan_;
+  mutable bool planMemoryCompiled_{false};
+  mutable bool packParametersCompiled_{false};
 };
+
+using CreateEngineFN =
+    std::function<std::unique_ptr<Engine>(memory::Workspace& w, const graph::Graph& graph, size_t numThreads)>;
+extern Map<std::string, CreateEngineFN>& engines();
+inline std::unique_ptr<Engine> createEngine(const std::string& type, memory::Workspace& w, const graph::Graph& graph,
+                                            size_t numThreads = 1) {
+  return engines().at(type)(w, graph, numThreads);
+}
 }
 }
\ No newline at end of file
@@ -0,0 +1,1216 @@
+#define CATCH_CONFIG_MAIN
+#include <engine/Calibrator.h>
+#include <engine/DataParallelTrainer.h>
+#include <engine/Engine.h>
+#include <engine/ThreadedEngine.h>
+#include <unistd.h>
+#include "data/Checkpoint.h"
+#include "data/DataLoader.h"
+#include <misc/CastEigen.h>
+#include <misc/Gemm.h>
+#include <misc/Half.h>
+#include <misc/Int8.h>
+#include <misc/VecMath.h>
+#include <catch.hpp>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include "misc/InitFunction.h"
+
+using nnet::graph::Graph;
+using nnet::graph::Op;
+using nnet::graph::VariableAttrPtr;
+
+// X -> fc+sigmoid -> fc+softmax -> cross_entropy -> mean, with error_rate and optimizer ops (sgd by default).
+static void buildMLP(Graph* g, size_t batchSize, bool fuse = false, const std::string& precision = "",
+                     const nnet::Map<std::string, nnet::Any>& optimizer = {{"optimizer", std::string("sgd")},
+                                                                           {"learning_rate", 0.1f}}) {
+  auto F = nnet::graph::kFLOAT32;
+  auto x = g->createOrResizeVar("X", {batchSize, 20}, false, F);
+  auto label = g->createOrResizeVar("Label", {batchSize, 1}, false, nnet::graph::kINT32);
+  VariableAttrPtr input = x;
+  size_t width = 20;
+  const char* acts[] = {"sigmoid", "softmax"};
+  const size_t sizes[] = {16, 10};
+  for (size_t i = 0; i < 2; ++i) {
+    std::string prefix = "fc" + std::to_string(i);
+    auto w = g->createOrResizeVar(prefix + ".param.weight", {width, sizes[i]}, true, F);
+    auto b = g->createOrResizeVar(prefix + ".param.bias", {sizes[i], 1}, true, F);
+    auto fcOut = g->createOrResizeVar(prefix + "fc.output", {0}, true, F);
+    auto out = g->createOrResizeVar(prefix + ".output", {0}, true, F);
+    g->ops_.push_back(Op("fc", {input, w, b}, {fcOut}));
+    g->ops_.push_back(Op(acts[i], {fcOut}, {out}));
+    input = out;
+    width = sizes[i];
+  }
+  auto loss = g->createOrResizeVar("xe_loss.output", {0}, true, F);
+  auto errorRate = g->createOrResizeVar("error_rate", {0}, false, F);
+  auto avgLoss = g->createOrResizeVar("avg_loss.output", {0}, true, F);
+  g->ops_.push_back(Op("cross_entropy", {input, label}, {loss}));
+  g->ops_.push_back(Op("error_rate", {input, label}, {errorRate}));
+  g->ops_.push_back(Op("mean", {loss}, {avgLoss}));
+  nnet::graph::compileGraph(g, {"inferenceShape"});
+  if (fuse) {
+    nnet::graph::compileGraph(g, {"fuse"});
+  }
+  if (!precision.empty()) {
+    nnet::graph::compileGraph(g, {"mixedPrecision"}, {{"precision", precision}});
+  }
+  nnet::graph::compileGraph(g, {"backward"}, {{"loss_name", avgLoss->name_}});
+  nnet::graph::compileGraph(g, {"optimizer"}, optimizer);
+}
+
+static void feed(nnet::memory::Workspace& w, const Graph& g, size_t batchId) {
+  std::mt19937 engine(batchId);
+  std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+  auto x = w.getVar(g.variables_.at("X"));
+  auto label = w.getVar(g.variables_.at("Label"));
+  float* xBuf = (float*)x.buffer_->get();
+  int* lblBuf = (int*)label.buffer_->get();
+  for (size_t i = 0; i < nnet::details::product(x.attr_->dims_); ++i) {
+    xBuf[i] = dist(engine);
+  }
+  for (size_t i = 0; i < label.attr_->dims_[0]; ++i) {
+    lblBuf[i] = engine() % 10;
+  }
+}
+
+// Copy the parameters of an engine into the workspace of a graph with parameters of the same names and dims.
+static void copyParams(const nnet::engine::Engine& src, nnet::memory::Workspace& dst, const Graph& g) {
+  for (auto& v : g.variables_) {
+    auto param = src.getParamInGraph(v.first);
+    if (param == nullptr) continue;
+    std::memcpy(dst.getVar(v.second).buffer_->get(), param->buffer_->get(), param->buffer_->getSize());
+  }
+}
+
+// Train on the batches [first, first + n) given by feed, and return the loss of the last one.
+static float trainBatches(const nnet::engine::Engine& engine, nnet::memory::Workspace& w, const Graph& g, size_t n,
+                          size_t first = 0) {
+  for (size_t batchId = first; batchId < first + n; ++batchId) {
+    feed(w, g, batchId);
+    engine.resetOrCreateGradient();
+    engine.run();
+  }
+  return *(float*)w.getVar(g.variables_.at("avg_loss.output")).buffer_->get();
+}
+
+TEST_CASE("ThreadedEngine", "bit_identical_to_naive") {
+  nnet::util::InitFunction::apply();
+  Graph g;
+  buildMLP(&g, 32);
+
+  nnet::memory::Workspace naiveW;
+  nnet::memory::Workspace threadedW;
+  auto naive = nnet::engine::createEngine("naive", naiveW, g);
+  nnet::engine::ThreadedEngine threaded(threadedW, g, 4);
+  naive->randomize();
+  copyParams(*naive, threadedW, g);
+  trainBatches(*naive, naiveW, g, 20);
+  trainBatches(threaded, threadedW, g, 20);
+
+  for (auto& v : g.variables_) {
+    auto a = naiveW.getVar(v.second);
+    auto b = threadedW.getVar(v.second);
+    REQUIRE(a.buffer_->getSize() == b.buffer_->getSize());
+    INFO(v.first);
+    REQUIRE(std::memcmp(a.buffer_->get(), b.buffer_->get(), a.buffer_->getSize()) == 0);
+  }
+}
+
+TEST_CASE("DataParallelTrainer", "matches_single_replica") {
+  nnet::util::InitFunction::apply();
+  Graph g;
+  buildMLP(&g, 30);
+
+  nnet::engine::DataParallelTrainer trainer(g, 4);
+  trainer.randomize();
+  nnet::memory::Workspace w;
+  nnet::engine::NaiveEngine engine(w, g);
+  for (auto& v : g.variables_) {
+    if (engine.getParamInGraph(v.first) == nullptr) continue;
+    auto src = trainer.replicaWorkspace(0).getVar(v.second);
+    auto dst = w.getVar(v.second);
+    std::memcpy(dst.buffer_->get(), src.buffer_->get(), src.buffer_->getSize());
+  }
+
+  for (size_t batchId = 0; batchId < 10; ++batchId) {
+    feed(w, g, batchId);
+    for (auto name : {"X", "Label"}) {
+      auto src = w.getVar(g.variables_.at(name));
+      std::memcpy(trainer.getFeed(name).buffer_->get(), src.buffer_->get(), src.buffer_->getSize());
+    }
+    engine.resetOrCreateGradient();
+    engine.run();
+    trainer.run();
+    REQUIRE(trainer.fetchMean("avg_loss.output") ==
+            Approx(*(float*)w.getVar(g.variables_.at("avg_loss.output")).buffer_->get()).epsilon(1e-4));
+  }
+
+  for (auto& v : g.variables_) {
+    if (engine.getParamInGraph(v.first) == nullptr) continue;
+    INFO(v.first);
+    auto expected = nnet::eigen::cast<nnet::eigen::Vector>(w.getVar(v.second));
+    auto first = trainer.replicaWorkspace(0).getVar(v.second);
+    REQUIRE((nnet::eigen::cast<nnet::eigen::Vector>(first) - expected).cwiseAbs().maxCoeff() < 1e-4f);
+    for (size_t i = 1; i < trainer.numReplicas(); ++i) {
+      auto other = trainer.replicaWorkspace(i).getVar(v.second);
+      REQUIRE(std::memcmp(first.buffer_->get(), other.buffer_->get(), first.buffer_->getSize()) == 0);
+    }
+  }
+}
+
+TEST_CASE("Inference", "prune_to_fetch") {
+  nnet::util::InitFunction::apply();
+  Graph g;
+  buildMLP(&g, 16);
+  Graph infer = g.clone();
+  nnet::graph::compileGraph(&infer, {"inference"}, {{"fetch", nnet::SmallVec<std::string>{"fc1.output"}}});
+
+  nnet::SmallVec<std::string> types;
+  for (auto& op : infer.ops_) {
+    types.push_back(op.type_);
+  }
+  REQUIRE(types == nnet::SmallVec<std::string>{"fc", "sigmoid", "fc", "softmax"});
+  for (auto& v : infer.variables_) {
+    INFO(v.first);
+    REQUIRE(v.first.find(".grad") == std::string::npos);
+    if (v.first.find(".param") != std::string::npos) {
+      REQUIRE_FALSE(v.second->needBackward_);
+      REQUIRE(g.variables_.at(v.first)->needBackward_);
+    }
+  }
+
+  // The inference graph reads the parameters of the training workspace, and computes the same forward output.
+  nnet::memory::Workspace w;
+  nnet::engine::NaiveEngine trainer(w, g);
+  nnet::engine::NaiveEngine predictor(w, infer);
+  trainer.randomize();
+  feed(w, g, 0);
+  predictor.run();
+  auto output = nnet::eigen::cast<nnet::eigen::Vector>(w.getVar(infer.variables_.at("fc1.output")));
+  nnet::eigen::Vector expected = output;
+  trainer.resetOrCreateGradient();
+  trainer.run();
+  REQUIRE(std::memcmp(output.data(), expected.data(), expected.size() * sizeof(float)) == 0);
+
+  // A workspace used only for inference does not allocate gradients.
+  nnet::memory::Workspace inferW;
+  nnet::engine::NaiveEngine(inferW, infer).run();
+  for (auto& buf : inferW.varBuffers_) {
+    REQUIRE(buf.first.find(".grad") == std::string::npos);
+  }
+  REQUIRE(inferW.varBuffers_.size() == infer.variables_.size());
+}
+
+// Bytes of memory spanned by the buffers of a workspace, buffers sharing memory are counted once.
+static size_t memoryFootprint(const nnet::memory::Workspace& w) {
+  nnet::Vec<std::pair<const char*, const char*>> ranges;
+  for (auto& buf : w.varBuffers_) {
+    auto begin = (const char*)buf.second->get();
+    ranges.push_back({begin, begin + buf.second->getSize()});
+  }
+  std::sort(ranges.begin(), ranges.end());
+  size_t size = 0;
+  const char* end = nullptr;
+  for (auto& r : ranges) {
+    auto begin = std::max(r.first, end);
+    if (r.second > begin) {
+      size += r.second - begin;
+      end = r.second;
+    }
+  }
+  return size;
+}
+
+TEST_CASE("PlanMemory", "same_result_less_memory") {
+  nnet::util::InitFunction::apply();
+  Graph g;
+  buildMLP(&g, 64);
+
+  nnet::memory::Workspace w;
+  nnet::memory::Workspace naivePlannedW;
+  nnet::memory::Workspace threadedPlannedW;
+  nnet::engine::NaiveEngine engine(w, g);
+  nnet::engine::NaiveEngine naivePlanned(naivePlannedW, g);
+  nnet::engine::ThreadedEngine threadedPlanned(threadedPlannedW, g, 4);
+  naivePlanned.setPlanMemory(true);
+  threadedPlanned.setPlanMemory(true);
+  engine.randomize();
+  copyParams(engine, naivePlannedW, g);
+  copyParams(engine, threadedPlannedW, g);
+  for (size_t batchId = 0; batchId < 5; ++batchId) {
+    float loss = trainBatches(engine, w, g, 1, batchId);
+    REQUIRE(trainBatches(naivePlanned, naivePlannedW, g, 1, batchId) == loss);
+    REQUIRE(trainBatches(threadedPlanned, threadedPlannedW, g, 1, batchId) == loss);
+  }
+  for (auto& v : g.variables_) {
+    if (engine.getParamInGraph(v.first) == nullptr) continue;
+    INFO(v.first);
+    auto expected = w.getVar(v.second);
+    for (auto* plannedW : {&naivePlannedW, &threadedPlannedW}) {
+      auto actual = plannedW->getVar(v.second);
+      REQUIRE(std::memcmp(expected.buffer_->get(), actual.buffer_->get(), expected.buffer_->getSize()) == 0);
+    }
+  }
+  REQUIRE(memoryFootprint(naivePlannedW) < memoryFootprint(w));
+  // sigmoid and softmax overwrite the output of fc.
+  REQUIRE(naivePlannedW.bufferName("fc0.output") == "fc0fc.output");
+  REQUIRE(naivePlannedW.bufferName("fc1.output") == "fc1fc.output");
+  REQUIRE(w.bufferName("fc0.output") == "fc0.output");
+}
+
+TEST_CASE("Fuse", "matches_unfused") {
+  nnet::util::InitFunction::apply();
+  Graph g;
+  Graph fused;
+  buildMLP(&g, 32);
+  buildMLP(&fused, 32, true);
+  nnet::SmallVec<std::string> types;
+  for (size_t i = 0; i < 5; ++i) {
+    types.push_back(fused.ops_[i].type_);
+  }
+  REQUIRE(types == nnet::SmallVec<std::string>{"fc_bias_act", "fc", "softmax_cross_entropy", "error_rate", "mean"});
+  REQUIRE(fused.variables_.count("fc0fc.output") == 0);
+
+  nnet::memory::Workspace w;
+  nnet::memory::Workspace fusedW;
+  nnet::engine::NaiveEngine engine(w, g);
+  nnet::engine::NaiveEngine fusedEngine(fusedW, fused);
+  engine.randomize();
+  copyParams(engine, fusedW, fused);
+  for (size_t batchId = 0; batchId < 10; ++batchId) {
+    float loss = trainBatches(engine, w, g, 1, batchId);
+    REQUIRE(trainBatches(fusedEngine, fusedW, fused, 1, batchId) == Approx(loss).epsilon(1e-4));
+  }
+  for (auto& v : fused.variables_) {
+    if (engine.getParamInGraph(v.first) == nullptr) continue;
+    INFO(v.first);
+    auto expected = nnet::eigen::cast<nnet::eigen::Vector>(w.getVar(g.variables_.at(v.first)));
+    auto actual = nnet::eigen::cast<nnet::eigen::Vector>(fusedW.getVar(v.second));
+    REQUIRE((actual - expected).cwiseAbs().maxCoeff() < 1e-4f);
+  }
+}
+
+TEST_CASE("FusedOptimizer", "matches_an_op_per_parameter") {
+  nnet::util::InitFunction::apply();
+  for (std::string optimizer : {"sgd", "momentum", "adagrad", "adam"}) {
+    INFO(optimizer);
+    // The same MLP with an update op per parameter, and with the four parameters updated by one op.
+    Graph graphs[2];
+    nnet::memory::Workspace workspaces[2];
+    std::unique_ptr<nnet::engine::Engine> engines[2];
+    for (size_t i = 0; i < 2; ++i) {
+      buildMLP(&graphs[i], 32, false, "",
+               {{"optimizer", optimizer}, {"learning_rate", 0.05f}, {"fuse_optimizer", i == 1}});
+      size_t numOps = std::count_if(graphs[i].ops_.begin(), graphs[i].ops_.end(),
+                                    [&](const Op& op) { return op.type_ == optimizer; });
+      REQUIRE(numOps == (i == 0 ? 4UL : 1UL));
+      engines[i] = nnet::engine::createEngine("naive", workspaces[i], graphs[i]);
+    }
+    size_t numStates = optimizer == "sgd" ? 0 : optimizer == "adam" ? 3 : 1;
+    REQUIRE(graphs[1].ops_.back().inputs_.size() == 4 * (2 + numStates));
+
+    engines[0]->randomize();
+    engines[1]->randomize();
+    copyParams(*engines[0], workspaces[1], graphs[1]);
+    for (size_t i = 0; i < 2; ++i) {
+      trainBatches(*engines[i], workspaces[i], graphs[i], 5);
+    }
+
+    // The states have the same names, and the updates are bit-identical.
+    for (auto& v : graphs[0].variables_) {
+      if (engines[0]->getParamInGraph(v.first) == nullptr) continue;
+      INFO(v.first);
+      auto a = workspaces[0].getVar(v.second);
+      auto b = workspaces[1].getVar(graphs[1].variables_.at(v.first));
+      REQUIRE(a.buffer_->getSize() == b.buffer_->getSize());
+      REQUIRE(std::memcmp(a.buffer_->get(), b.buffer_->get(), a.buffer_->getSize()) == 0);
+    }
+    if (optimizer == "adam") {
+      REQUIRE(engines[1]->getParamInGraph("fc0.param.weight.state.step") == nullptr);
+      REQUIRE(engines[1]->getStateInGraph("fc0.param.weight.state.step") != nullptr);
+      auto step = workspaces[1].getVar(graphs[1].variables_.at("fc0.param.weight.state.step"));
+      REQUIRE(*(float*)step.buffer_->get() == 5.0f);
+    }
+  }
+}
+
+TEST_CASE("PackParameters", "same_result_in_arenas") {
+  nnet::util::InitFunction::apply();
+  Graph g;
+  buildMLP(&g, 32, false, "", {{"optimizer", std::string("adam")}, {"fuse_optimizer", true}});
+
+  // With the parameters, gradients and states in arenas, alone and with the memory of the plan packed as well.
+  nnet::memory::Workspace workspaces[3];
+  std::unique_ptr<nnet::engine::NaiveEngine> engines[3];
+  for (size_t i = 0; i < 3; ++i) {
+    engines[i].reset(new nnet::engine::NaiveEngine(workspaces[i], g));
+    engines[i]->setPackParameters(i != 0);
+    engines[i]->setPlanMemory(i == 2);
+  }
+  engines[0]->randomize();
+  copyParams(*engines[0], workspaces[1], g);
+  copyParams(*engines[0], workspaces[2], g);
+  for (size_t i = 0; i < 3; ++i) {
+    trainBatches(*engines[i], workspaces[i], g, 5);
+  }
+  for (auto& v : g.variables_) {
+    if (v.first.find(".param") == std::string::npos) continue;  // parameters, their gradients and states
+    INFO(v.first);
+    auto expected = workspaces[0].getVar(v.second);
+    for (size_t i = 1; i < 3; ++i) {
+      auto actual = workspaces[i].getVar(v.second);
+      REQUIRE(std::memcmp(expected.buffer_->get(), actual.buffer_->get(), expected.buffer_->getSize()) == 0);
+    }
+  }
+
+  // Each arena holds its variables one after the other, in the order of the parameters.
+  auto& w = workspaces[2];
+  const char* params[] = {"fc0.param.bias", "fc0.param.weight", "fc1.param.bias", "fc1.param.weight"};
+  for (std::string arena : {"param", "grad", "state.m", "state.v", "state.step"}) {
+    INFO(arena);
+    auto buffer = w.arena(arena);
+    REQUIRE(buffer != nullptr);
+    auto next = (char*)buffer->get();
+    for (std::string param : params) {
+      std::string name = arena == "param" ? param : arena == "grad" ? param + ".grad" : param + "." + arena;
+      REQUIRE(w.inArena(name));
+      REQUIRE(w.findBuffer(name)->get() == next);
+      next += g.variables_.at(name)->bytes();
+    }
+    REQUIRE(next == (char*)buffer->get() + buffer->getSize());
+  }
+  engines[2]->resetOrCreateGradient();
+  auto grads = nnet::eigen::Vector::Map((float*)w.arena("grad")->get(), w.arena("grad")->getSize() / sizeof(float));
+  REQUIRE(grads.isZero(0));
+
+  // A restored checkpoint replaces the buffers of the parameters, the next plan copies them into a new arena.
+  std::string path = "engine_test_pack.ckpt";
+  nnet::data::saveCheckpoint(g, w, path).get();
+  nnet::memory::Workspace restored;
+  nnet::engine::NaiveEngine engine(restored, g);
+  engine.setPackParameters(true);
+  engine.resetOrCreateGradient();
+  nnet::data::restoreCheckpoint(g, restored, path);
+  REQUIRE(restored.findBuffer("fc0.param.weight")->get() != restored.arena("param")->get());
+  engine.resetOrCreateGradient();
+  REQUIRE(restored.findBuffer("fc0.param.bias")->get() == restored.arena("param")->get());
+  REQUIRE(std::memcmp(restored.arena("param")->get(), w.arena("param")->get(), w.arena("param")->getSize()) == 0);
+  unlink(path.c_str());
+}
+
+TEST_CASE("SparseOptimizer", "updates_looked_up_rows") {
+  nnet::util::InitFunction::apply();
+  auto F = nnet::graph::kFLOAT32;
+  const int words[] = {3, 7, 3, 0, 7, 3, 9, 1};
+  const float lr = 0.5f;
+  for (std::string optimizer : {"sgd", "momentum", "adagrad", "adam"}) {
+    INFO(optimizer);
+    // Word -> lookup_table -> fc+softmax -> cross_entropy -> mean
+    Graph g;
+    auto word = g.createOrResizeVar("Word", {8, 1}, false, nnet::graph::kINT32);
+    auto label = g.createOrResizeVar("Label", {8, 1}, false, nnet::graph::kINT32);
+    auto table = g.createOrResizeVar("emb.param.table", {12, 6}, true, F);
+    auto emb = g.createOrResizeVar("emb.output", {0}, true, F);
+    auto w = g.createOrResizeVar("fc.param.weight", {6, 4}, true, F);
+    auto fcOut = g.createOrResizeVar("fc.output", {0}, true, F);
+    auto prob = g.createOrResizeVar("prob", {0}, true, F);
+    auto loss = g.createOrResizeVar("loss", {0}, true, F);
+    auto avgLoss = g.createOrResizeVar("avg_loss", {0}, true, F);
+    g.ops_.push_back(Op("lookup_table", {word, table}, {emb}));
+    g.ops_.push_back(Op("fc", {emb, w, nullptr}, {fcOut}));
+    g.ops_.push_back(Op("softmax", {fcOut}, {prob}));
+    g.ops_.push_back(Op("cross_entropy", {prob, label}, {loss}));
+    g.ops_.push_back(Op("mean", {loss}, {avgLoss}));
+    nnet::graph::compileGraph(&g, {"inferenceShape"});
+    nnet::graph::compileGraph(&g, {"backward"}, {{"loss_name", avgLoss->name_}});
+    nnet::graph::compileGraph(&g, {"optimizer"}, {{"optimizer", optimizer}, {"learning_rate", lr}});
+    nnet::SmallVec<std::string> types;
+    for (size_t i = g.ops_.size() - 2; i < g.ops_.size(); ++i) {
+      types.push_back(g.ops_[i].type_);
+    }
+    std::sort(types.begin(), types.end());
+    REQUIRE(types == nnet::SmallVec<std::string>{optimizer, "sparse_" + optimizer});
+
+    nnet::memory::Workspace ws;
+    nnet::engine::NaiveEngine engine(ws, g);
+    engine.randomize();
+    auto wordVar = ws.getVar(word);
+    auto labelVar = ws.getVar(label);
+    for (size_t i = 0; i < 8; ++i) {
+      ((int*)wordVar.buffer_->get())[i] = words[i];
+      ((int*)labelVar.buffer_->get())[i] = i % 4;
+    }
+    auto tableVar = ws.getVar(table);
+    nnet::eigen::Matrix before = nnet::eigen::cast<nnet::eigen::Matrix>(tableVar);
+    engine.resetOrCreateGradient();
+    engine.run();
+
+    // The gradient has a row per distinct word, the sum of the gradients of its lookups.
+    auto grad = ws.getVar(g.variables_.at("emb.param.table.grad"));
+    REQUIRE(grad.attr_->dims_ == nnet::SmallVec<size_t>{8, 6});
+    auto rows = (int*)ws.getVar(g.variables_.at("emb.param.table.grad.rows")).buffer_->get();
+    REQUIRE(std::vector<int>(rows, rows + 8) == std::vector<int>{0, 1, 3, 7, 9, -1, -1, -1});
+    REQUIRE(engine.getGradInGraph("emb.param.table.grad.rows") == nullptr);  // e.g. not printed by printMean
+    auto embGrad = nnet::eigen::cast<nnet::eigen::Matrix>(ws.getVar(g.variables_.at("emb.output.grad")));
+    nnet::eigen::Matrix dense = nnet::eigen::Matrix::Zero(12, 6);
+    for (size_t i = 0; i < 8; ++i) {
+      dense.row(words[i]) += embGrad.row(i);
+    }
+    auto G = nnet::eigen::cast<nnet::eigen::Matrix>(grad);
+    for (size_t i = 0; i < 5; ++i) {
+      REQUIRE((G.row(i) - dense.row(rows[i])).cwiseAbs().maxCoeff() < 1e-6f);
+    }
+
+    // Only the looked up rows are updated, a first momentum step is a sgd step.
+    nnet::eigen::Matrix expected = before;
+    if (optimizer == "adagrad") {
+      expected.array() -= lr * dense.array() / (dense.array().abs() + 1e-6f);
+    } else if (optimizer == "adam") {  // M / sqrt(V) is G / |G| after the bias corrections
+      expected.array() -= lr * dense.array() / (dense.array().abs() + 1e-8f / std::sqrt(1 - 0.999f));
+    } else {
+      expected -= lr * dense;
+    }
+    auto after = nnet::eigen::cast<nnet::eigen::Matrix>(tableVar);
+    for (size_t r = 0; r < 12; ++r) {
+      INFO(r);
+      if (dense.row(r).isZero()) {
+        REQUIRE((after.row(r) - before.row(r)).isZero());
+      } else {
+        REQUIRE((after.row(r) - expected.row(r)).cwiseAbs().maxCoeff() < 1e-5f);
+      }
+    }
+  }
+}
+
+TEST_CASE("SparseFC", "matches_dense_input") {
+  nnet::util::InitFunction::apply();
+  auto F = nnet::graph::kFLOAT32;
+  const size_t batch = 8, width = 300, maxNnz = 40;
+  // X -> fc -> softmax -> cross_entropy -> mean, with X dense in one graph and CSR in the other.
+  Graph graphs[2];
+  for (size_t i = 0; i < 2; ++i) {
+    auto& g = graphs[i];
+    auto x = g.createOrResizeVar("X", {batch, width}, false, i == 0 ? F : nnet::graph::kCSR_FLOAT32);
+    x->maxNnz_ = maxNnz;
+    auto label = g.createOrResizeVar("Label", {batch, 1}, false, nnet::graph::kINT32);
+    auto w = g.createOrResizeVar("fc.param.weight", {width, 4}, true, F);
+    auto b = g.createOrResizeVar("fc.param.bias", {4, 1}, true, F);
+    auto fcOut = g.createOrResizeVar("fc.output", {0}, true, F);
+    auto prob = g.createOrResizeVar("prob", {0}, true, F);
+    auto loss = g.createOrResizeVar("loss", {0}, true, F);
+    auto avgLoss = g.createOrResizeVar("avg_loss", {0}, true, F);
+    g.ops_.push_back(Op("fc", {x, w, b}, {fcOut}));
+    g.ops_.push_back(Op("softmax", {fcOut}, {prob}));
+    g.ops_.push_back(Op("cross_entropy", {prob, label}, {loss}));
+    g.ops_.push_back(Op("mean", {loss}, {avgLoss}));
+    nnet::graph::compileGraph(&g, {"inferenceShape"});
+    nnet::graph::compileGraph(&g, {"backward"}, {{"loss_name", avgLoss->name_}});
+    nnet::graph::compileGraph(&g, {"optimizer"}, {{"optimizer", std::string("sgd")}, {"learning_rate", 0.5f}});
+  }
+  REQUIRE(graphs[1].variables_.at("fc.param.weight.grad")->sparseRows_ == "fc.param.weight.grad.rows");
+  REQUIRE(graphs[1].variables_.at("fc.param.weight.grad")->dims_ == nnet::SmallVec<size_t>{maxNnz, 4});
+
+  nnet::memory::Workspace dense, sparse;
+  nnet::engine::NaiveEngine denseEngine(dense, graphs[0]);
+  nnet::engine::NaiveEngine sparseEngine(sparse, graphs[1]);
+  denseEngine.randomize();
+  for (auto name : {"fc.param.weight", "fc.param.bias"}) {
+    auto src = dense.getVar(graphs[0].variables_.at(name));
+    std::memcpy(sparse.getVar(graphs[1].variables_.at(name)).buffer_->get(), src.buffer_->get(),
+                src.buffer_->getSize());
+  }
+  auto weight = dense.getVar(graphs[0].variables_.at("fc.param.weight"));
+  nnet::eigen::Matrix before = nnet::eigen::cast<nnet::eigen::Matrix>(weight);
+
+  for (size_t batchId = 0; batchId < 3; ++batchId) {
+    std::mt19937 gen(batchId);
+    auto x = dense.getVar(graphs[0].variables_.at("X"));
+    auto X = nnet::eigen::cast<nnet::eigen::Matrix>(x);
+    X.setZero();
+    auto csr = nnet::eigen::csr(sparse.getVar(graphs[1].variables_.at("X")));
+    int nnz = 0;
+    for (size_t i = 0; i < batch; ++i) {
+      csr.rowOffsets_[i] = nnz;
+      for (size_t j = 0; j < 4; ++j) {  // a few columns per row, shared across rows
+        int col = (gen() % 50) * 6 + j;
+        csr.cols_[nnz] = col;
+        csr.values_[nnz] = (gen() % 100) / 100.0f;
+        X(i, col) = csr.values_[nnz++];
+      }
+    }
+    csr.rowOffsets_[batch] = nnz;
+    for (size_t i = 0; i < 2; ++i) {
+      auto label = (int*)(i == 0 ? dense : sparse).getVar(graphs[i].variables_.at("Label")).buffer_->get();
+      for (size_t j = 0; j < batch; ++j) label[j] = j % 4;
+    }
+    denseEngine.resetOrCreateGradient();
+    denseEngine.run();
+    sparseEngine.resetOrCreateGradient();
+    sparseEngine.run();
+    REQUIRE(*(float*)sparse.getVar(graphs[1].variables_.at("avg_loss")).buffer_->get() ==
+            Approx(*(float*)dense.getVar(graphs[0].variables_.at("avg_loss")).buffer_->get()).epsilon(1e-5));
+  }
+  for (auto name : {"fc.param.weight", "fc.param.bias"}) {
+    INFO(name);
+    auto expected = nnet::eigen::cast<nnet::eigen::Vector>(dense.getVar(graphs[0].variables_.at(name)));
+    auto actual = nnet::eigen::cast<nnet::eigen::Vector>(sparse.getVar(graphs[1].variables_.at(name)));
+    REQUIRE((actual - expected).cwiseAbs().maxCoeff() < 1e-5f);
+  }
+  // the columns of X which are always zero are not updated.
+  auto after = nnet::eigen::cast<nnet::eigen::Matrix>(sparse.getVar(graphs[1].variables_.at("fc.param.weight")));
+  for (size_t r = 0; r < width; r += 6) {
+    REQUIRE((after.row(r + 5) - before.row(r + 5)).isZero());
+  }
+}
+
+TEST_CASE("CpuAllocator", "reuses_blocks") {
+  nnet::util::InitFunction::apply();
+  using nnet::memory::CpuAllocator;
+  REQUIRE(CpuAllocator::sizeClass(1) == 64);
+  REQUIRE(CpuAllocator::sizeClass(64) == 64);
+  REQUIRE(CpuAllocator::sizeClass(65) == 80);
+  REQUIRE(CpuAllocator::sizeClass(100) == 112);
+  REQUIRE(CpuAllocator::sizeClass(1024) == 1024);
+  REQUIRE(CpuAllocator::sizeClass(1025) == 1280);
+
+  CpuAllocator allocator;
+  size_t capacity;
+  void* a = allocator.allocate(100, &capacity);
+  REQUIRE(capacity == 112);
+  REQUIRE((size_t)a % CpuAllocator::kAlignment == 0);
+  allocator.deallocate(a, capacity);
+  REQUIRE(allocator.stats().cachedBytes_ == 112);
+  void* b = allocator.allocate(110, &capacity);  // same class, reused
+  REQUIRE(b == a);
+  auto stats = allocator.stats();
+  REQUIRE(stats.numAllocs_ == 2);
+  REQUIRE(stats.numSystemAllocs_ == 1);
+  REQUIRE(stats.liveBytes_ == 112);
+  allocator.deallocate(b, capacity);
+  allocator.release();
+  REQUIRE(allocator.stats().cachedBytes_ == 0);
+
+  // A buffer which grew once does not allocate again below its capacity.
+  auto& global = nnet::memory::cpuAllocator();
+  nnet::memory::CpuVariableBuffer buf(100);
+  buf.resize(1000);
+  size_t numAllocs = global.stats().numAllocs_;
+  buf.resize(900);
+  buf.resize(1000);
+  REQUIRE(global.stats().numAllocs_ == numAllocs);
+
+  // Training does not allocate once the buffers of the first mini-batch exist.
+  Graph g;
+  buildMLP(&g, 32);
+  nnet::memory::Workspace w;
+  nnet::engine::NaiveEngine engine(w, g);
+  engine.setPlanMemory(true);
+  engine.randomize();
+  for (size_t batchId = 0; batchId < 5; ++batchId) {
+    if (batchId == 1) {
+      numAllocs = global.stats().numAllocs_;
+    }
+    feed(w, g, batchId);
+    engine.resetOrCreateGradient();
+    engine.run();
+  }
+  REQUIRE(global.stats().numAllocs_ == numAllocs);
+}
+
+TEST_CASE("MappedDataset", "feeds_without_copy") {
+  nnet::util::InitFunction::apply();
+  const char* path = "engine_test.nnet";
+  const size_t numRecords = 96, batch = 32;
+  {
+    nnet::data::DatasetWriter writer(path, numRecords,
+                                     {{"X", nnet::graph::kFLOAT32, 20}, {"Label", nnet::graph::kINT32, 1}});
+    std::mt19937 gen(0);
+    auto x = (float*)writer.data("X");
+    auto label = (int*)writer.data("Label");
+    for (size_t i = 0; i < numRecords * 20; ++i) x[i] = (gen() % 1000) / 1000.0f;
+    for (size_t i = 0; i < numRecords; ++i) label[i] = gen() % 10;
+  }
+  nnet::data::MappedDataset dataset(path);
+  REQUIRE(dataset.numRecords() == numRecords);
+  REQUIRE(dataset.field("X").width_ == 20);
+
+  Graph g;
+  buildMLP(&g, batch);
+  nnet::memory::Workspace mapped, copied;
+  nnet::engine::NaiveEngine mappedEngine(mapped, g);
+  nnet::engine::NaiveEngine copiedEngine(copied, g);
+  mappedEngine.setPlanMemory(true);
+  mappedEngine.randomize();
+  copyParams(mappedEngine, copied, g);
+  size_t numAllocs = 0, generation = 0;
+  for (size_t pass = 0; pass < 2; ++pass) {
+    for (size_t i = 0; i < numRecords / batch; ++i) {
+      if (pass == 1 && i == 0) {
+        numAllocs = nnet::memory::cpuAllocator().stats().numAllocs_;
+        generation = mapped.generation();
+      }
+      for (auto name : {"X", "Label"}) {
+        dataset.feed(mapped, g.variables_.at(name), name, i * batch);
+        dataset.copy(copied.getVar(g.variables_.at(name)), name, i * batch);
+      }
+      REQUIRE(std::memcmp(mapped.findBuffer("X")->get(), copied.findBuffer("X")->get(), batch * 20 * 4) == 0);
+      mappedEngine.resetOrCreateGradient();
+      mappedEngine.run();
+      copiedEngine.resetOrCreateGradient();
+      copiedEngine.run();
+      REQUIRE(*(float*)mapped.getVar(g.variables_.at("avg_loss.output")).buffer_->get() ==
+              *(float*)copied.getVar(g.variables_.at("avg_loss.output")).buffer_->get());
+    }
+  }
+  REQUIRE(dynamic_cast<nnet::memory::ExternalVariableBuffer*>(mapped.findBuffer("X")) != nullptr);
+  // the feeds are retargeted in place, the plan is kept without looking its feeds up again.
+  REQUIRE(nnet::memory::cpuAllocator().stats().numAllocs_ == numAllocs);
+  REQUIRE(mapped.generation() == generation);
+
+  // a file of an older format (or none) must be converted again.
+  REQUIRE(nnet::data::MappedDataset::readable(path));
+  {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.write("NNETDS01", 8);
+  }
+  REQUIRE_FALSE(nnet::data::MappedDataset::readable(path));
+  unlink(path);
+  REQUIRE_FALSE(nnet::data::MappedDataset::readable(path));
+}
+
+TEST_CASE("DataLoader", "shuffles_every_epoch") {
+  nnet::util::InitFunction::apply();
+  const char* path = "engine_test_loader.nnet";
+  const size_t numRecords = 100, batch = 32, width = 20;
+  {
+    nnet::data::FieldDesc x{"X", nnet::graph::kFLOAT32, width, nnet::data::kSTORE_UINT8, 1 / 255.0f};
+    nnet::data::DatasetWriter writer(path, numRecords, {x, {"Label", nnet::graph::kINT32, 1}});
+    auto pixels = (uint8_t*)writer.data("X");
+    auto label = (int*)writer.data("Label");
+    for (size_t i = 0; i < numRecords * width; ++i) pixels[i] = (i * 7) % 256;
+    for (size_t i = 0; i < numRecords; ++i) label[i] = i;
+  }
+  nnet::data::MappedDataset dataset(path);
+  float scale = dataset.field("X").scale_;
+
+  Graph g;
+  auto X = g.createOrResizeVar("X", {batch, width}, false, nnet::graph::kFLOAT32);
+  auto L = g.createOrResizeVar("Label", {batch, 1}, false, nnet::graph::kINT32);
+  // the labels of the batches of two epochs.
+  auto load = [&](size_t numWorkers, bool shuffle) {
+    nnet::data::DataLoaderOptions options;
+    options.batchSize_ = batch;
+    options.numWorkers_ = numWorkers;
+    options.shuffle_ = shuffle;
+    options.seed_ = 1;
+    nnet::data::DataLoader loader(dataset, {{X, "X"}, {L, "Label"}}, options);
+    REQUIRE(loader.numBatches() == numRecords / batch);
+    nnet::memory::Workspace w;
+    nnet::memory::VariableBuffer* xBuffer = nullptr;
+    nnet::Vec<int> labels;
+    for (size_t i = 0; i < 2 * loader.numBatches(); ++i) {
+      loader.next(w);
+      REQUIRE(loader.epoch() == i / loader.numBatches());
+      if (xBuffer == nullptr) xBuffer = w.findBuffer("X");
+      REQUIRE(w.findBuffer("X") == xBuffer);  // retargeted, not replaced
+      auto x = (const float*)w.findBuffer("X")->get();
+      auto label = (const int*)w.findBuffer("Label")->get();
+      for (size_t k = 0; k < batch; ++k) {
+        for (size_t j = 0; j < width; ++j) {
+          REQUIRE(x[k * width + j] == ((label[k] * width + j) * 7 % 256) * scale);
+        }
+        labels.push_back(label[k]);
+      }
+    }
+    return labels;
+  };
+
+  auto sequential = load(1, false);
+  for (size_t i = 0; i < sequential.size(); ++i) {
+    REQUIRE(sequential[i] == int(i % (numRecords / batch * batch)));
+  }
+  auto shuffled = load(2, true);
+  REQUIRE(shuffled != sequential);
+  size_t epochSize = shuffled.size() / 2;
+  nnet::Vec<int> first(shuffled.begin(), shuffled.begin() + epochSize);
+  nnet::Vec<int> second(shuffled.begin() + epochSize, shuffled.end());
+  REQUIRE(first != second);  // a new permutation every epoch
+  for (auto* epoch : {&first, &second}) {
+    std::sort(epoch->begin(), epoch->end());
+    REQUIRE(std::unique(epoch->begin(), epoch->end()) == epoch->end());  // no record twice in an epoch
+  }
+  // the batches only depend on the seed, not on the number of workers.
+  REQUIRE(load(3, true) == shuffled);
+
+  uint8_t bytes[37];
+  float converted[37];
+  for (size_t i = 0; i < 37; ++i) bytes[i] = 255 - i * 5;
+  nnet::data::convertUint8(bytes, converted, 37, 0.5f);
+  for (size_t i = 0; i < 37; ++i) REQUIRE(converted[i] == bytes[i] * 0.5f);
+  unlink(path);
+}
+
+TEST_CASE("Checkpoint", "restores_snapshot") {
+  nnet::util::InitFunction::apply();
+  const char* path = "engine_test.ckpt";
+  Graph g;
+  buildMLP(&g, 32);
+  nnet::memory::Workspace w;
+  nnet::engine::NaiveEngine engine(w, g);
+  engine.randomize();
+  for (size_t batchId = 0; batchId < 3; ++batchId) {
+    feed(w, g, batchId);
+    engine.resetOrCreateGradient();
+    engine.run();
+  }
+  nnet::Map<std::string, nnet::Vec<char>> snapshot;
+  for (auto& v : g.variables_) {
+    auto param = engine.getParamInGraph(v.first);
+    if (param == nullptr) continue;
+    auto data = (const char*)param->buffer_->get();
+    snapshot[v.first].assign(data, data + param->buffer_->getSize());
+  }
+  REQUIRE(snapshot.size() == 4);
+  auto saving = nnet::data::saveCheckpoint(g, w, path);
+  // training goes on while the checkpoint is written, the file holds the values at the time of the call.
+  for (size_t batchId = 3; batchId < 5; ++batchId) {
+    feed(w, g, batchId);
+    engine.resetOrCreateGradient();
+    engine.run();
+  }
+  saving.wait();
+
+  nnet::memory::Workspace mapped, planned;
+  nnet::engine::NaiveEngine mappedEngine(mapped, g);
+  nnet::engine::NaiveEngine plannedEngine(planned, g);
+  // a plan is compiled with random parameters before restoring, it must not keep reading them.
+  plannedEngine.randomize();
+  feed(planned, g, 0);
+  plannedEngine.resetOrCreateGradient();
+  plannedEngine.run();
+  for (auto* restored : {&mapped, &planned}) {
+    nnet::data::restoreCheckpoint(g, *restored, path);
+  }
+  for (auto& item : snapshot) {
+    INFO(item.first);
+    for (auto* restored : {&mapped, &planned}) {
+      auto buf = restored->findBuffer(item.first);
+      REQUIRE(dynamic_cast<nnet::memory::ExternalVariableBuffer*>(buf) != nullptr);  // not copied
+      REQUIRE(buf->getSize() == item.second.size());
+      REQUIRE(std::memcmp(buf->get(), item.second.data(), item.second.size()) == 0);
+    }
+  }
+  for (size_t batchId = 3; batchId < 5; ++batchId) {
+    for (auto* restored : {&mapped, &planned}) {
+      feed(*restored, g, batchId);
+    }
+    mappedEngine.resetOrCreateGradient();
+    mappedEngine.run();
+    plannedEngine.resetOrCreateGradient();
+    plannedEngine.run();
+    REQUIRE(*(float*)mapped.getVar(g.variables_.at("avg_loss.output")).buffer_->get() ==
+            *(float*)planned.getVar(g.variables_.at("avg_loss.output")).buffer_->get());
+  }
+  // the restored run ends where the original one did.
+  for (auto& item : snapshot) {
+    REQUIRE(std::memcmp(mapped.findBuffer(item.first)->get(), w.findBuffer(item.first)->get(),
+                        item.second.size()) == 0);
+  }
+  // updating the parameters read in place does not change the file.
+  nnet::memory::Workspace again;
+  nnet::data::restoreCheckpoint(g, again, path);
+  for (auto& item : snapshot) {
+    REQUIRE(std::memcmp(again.findBuffer(item.first)->get(), item.second.data(), item.second.size()) == 0);
+  }
+  unlink(path);
+}
+
+TEST_CASE("MixedPrecision", "matches_float") {
+  nnet::util::InitFunction::apply();
+  using nnet::util::bf16ToFloat;
+  using nnet::util::floatToBF16;
+  using nnet::util::floatToFP16;
+  using nnet::util::fp16ToFloat;
+  REQUIRE(floatToBF16(1.0f) == 0x3f80);
+  REQUIRE(floatToBF16(bf16ToFloat(0x3f80) + 1.0f / 256) == 0x3f80);
+  REQUIRE(floatToBF16(bf16ToFloat(0x3f81) + 1.0f / 256) == 0x3f82);  // a tie rounds to even
+  REQUIRE(std::isnan(bf16ToFloat(floatToBF16(NAN))));
+  REQUIRE(floatToFP16(1.0f) == 0x3c00);
+  REQUIRE(floatToFP16(-2.5f) == 0xc100);
+  REQUIRE(floatToFP16(65504.0f) == 0x7bff);
+  REQUIRE(floatToFP16(65520.0f) == 0x7c00);  // infinity
+  REQUIRE(floatToFP16(1.0f / 16777216) == 0x0001);  // the smallest subnormal
+  REQUIRE(fp16ToFloat(0x0001) == 1.0f / 16777216);
+  REQUIRE(std::isnan(fp16ToFloat(floatToFP16(NAN))));
+  // the vectorized conversions match the scalar ones.
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<float> dist(-70000.0f, 70000.0f);
+  nnet::Vec<float> values(1001);
+  for (size_t i = 0; i < values.size(); ++i) values[i] = dist(gen) / (1 << (i % 32));
+  for (auto type : {nnet::graph::kBF16, nnet::graph::kFP16}) {
+    nnet::Vec<uint16_t> halves(values.size());
+    nnet::Vec<float> back(values.size());
+    nnet::util::fromFloat(values.data(), type, halves.data(), values.size());
+    nnet::util::toFloat(halves.data(), type, back.data(), values.size());
+    for (size_t i = 0; i < values.size(); ++i) {
+      auto h = type == nnet::graph::kBF16 ? floatToBF16(values[i]) : floatToFP16(values[i]);
+      REQUIRE(halves[i] == h);
+      REQUIRE(back[i] == (type == nnet::graph::kBF16 ? bf16ToFloat(h) : fp16ToFloat(h)));
+    }
+  }
+
+  for (std::string precision : {"bf16", "fp16"}) {
+    Graph g;
+    Graph mixed;
+    buildMLP(&g, 64, true);
+    buildMLP(&mixed, 64, true, precision);
+    auto hidden = mixed.variables_.at("fc0.output");
+    REQUIRE(hidden->type_ == (precision == "bf16" ? nnet::graph::kBF16 : nnet::graph::kFP16));
+    REQUIRE(mixed.variables_.at("fc0.output.grad")->type_ == nnet::graph::kFLOAT32);
+    REQUIRE(mixed.variables_.at("fc1.output")->type_ == nnet::graph::kFLOAT32);  // read by softmax
+
+    nnet::memory::Workspace w;
+    nnet::memory::Workspace mixedW;
+    nnet::engine::NaiveEngine engine(w, g);
+    nnet::engine::NaiveEngine mixedEngine(mixedW, mixed);
+    engine.setPlanMemory(true);
+    mixedEngine.setPlanMemory(true);
+    engine.randomize();
+    copyParams(engine, mixedW, mixed);
+    for (size_t batchId = 0; batchId < 10; ++batchId) {
+      float loss = trainBatches(engine, w, g, 1, batchId);
+      REQUIRE(trainBatches(mixedEngine, mixedW, mixed, 1, batchId) == Approx(loss).epsilon(2e-2));
+    }
+    REQUIRE(mixedW.findBuffer("fc0.output")->getSize() == 64 * 16 * 2);
+    REQUIRE(memoryFootprint(mixedW) < memoryFootprint(w));
+  }
+}
+
+TEST_CASE("Quantize", "matches_float") {
+  nnet::util::InitFunction::apply();
+  // every int8 kernel the CPU runs computes the same GEMM as the scalar one, for dims not multiple of the panels.
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  size_t m = 7, k = 37, n = 21;
+  size_t kPad = nnet::util::roundUp(k, 4), nPad = nnet::util::roundUp(n, 16);
+  nnet::Vec<float> weights(k * n);
+  for (auto& v : weights) v = dist(gen);
+  nnet::Vec<int8_t> packed(kPad * nPad);
+  nnet::Vec<float> scales(n);
+  nnet::Vec<int32_t> sums(n);
+  nnet::util::packInt8Weights(weights.data(), k, n, packed.data(), scales.data(), sums.data());
+  float maxAbs = 0;
+  for (size_t l = 0; l < k; ++l) maxAbs = std::max(maxAbs, std::abs(weights[l * n]));
+  REQUIRE(scales[0] == maxAbs / 127);
+  nnet::Vec<uint8_t> x(m * kPad);
+  for (auto& v : x) v = gen() % 256;
+  nnet::Vec<int32_t> expected(m * nPad), actual(m * nPad);
+  nnet::util::gemmU8S8(x.data(), m, kPad, packed.data(), nPad, expected.data(), nnet::util::kINT8_SCALAR);
+  for (auto kernel : {nnet::util::kINT8_AVX2, nnet::util::kINT8_AVX512_VNNI}) {
+    if (!nnet::util::hasInt8Kernel(kernel)) continue;
+    INFO(nnet::util::int8KernelName(kernel));
+    nnet::util::gemmU8S8(x.data(), m, kPad, packed.data(), nPad, actual.data(), kernel);
+    REQUIRE(actual == expected);
+  }
+  // the dequantized products are close to the float ones.
+  for (size_t i = 0; i < m; ++i) {
+    for (size_t j = 0; j < n; ++j) {
+      float product = 0;
+      for (size_t l = 0; l < k; ++l) product += (x[i * kPad + l] - 128) * weights[l * n + j];
+      REQUIRE((expected[i * nPad + j] - 128 * sums[j]) * scales[j] == Approx(product).margin(k * 128 * 0.01));
+    }
+  }
+
+  Graph g;
+  buildMLP(&g, 64, true);
+  Graph infer = g.clone();
+  nnet::graph::compileGraph(&infer, {"inference"}, {{"fetch", nnet::SmallVec<std::string>{"fc1.output"}}});
+  nnet::memory::Workspace w;
+  nnet::engine::NaiveEngine trainer(w, g);
+  nnet::engine::NaiveEngine predictor(w, infer);
+  trainer.randomize();
+  nnet::engine::Calibrator calibrator(infer);
+  for (size_t batchId = 0; batchId < 4; ++batchId) {
+    feed(w, g, batchId);
+    predictor.run();
+    calibrator.observe(w);
+  }
+  REQUIRE(calibrator.ranges().size() == 2);
+  REQUIRE(calibrator.ranges().at("X") <= 1.0f);
+
+  auto packedWeights = calibrator.packWeights(w);
+  REQUIRE(packedWeights == nnet::Set<std::string>{"fc0.param.weight", "fc1.param.weight"});
+  Graph quantized = infer.clone();
+  nnet::graph::compileGraph(&quantized, {"quantize"},
+                            {{"calibration", calibrator.ranges()}, {"packed_weights", packedWeights}});
+  nnet::SmallVec<std::string> types;
+  for (auto& op : quantized.ops_) {
+    types.push_back(op.type_);
+  }
+  REQUIRE(types == nnet::SmallVec<std::string>{"fc_int8", "fc_int8", "softmax_cross_entropy"});
+  REQUIRE(quantized.variables_.at("fc0.output")->type_ == nnet::graph::kINT8);  // requantized for fc1
+  REQUIRE(quantized.variables_.count("fc0.param.weight") == 0);
+  REQUIRE(quantized.variables_.at("fc0.param.weight.int8")->dims_ == nnet::SmallVec<size_t>{20, 16});
+
+  feed(w, g, 5);
+  predictor.run();
+  nnet::eigen::Vector probs = nnet::eigen::cast<nnet::eigen::Vector>(w.getVar(infer.variables_.at("fc1.output")));
+  nnet::engine::NaiveEngine(w, quantized).run();
+  auto int8Probs = nnet::eigen::cast<nnet::eigen::Vector>(w.getVar(quantized.variables_.at("fc1.output")));
+  REQUIRE((int8Probs - probs).cwiseAbs().maxCoeff() < 2e-2);
+  REQUIRE((int8Probs - probs).cwiseAbs().mean() < 1e-3);
+}
+
+// |y - ref| in units in the last place of the float nearest to ref.
+static double ulpError(float y, double ref) {
+  float r = (float)ref;
+  if (std::isinf(r)) return y == r ? 0 : INFINITY;
+  return std::abs(y - ref) / std::ldexp(1.0, std::max(std::ilogb(r), -126) - 23);
+}
+
+TEST_CASE("VecMath", "accuracy") {
+  struct Function {
+    const char* name_;
+    nnet::util::VecMathFN nnet::util::VecMathKernels::*kernel_;
+    double (*reference_)(double);
+    float min_;  // the domain over which the bound is measured
+    double maxUlp_;
+  };
+  const Function functions[] = {
+      {"exp", &nnet::util::VecMathKernels::exp_, [](double x) { return std::exp(x); }, -87.33f, 1.5},
+      {"log", &nnet::util::VecMathKernels::log_, [](double x) { return std::log(x); }, 0, 1},
+      {"tanh", &nnet::util::VecMathKernels::tanh_, [](double x) { return std::tanh(x); }, -INFINITY, 2.5},
+      {"sigmoid", &nnet::util::VecMathKernels::sigmoid_, [](double x) { return 1 / (1 + std::exp(-x)); }, -87.33f, 2.5},
+  };
+  // a sample of all the finite floats, of both signs.
+  nnet::Vec<float> values;
+  for (uint32_t bits = 0; bits < 0x7f800000; bits += 4099) {
+    float v;
+    std::memcpy(&v, &bits, sizeof(v));
+    values.push_back(v);
+    values.push_back(-v);
+  }
+  nnet::Vec<float> results(values.size());
+  for (int isa = nnet::util::kISA_SCALAR; isa < nnet::util::kNUM_ISAS; ++isa) {
+    if (!nnet::util::hasSimdIsa((nnet::util::SimdIsa)isa)) continue;
+    auto& kernels = nnet::util::vecMathKernels((nnet::util::SimdIsa)isa);
+    for (auto& f : functions) {
+      INFO(nnet::util::simdIsaName((nnet::util::SimdIsa)isa) << " " << f.name_);
+      (kernels.*f.kernel_)(values.data(), results.data(), values.size());
+      double maxUlp = 0;
+      for (size_t i = 0; i < values.size(); ++i) {
+        if (values[i] < f.min_ || (f.kernel_ == &nnet::util::VecMathKernels::exp_ && values[i] > 88.72f)) continue;
+        maxUlp = std::max(maxUlp, ulpError(results[i], f.reference_(values[i])));
+      }
+      REQUIRE(maxUlp <= f.maxUlp_);
+
+      const float special[] = {NAN, INFINITY, -INFINITY, 0.0f, -0.0f, -1.0f, 100.0f, -100.0f, 1e-40f, 0.5f};
+      float y[10];
+      (kernels.*f.kernel_)(special, y, 10);  // the tail of a vector too
+      REQUIRE(std::isnan(y[0]));
+      for (size_t i = 1; i < 10; ++i) {
+        INFO(special[i]);
+        float ref = (float)f.reference_(special[i]);
+        if (std::isnan(ref) || std::isinf(ref) || ref == 0) {
+          REQUIRE((std::isnan(ref) ? std::isnan(y[i]) : y[i] == ref));
+        } else if (std::abs(ref) > 1.17549435e-38f) {
+          REQUIRE(ulpError(y[i], f.reference_(special[i])) <= f.maxUlp_);
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("OpAttrs", "bound_when_compiled") {
+  nnet::util::InitFunction::apply();
+  // scale_test computes O = scale * X, negated with the mode "negate". Its kernel reads both from a ScaleAttrs.
+  struct ScaleAttrs {
+    float scale_;
+    bool negate_;
+  };
+  nnet::graph::OpMeta meta;
+  meta.type_ = "scale_test";
+  meta.kernels[nnet::graph::kDEVICE_CPU] = [](const nnet::SmallVec<nnet::graph::Variable>& inputs,
+                                              nnet::SmallVec<nnet::graph::Variable>& outputs,
+                                              const nnet::graph::OpAttrs& attrs) {
+    auto& scaleAttrs = attrs.get<ScaleAttrs>();
+    float scale = scaleAttrs.negate_ ? -scaleAttrs.scale_ : scaleAttrs.scale_;
+    nnet::eigen::cast<nnet::eigen::Matrix>(outputs[0]) = scale * nnet::eigen::cast<nnet::eigen::Matrix>(inputs[0]);
+  };
+  meta.shapeInferer_ = [](const nnet::SmallVec<VariableAttrPtr>& inputs,
+                          const nnet::SmallVec<VariableAttrPtr>& outputs) { outputs[0]->dims_ = inputs[0]->dims_; };
+  meta.setAttrs<ScaleAttrs>();
+  meta.attrMeta_.push_back(nnet::graph::AttributeMeta::create<float>("scale", "factor of X"));
+  meta.attrMeta_.back()->bind(&ScaleAttrs::scale_).constraints<float>().defaultValue(2.0f);
+  meta.attrMeta_.push_back(nnet::graph::AttributeMeta::create<std::string>("mode", "keep or negate"));
+  meta.attrMeta_.back()->bind<std::string, ScaleAttrs>([](const std::string& mode, ScaleAttrs* attrs) {
+    attrs->negate_ = mode == "negate";
+  });
+  meta.attrMeta_.back()->constraints<std::string>().defaultValue("keep").add([](std::string* mode, bool) {
+    REQUIRE((*mode == "keep" || *mode == "negate"));
+  });
+  nnet::graph::OpMeta::gAllOpMeta_[meta.type_] = meta;
+
+  auto bound = meta.bindAttrs({{"mode", std::string("negate")}});
+  REQUIRE(bound.get<ScaleAttrs>().scale_ == 2.0f);  // the default
+  REQUIRE(bound.get<ScaleAttrs>().negate_);
+  REQUIRE(*bound.type() == typeid(ScaleAttrs));
+  REQUIRE(meta.bindAttrs({}).get<ScaleAttrs>().negate_ == false);
+  REQUIRE(nnet::graph::OpMeta::gAllOpMeta_.at("sigmoid").bindAttrs({}).data() == nullptr);  // reads no attribute
+
+  // the op is added without its defaults, as by a stage, and bound when the plan is compiled.
+  Graph g;
+  auto x = g.createOrResizeVar("X", {2, 3}, false, nnet::graph::kFLOAT32);
+  auto o = g.createOrResizeVar("O", {2, 3}, false, nnet::graph::kFLOAT32);
+  g.ops_.push_back(Op("scale_test", {x}, {o}, {{"scale", 3.0f}}));
+  nnet::memory::Workspace w;
+  nnet::engine::NaiveEngine engine(w, g);
+  auto X = nnet::eigen::cast<nnet::eigen::Matrix>(w.getVar(x));
+  X.setRandom();
+  engine.run();
+  REQUIRE((nnet::eigen::cast<nnet::eigen::Matrix>(w.getVar(o)).array() == 3.0f * X.array()).all());
+  REQUIRE(g.ops_[0].attrs_.count("mode") == 0);  // the attributes of the graph are left as they are
+  nnet::graph::OpMeta::gAllOpMeta_.erase(meta.type_);
+}
+
+TEST_CASE("Autotuner", "picks_fastest_variant") {
+  nnet::util::InitFunction::apply();
+  // copy_test copies X to O, its default kernel is slow, and a variant is not supported.
+  static size_t numSlowCalls = 0, numFastCalls = 0;
+  auto copy = [](const nnet::SmallVec<nnet::graph::Variable>& inputs, nnet::SmallVec<nnet::graph::Variable>& outputs) {
+    std::memcpy(outputs[0].buffer_->get(), inputs[0].buffer_->get(), inputs[0].buffer_->getSize());
+  };
+  nnet::graph::OpMeta meta;
+  meta.type_ = "copy_test";
+  meta.kernels[nnet::graph::kDEVICE_CPU] = [copy](const nnet::SmallVec<nnet::graph::Variable>& inputs,
+                                                  nnet::SmallVec<nnet::graph::Variable>& outputs,
+                                                  const nnet::graph::OpAttrs&) {
+    ++numSlowCalls;
+    usleep(200);
+    copy(inputs, outputs);
+  };
+  meta.cpuVariants_.push_back({"fast", [copy](const nnet::SmallVec<nnet::graph::Variable>& inputs,
+                                              nnet::SmallVec<nnet::graph::Variable>& outputs,
+                                              const nnet::graph::OpAttrs&) {
+                                 ++numFastCalls;
+                                 copy(inputs, outputs);
+                               },
+                               nullptr});
+  meta.cpuVariants_.push_back({"unsupported", nullptr, [](const nnet::SmallVec<VariableAttrPtr>&,
+                                                          const nnet::SmallVec<VariableAttrPtr>&) { return false; }});
+  meta.shapeInferer_ = [](const nnet::SmallVec<VariableAttrPtr>& inputs,
+                          const nnet::SmallVec<VariableAttrPtr>& outputs) { outputs[0]->dims_ = inputs[0]->dims_; };
+  nnet::graph::OpMeta::gAllOpMeta_[meta.type_] = meta;
+
+  const char* path = "engine_test.autotune";
+  unlink(path);
+  Graph g;
+  auto x = g.createOrResizeVar("X", {4, 3}, false, nnet::graph::kFLOAT32);
+  auto o = g.createOrResizeVar("O", {0}, false, nnet::graph::kFLOAT32);
+  g.ops_.push_back(Op("copy_test", {x}, {o}));
+  auto run = [&](nnet::engine::Autotuner* autotuner, size_t batchSize) {
+    x->dims_[0] = batchSize;
+    nnet::memory::Workspace w;
+    nnet::engine::NaiveEngine engine(w, g);
+    engine.setAutotuner(autotuner);
+    for (size_t i = 0; i < 2; ++i) {
+      auto xBuf = (float*)w.getVar(x).buffer_->get();
+      for (size_t j = 0; j < batchSize * 3; ++j) xBuf[j] = i * 100 + j;
+      numSlowCalls = numFastCalls = 0;
+      engine.run();
+      REQUIRE(std::memcmp(w.getVar(o).buffer_->get(), xBuf, batchSize * 3 * sizeof(float)) == 0);
+    }
+  };
+  {
+    nnet::engine::Autotuner autotuner(path);
+    run(&autotuner, 4);
+    REQUIRE(autotuner.numTuned() == 1);
+    REQUIRE(autotuner.winner(nnet::engine::Autotuner::key(g.ops_[0])) == "fast");
+    REQUIRE(numSlowCalls == 0);  // the second run only calls the winner
+    REQUIRE(numFastCalls == 1);
+    run(nullptr, 4);
+    REQUIRE(numSlowCalls == 1);  // without an autotuner, the default kernel
+  }
+  {
+    // a later run reads the pick from the cache, and only tunes a new shape.
+    nnet::engine::Autotuner autotuner(path);
+    run(&autotuner, 4);
+    REQUIRE(autotuner.numTuned() == 0);
+    REQUIRE(numFastCalls == 1);
+    run(&autotuner, 5);
+    REQUIRE(autotuner.numTuned() == 1);
+  }
+  REQUIRE(nnet::engine::Autotuner(path).winner(nnet::engine::Autotuner::key(g.ops_[0])) == "fast");
+  nnet::graph::OpMeta::gAllOpMeta_.erase(meta.type_);
+  unlink(path);
+
+  // the variants of fc, sigmoid and softmax compute the same MLP.
+  Graph mlp;
+  buildMLP(&mlp, 8);
+  nnet::memory::Workspace tunedW, defaultW;
+  nnet::engine::NaiveEngine tuned(tunedW, mlp), untuned(defaultW, mlp);
+  nnet::engine::Autotuner autotuner;
+  tuned.setAutotuner(&autotuner);
+  tuned.randomize();
+  copyParams(tuned, defaultW, mlp);
+  for (size_t batchId = 0; batchId < 5; ++batchId) {
+    float loss = trainBatches(untuned, defaultW, mlp, 1, batchId);
+    REQUIRE(trainBatches(tuned, tunedW, mlp, 1, batchId) == Approx(loss).epsilon(1e-5));
+  }
+  REQUIRE(autotuner.numTuned() == 6);  // the two fc and fc_grad, sigmoid and softmax
+}
+
+TEST_CASE("Gemm", "matches_reference") {
+  struct Shape {
+    size_t m_, n_, k_;
+  };
+  // edge tiles, several blocks of k, of rows and of columns, and k = 0.
+  const Shape shapes[] = {{1, 1, 1}, {7, 5, 3}, {37, 45, 300}, {150, 33, 20}, {3, 2100, 5}, {4, 6, 0}};
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  nnet::util::ThreadPool pool(3);
+  for (auto& shape : shapes) {
+    size_t m = shape.m_, n = shape.n_, k = shape.k_;
+    nnet::Vec<float> A(m * k), B(k * n), bias(n), C0(m * n);
+    for (auto* v : {&A, &B, &bias, &C0}) {
+      for (auto& x : *v) x = dist(gen);
+    }
+    for (int flags = 0; flags < 16; ++flags) {
+      bool transA = flags & 1, transB = flags & 2;
+      nnet::util::GemmEpilogue epilogue;
+      epilogue.accumulate_ = flags & 4;
+      epilogue.bias_ = flags & 8 ? bias.data() : nullptr;
+      epilogue.tanh_ = flags & 8;
+      // A and B hold op(A) and op(B), transposed in memory when transA or transB.
+      auto a = [&](size_t i, size_t p) { return transA ? A[p * m + i] : A[i * k + p]; };
+      auto b = [&](size_t p, size_t j) { return transB ? B[j * k + p] : B[p * n + j]; };
+      nnet::Vec<float> expected(m * n);
+      for (size_t i = 0; i < m; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+          double sum = epilogue.accumulate_ ? C0[i * n + j] : 0;
+          for (size_t p = 0; p < k; ++p) sum += (double)a(i, p) * b(p, j);
+          if (epilogue.bias_ != nullptr) sum = std::tanh(sum + bias[j]);
+          expected[i * n + j] = (float)sum;
+        }
+      }
+      for (int isa = nnet::util::kISA_SCALAR; isa < nnet::util::kNUM_ISAS; ++isa) {
+        if (!nnet::util::hasSimdIsa((nnet::util::SimdIsa)isa)) continue;
+        INFO(nnet::util::simdIsaName((nnet::util::SimdIsa)isa) << " " << m << "x" << n << "x" << k << " " << flags);
+        nnet::Vec<float> C = C0;
+        nnet::util::gemm(transA, transB, m, n, k, A.data(), transA ? m : k, B.data(), transB ? k : n, C.data(), n,
+                         epilogue, (nnet::util::SimdIsa)isa);
+        for (size_t i = 0; i < m * n; ++i) {
+          REQUIRE(C[i] == Approx(expected[i]).margin(1e-5 * (k + 1)));
+        }
+        // the same bits whatever the number of threads is.
+        nnet::Vec<float> threaded = C0;
+        nnet::util::ThreadPool::Scope scope(&pool);
+        nnet::util::gemm(transA, transB, m, n, k, A.data(), transA ? m : k, B.data(), transB ? k : n,
+                         threaded.data(), n, epilogue, (nnet::util::SimdIsa)isa);
+        REQUIRE(std::memcmp(threaded.data(), C.data(), m * n * sizeof(float)) == 0);
+      }
+    }
+  }
+}
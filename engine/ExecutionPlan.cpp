@@ -0,0 +1,185 @@
+#include "ExecutionPlan.h"
+
+namespace nnet {
+namespace engine {
+
+ExecutionPlan::ExecutionPlan(memory::Workspace& w, const graph::Graph& g, const SmallVec<std::string>& stages)
+    : workspace_(w), graph_(g) {
+  compile(stages);
+}
+
+bool ExecutionPlan::isValid() const {
+  if (numOps_ != graph_.ops_.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < feeds_.size(); ++i) {
+    if (!(feeds_[i]->dims_ == feedDims_[i])) {
+      return false;
+    }
+  }
+  if (workspace_.generation() == generation_) {
+    return true;
+  }
+  for (size_t i = 0; i < feeds_.size(); ++i) {  // only looked up by name when a buffer of the workspace changed
+    if (workspace_.findBuffer(feeds_[i]->name_) != feedBuffers_[i]) {
+      return false;
+    }
+  }
+  generation_ = workspace_.generation();
+  return true;
+}
+
+static SmallVec<Variable> toVar(memory::Workspace& workspace, const SmallVec<graph::VariableAttrPtr>& vars) {
+  SmallVec<Variable> retv;
+  for (auto iptAttr : vars) {
+    retv.emplace_back();
+    auto& ipt = retv.back();
+    ipt.attr_ = iptAttr;
+    if (ipt.attr_ == nullptr) {
+      ipt.buffer_ = nullptr;
+    } else {
+      ipt.buffer_ = workspace(ipt.attr_);
+    }
+  }
+  return retv;
+}
+
+void ExecutionPlan::compile(const SmallVec<std::string>& stages) {
+  graph::Graph g = graph_;
+  Map<std::string, Any> attrs;
+  attrs["workspace"] = &this->workspace_;
+  graph::compileGraph(&g, stages, attrs);
+
+  numOps_ = graph_.ops_.size();
+  Set<std::string> written;
+  Set<std::string> feedNames;
+  for (auto& op : graph_.ops_) {
+    for (auto& i : op.inputs_) {
+      if (i != nullptr && written.find(i->name_) == written.end() && feedNames.insert(i->name_).second) {
+        feeds_.push_back(i);
+        feedDims_.push_back(i->dims_);
+      }
+    }
+    for (auto& o : op.outputs_) {
+      if (o != nullptr) {
+        written.insert(o->name_);
+      }
+    }
+
+    auto& meta = graph::OpMeta::gAllOpMeta_.at(op.type_);
+    steps_.emplace_back();
+    Step& step = steps_.back();
+    step.op_ = &op;
+    step.kernel_ = &meta.kernels[graph::kDEVICE_CPU];
+    step.attrs_ = meta.bindAttrs(op.attrs_);
+    step.inputs_ = toVar(workspace_, op.inputs_);
+    step.outputs_ = toVar(workspace_, op.outputs_);
+  }
+  for (auto& feed : feeds_) {
+    feedBuffers_.push_back(workspace_.findBuffer(feed->name_));
+  }
+  generation_ = workspace_.generation();
+}
+
+static std::string toDebugString(const graph::Op& op) {
+  std::ostringstream sout;
+  sout << " From: ";
+  for (auto& i : op.inputs_) {
+    if (i == nullptr) {
+      sout << "nullptr";
+    } else {
+      sout << i->name_ << i->dims_ << " ";
+    }
+  }
+  sout << "-> ";
+  for (auto& o : op.outputs_) {
+    if (o == nullptr) {
+      sout << "nullptr";
+    } else {
+      sout << o->name_ << o->dims_ << " ";
+    }
+  }
+  return sout.str();
+}
+
+void ExecutionPlan::run(bool debug, Profiler* profiler) {
+  for (size_t i = 0; i < steps_.size(); ++i) {
+    runStep(i, debug, profiler);
+  }
+}
+
+void ExecutionPlan::runStep(size_t stepId, bool debug, Profiler* profiler) {
+  auto& step = steps_[stepId];
+  if (debug) {
+    LOG(DEBUG) << "Performing " << step.op_->type_ << toDebugString(*step.op_);
+  }
+  if (step.tune_) {  // when it runs, so the inputs hold real values and the thread pool of the run is set
+    step.kernel_ = autotuner_->select(*step.op_, step.attrs_, step.inputs_, step.outputs_);
+    step.tune_ = false;
+  }
+  if (profiler == nullptr) {
+    (*step.kernel_)(step.inputs_, step.outputs_, step.attrs_);
+  } else {
+    if (step.profile_ == nullptr) {
+      step.profile_ = Profiler::createOpInfo(*step.op_);
+    }
+    auto begin = Profiler::Clock::now();
+    (*step.kernel_)(step.inputs_, step.outputs_, step.attrs_);
+    profiler->record(step.profile_, begin, Profiler::Clock::now());
+  }
+}
+
+void ExecutionPlan::setAutotuner(Autotuner* autotuner) {
+  autotuner_ = autotuner;
+  for (auto& step : steps_) {
+    auto& meta = graph::OpMeta::gAllOpMeta_.at(step.op_->type_);
+    step.kernel_ = &meta.kernels[graph::kDEVICE_CPU];
+    step.tune_ = autotuner != nullptr && !meta.cpuVariants_.empty();
+  }
+}
+
+using MemoryRange = std::pair<const char*, const char*>;
+
+static void appendRanges(const SmallVec<Variable>& vars, SmallVec<MemoryRange>* ranges) {
+  for (auto& v : vars) {
+    if (v.buffer_ == nullptr || v.buffer_->getSize() == 0) continue;
+    auto begin = reinterpret_cast<const char*>(v.buffer_->get());
+    ranges->push_back({begin, begin + v.buffer_->getSize()});
+  }
+}
+
+static bool overlap(const SmallVec<MemoryRange>& a, const SmallVec<MemoryRange>& b) {
+  for (auto& x : a) {
+    for (auto& y : b) {
+      if (x.first < y.second && y.first < x.second) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+const Vec<SmallVec<size_t>>& ExecutionPlan::successors() const {
+  if (successors_.size() == steps_.size()) {
+    return successors_;
+  }
+  // Dependencies are computed on memory ranges rather than names, so variables sharing a buffer are ordered too.
+  Vec<SmallVec<MemoryRange>> reads(steps_.size());
+  Vec<SmallVec<MemoryRange>> writes(steps_.size());
+  for (size_t i = 0; i < steps_.size(); ++i) {
+    appendRanges(steps_[i].inputs_, &reads[i]);
+    appendRanges(steps_[i].outputs_, &writes[i]);
+  }
+  successors_.clear();
+  successors_.resize(steps_.size());
+  for (size_t i = 0; i < steps_.size(); ++i) {
+    for (size_t j = 0; j < i; ++j) {
+      if (overlap(writes[i], reads[j]) || overlap(writes[i], writes[j]) || overlap(reads[i], writes[j])) {
+        successors_[j].push_back(i);
+      }
+    }
+  }
+  return successors_;
+}
+}
+}
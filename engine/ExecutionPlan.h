@@ -0,0 +1,72 @@
+#pragma once
+#include "graph/ComputationGraph.h"
+#include "Autotuner.h"
+#include "Profiler.h"
+#include "memory/Workspace.h"
+
+namespace nnet {
+namespace engine {
+using graph::Variable;
+
+/**
+ * ExecutionPlan is a graph compiled against a workspace. The kernel, attributes and buffers of every op are resolved
+ * once, the attributes into the struct its kernels read (see OpMeta::bindAttrs). So running the plan is a flat loop
+ * of pre-bound kernel calls, without hashing or allocation.
+ *
+ * A plan is keyed on the dims and buffers of the feed variables of the graph, i.e. the variables which are read before
+ * any op writes them. When a feed shape changes, a feed is given another buffer (e.g. a view of a mapped dataset), or
+ * ops are added to the graph, the plan must be rebuilt. The attributes of an op changed afterwards are only seen by a
+ * new plan too.
+ */
+class ExecutionPlan final {
+ public:
+  struct Step {
+    const graph::Op* op_;
+    const graph::OpMeta::RunOnDeviceFN* kernel_;
+    graph::OpAttrs attrs_;  // the attributes of op_, bound when the plan is compiled
+    SmallVec<Variable> inputs_;
+    SmallVec<Variable> outputs_;
+    Profiler::OpInfoPtr profile_;  // created on the first profiled run
+    bool tune_{false};             // the autotuner picks a kernel variant on the next run
+  };
+
+  ExecutionPlan(memory::Workspace& w, const graph::Graph& g, const SmallVec<std::string>& stages);
+
+  /**
+   * @brief isValid return True if the plan could still be used for the graph, i.e. no feed shape or buffer changed.
+   */
+  bool isValid() const;
+
+  void run(bool debug = false, Profiler* profiler = nullptr);
+
+  void runStep(size_t stepId, bool debug = false, Profiler* profiler = nullptr);
+
+  // Let autotuner pick the kernels of the ops with variants on their next run. nullptr runs the default kernels.
+  void setAutotuner(Autotuner* autotuner);
+
+  Autotuner* autotuner() const { return autotuner_; }
+
+  const Vec<Step>& steps() const { return steps_; }
+
+  /**
+   * @brief successors return, for each step, the steps which must run after it. Two steps depend on each other when
+   * one of them writes memory the other one reads or writes. It is computed lazily and cached in the plan.
+   */
+  const Vec<SmallVec<size_t>>& successors() const;
+
+ private:
+  void compile(const SmallVec<std::string>& stages);
+
+  memory::Workspace& workspace_;
+  const graph::Graph& graph_;
+  size_t numOps_;
+  Vec<graph::VariableAttrPtr> feeds_;
+  Vec<SmallVec<size_t>> feedDims_;
+  Vec<memory::VariableBuffer*> feedBuffers_;
+  mutable size_t generation_;  // of the workspace when feedBuffers_ were last looked up
+  Vec<Step> steps_;
+  Autotuner* autotuner_{nullptr};
+  mutable Vec<SmallVec<size_t>> successors_;
+};
+}
+}
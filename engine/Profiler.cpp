@@ -0,0 +1,139 @@
+#include "Profiler.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+
+namespace nnet {
+namespace engine {
+
+const char* toString(Pass pass) {
+  switch (pass) {
+    case kPASS_FORWARD:
+      return "forward";
+    case kPASS_BACKWARD:
+      return "backward";
+    case kPASS_OPTIMIZE:
+      return "optimize";
+    default:
+      LOG(FATAL) << "Not supported pass " << pass;
+      return "";
+  }
+}
+
+Profiler::OpInfoPtr Profiler::createOpInfo(const graph::Op& op) {
+  auto info = std::make_shared<OpInfo>();
+  info->type_ = op.type_;
+  info->pass_ = kPASS_FORWARD;
+  for (auto& o : op.outputs_) {
+    if (o == nullptr) continue;
+    info->outputs_ += (info->outputs_.empty() ? "" : ",") + o->name_;
+    if (graph::isGradName(o->name_)) {
+      info->pass_ = kPASS_BACKWARD;
+    } else if (graph::isParamName(o->name_)) {
+      info->pass_ = kPASS_OPTIMIZE;  // only optimizers write parameters
+    }
+  }
+  info->cost_ = graph::OpMeta::gAllOpMeta_.at(op.type_).cost_(op.inputs_, op.outputs_);
+  return info;
+}
+
+void Profiler::record(const OpInfoPtr& op, Clock::time_point begin, Clock::time_point end) {
+  using Us = std::chrono::duration<double, std::micro>;
+  std::lock_guard<std::mutex> g(mu_);
+  auto it = threadIds_.find(std::this_thread::get_id());
+  if (it == threadIds_.end()) {
+    it = threadIds_.insert({std::this_thread::get_id(), threadIds_.size()}).first;
+  }
+  events_.push_back({op, it->second, Us(begin - origin_).count(), Us(end - begin).count()});
+}
+
+void Profiler::reset() {
+  std::lock_guard<std::mutex> g(mu_);
+  events_.clear();
+  origin_ = Clock::now();
+}
+
+namespace {
+struct Stat {
+  size_t calls_{0};
+  double us_{0};
+  double flops_{0};
+  double bytes_{0};
+
+  void add(const Profiler::Event& e) {
+    ++calls_;
+    us_ += e.durationUs_;
+    flops_ += e.op_->cost_.flops_;
+    bytes_ += e.op_->cost_.bytes_;
+  }
+};
+}
+
+void Profiler::printSummary(std::ostream& os) const {
+  std::lock_guard<std::mutex> g(mu_);
+  Map<std::string, Stat> perType;
+  Stat perPass[kNUM_PASSES];
+  Stat total;
+  for (auto& e : events_) {
+    perType[e.op_->type_].add(e);
+    perPass[e.op_->pass_].add(e);
+    total.add(e);
+  }
+  Vec<std::pair<std::string, Stat>> sorted(perType.begin(), perType.end());
+  std::sort(sorted.begin(), sorted.end(),
+            [](const std::pair<std::string, Stat>& a, const std::pair<std::string, Stat>& b) {
+              return a.second.us_ > b.second.us_;
+            });
+
+  char line[256];
+  auto printRow = [&](const std::string& name, const Stat& s) {
+    double seconds = s.us_ * 1e-6;
+    snprintf(line, sizeof(line), "%-24s %8zu %12.3f %10.2f %7.2f%% %10.2f %10.2f\n", name.c_str(), s.calls_,
+             s.us_ / 1000, s.calls_ == 0 ? 0 : s.us_ / s.calls_, total.us_ == 0 ? 0 : 100 * s.us_ / total.us_,
+             seconds == 0 ? 0 : s.flops_ / seconds * 1e-9, seconds == 0 ? 0 : s.bytes_ / seconds * 1e-9);
+    os << line;
+  };
+  snprintf(line, sizeof(line), "%-24s %8s %12s %10s %8s %10s %10s\n", "op type", "calls", "total(ms)", "avg(us)",
+           "ratio", "GFLOP/s", "GB/s");
+  os << line;
+  for (auto& item : sorted) {
+    printRow(item.first, item.second);
+  }
+  os << "\n";
+  snprintf(line, sizeof(line), "%-24s %8s %12s %10s %8s %10s %10s\n", "pass", "calls", "total(ms)", "avg(us)", "ratio",
+           "GFLOP/s", "GB/s");
+  os << line;
+  for (int p = 0; p < kNUM_PASSES; ++p) {
+    printRow(toString((Pass)p), perPass[p]);
+  }
+  printRow("total", total);
+}
+
+static std::string escape(const std::string& str) {
+  std::string retv;
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      retv += '\\';
+    }
+    retv += c;
+  }
+  return retv;
+}
+
+void Profiler::writeChromeTrace(const std::string& path) const {
+  std::lock_guard<std::mutex> g(mu_);
+  std::ofstream fout(path);
+  CHECK(fout.good()) << "Cannot open " << path;
+  fout << "{\"traceEvents\":[";
+  for (size_t i = 0; i < events_.size(); ++i) {
+    auto& e = events_[i];
+    fout << (i == 0 ? "" : ",") << "\n{\"name\":\"" << escape(e.op_->type_) << "\",\"cat\":\""
+         << toString(e.op_->pass_) << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << e.threadId_ << ",\"ts\":" << e.beginUs_
+         << ",\"dur\":" << e.durationUs_ << ",\"args\":{\"outputs\":\"" << escape(e.op_->outputs_)
+         << "\",\"flops\":" << e.op_->cost_.flops_ << ",\"bytes\":" << e.op_->cost_.bytes_ << "}}";
+  }
+  fout << "\n]}\n";
+}
+}
+}
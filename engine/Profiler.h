@@ -0,0 +1,61 @@
+#pragma once
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include "graph/ComputationGraph.h"
+
+namespace nnet {
+namespace engine {
+
+enum Pass : int { kPASS_FORWARD = 0, kPASS_BACKWARD = 1, kPASS_OPTIMIZE = 2, kNUM_PASSES };
+
+const char* toString(Pass pass);
+
+/**
+ * Profiler records the wall time of every kernel invocation together with its estimated FLOPs and bytes
+ * (OpMeta::cost_). It aggregates them per op type and per pass, and exports a chrome://tracing JSON file.
+ *
+ * Set it with Engine::setProfiler. When no profiler is set, the engine does not take any timestamp.
+ */
+class Profiler final {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // What is known about an op before running it. It is built once per execution plan.
+  struct OpInfo {
+    std::string type_;
+    std::string outputs_;
+    Pass pass_;
+    graph::OpCost cost_;
+  };
+  using OpInfoPtr = std::shared_ptr<const OpInfo>;
+
+  struct Event {
+    OpInfoPtr op_;
+    size_t threadId_;
+    double beginUs_;
+    double durationUs_;
+  };
+
+  static OpInfoPtr createOpInfo(const graph::Op& op);
+
+  Profiler() : origin_(Clock::now()) {}
+
+  void record(const OpInfoPtr& op, Clock::time_point begin, Clock::time_point end);
+
+  void reset();
+
+  // print the time, GFLOP/s and GB/s aggregated per op type, and the time per pass.
+  void printSummary(std::ostream& os) const;
+
+  void writeChromeTrace(const std::string& path) const;
+
+ private:
+  Clock::time_point origin_;
+  mutable std::mutex mu_;
+  Vec<Event> events_;
+  Map<std::thread::id, size_t> threadIds_;
+};
+}
+}
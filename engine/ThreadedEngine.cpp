@@ -0,0 +1,62 @@
+#include "ThreadedEngine.h"
+#include "misc/InitFunction.h"
+
+namespace nnet {
+namespace engine {
+
+ThreadedEngine::ThreadedEngine(memory::Workspace& w, const graph::Graph& graph, size_t numThreads)
+    : NaiveEngine(w, graph, numThreads) {
+  if (pool_ == nullptr) {
+    pool_.reset(new util::ThreadPool(1));
+  }
+}
+
+void ThreadedEngine::run(bool debug) const {
+  auto& plan = getPlan();
+  auto& successors = plan.successors();
+  size_t numSteps = plan.steps().size();
+  if (numDeps_.size() != numSteps) {
+    remaining_.reset(new std::atomic<size_t>[numSteps]);
+  }
+  numDeps_.assign(numSteps, 0);
+  for (auto& succ : successors) {
+    for (auto s : succ) {
+      ++numDeps_[s];
+    }
+  }
+  for (size_t i = 0; i < numSteps; ++i) {
+    remaining_[i] = numDeps_[i];
+  }
+  numFinished_ = 0;
+
+  for (size_t i = 0; i < numSteps; ++i) {
+    if (numDeps_[i] == 0) {
+      pool_->schedule([this, &plan, i, debug] { this->execute(&plan, i, debug); });
+    }
+  }
+
+  std::unique_lock<std::mutex> l(finishedMu_);
+  finishedCv_.wait(l, [this, numSteps] { return numFinished_ == numSteps; });
+}
+
+void ThreadedEngine::execute(ExecutionPlan* plan, size_t stepId, bool debug) const {
+  plan->runStep(stepId, debug, profiler_);
+  for (auto s : plan->successors()[stepId]) {
+    if (--remaining_[s] == 0) {
+      pool_->schedule([this, plan, s, debug] { this->execute(plan, s, debug); });
+    }
+  }
+  // Notified under the lock: once run() sees the last step finished it returns, and the engine (with finishedCv_)
+  // could be destroyed before a notify after the unlock.
+  std::lock_guard<std::mutex> g(finishedMu_);
+  ++numFinished_;
+  finishedCv_.notify_one();
+}
+
+static util::InitFunction init([] {
+  engines().insert({"threaded", [](memory::Workspace& w, const graph::Graph& g, size_t numThreads) {
+                      return std::unique_ptr<Engine>(new ThreadedEngine(w, g, numThreads));
+                    }});
+});
+}
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "Engine.h"
+
+namespace nnet {
+namespace engine {
+
+/**
+ * ThreadedEngine runs the ops of the graph as a dataflow. Each op of the execution plan is dispatched to a
+ * work-stealing thread pool as soon as all the ops it depends on are finished, so independent branches (e.g. the
+ * sgd ops of each parameter) overlap.
+ *
+ * Ops touching the same memory keep the order of the graph, so the results are bit-identical to NaiveEngine. The
+ * same pool is used by kernels for intra-op parallelism.
+ */
+class ThreadedEngine : public NaiveEngine {
+ public:
+  ThreadedEngine(memory::Workspace& w, const graph::Graph& graph, size_t numThreads = 0);
+
+  void run(bool debug = false) const override;
+
+ private:
+  void execute(ExecutionPlan* plan, size_t stepId, bool debug) const;
+
+  mutable Vec<size_t> numDeps_;
+  mutable std::unique_ptr<std::atomic<size_t>[]> remaining_;
+  mutable size_t numFinished_;
+  mutable std::mutex finishedMu_;
+  mutable std::condition_variable finishedCv_;
+};
+}
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <stdint.h>
+#include <algorithm>
 #include <functional>
 #include <typeinfo>
 #include "ComputationGraph.h"
@@ -56,12 +57,51 @@ class Constraints final : public BaseConstraints {
   SmallVec<ConstraintFN> constraints_;
 };
 
+/**
+ * OpAttrs is the struct the kernels of an op read its attributes from, e.g. SgdAttrs of sgd. It is filled once, when
+ * a plan is compiled (see OpMeta::bindAttrs), so kernels do not look the attributes up by name on every call. It is
+ * empty for the ops whose kernels read no attribute.
+ */
+class OpAttrs final {
+ public:
+  template <typename S>
+  static OpAttrs create() {
+    OpAttrs attrs;
+    attrs.attrs_ = std::make_shared<S>();
+    attrs.type_ = &typeid(S);
+    return attrs;
+  }
+
+  // S must be the struct given to OpMeta::setAttrs of the op. get is on the hot path, it is only checked in debug
+  // builds.
+  template <typename S>
+  const S& get() const {
+#ifndef NDEBUG
+    CHECK(type_ != nullptr && *type_ == typeid(S)) << "The attributes are not a " << typeid(S).name();
+#endif
+    return *static_cast<const S*>(attrs_.get());
+  }
+
+  void* data() const { return attrs_.get(); }
+
+  // The struct of the attributes, nullptr when empty.
+  const std::type_info* type() const { return type_; }
+
+ private:
+  std::shared_ptr<void> attrs_;
+  const std::type_info* type_{nullptr};
+};
+
 class AttributeMeta final {
  public:
+  using BindFN = std::function<void(const Any& value, void* attrs)>;
+
   std::string name_;
   std::string description_;
   const std::type_info& type_;
   std::unique_ptr<BaseConstraints> constraints_;
+  BindFN bind_;  // stores the checked value in the OpAttrs of the op, empty when the kernels do not read it
+  const std::type_info* attrsType_{nullptr};  // the struct bind_ stores into
 
   template <typename T>
   Constraints<T>& constraints() {
@@ -69,6 +109,24 @@ class AttributeMeta final {
     return *ptr;
   }
 
+  /**
+   * @brief bind store the checked value of the attribute in the attribute struct S of the op by setter, e.g. to keep
+   * a string as an enum.
+   */
+  template <typename T, typename S>
+  AttributeMeta& bind(std::function<void(const T& value, S* attrs)> setter) {
+    CHECK(typeid(T) == type_) << "Attribute " << name_ << " is bound to a field of another type";
+    bind_ = [setter](const Any& value, void* attrs) { setter(any_cast<const T&>(value), static_cast<S*>(attrs)); };
+    attrsType_ = &typeid(S);
+    return *this;
+  }
+
+  // bind store the checked value of the attribute in the field of S.
+  template <typename T, typename S>
+  AttributeMeta& bind(T S::*field) {
+    return bind<T, S>([field](const T& value, S* attrs) { attrs->*field = value; });
+  }
+
   template <typename T>
   static std::shared_ptr<AttributeMeta> create(const std::string& name, const std::string& description) {
     return std::make_shared<AttributeMeta>(name, description, typeid(T),
@@ -80,7 +138,26 @@ class AttributeMeta final {
       : name_(name), description_(desc), type_(type), constraints_(std::move(cons)) {}
 };
 
-enum VariableType : size_t { kFLOAT32 = 0, kINT32 = 1 };
+// kCSR_FLOAT32 is a sparse matrix of dims_ in compressed sparse row format, see VariableAttr::bytes() for its layout.
+// kBF16 and kFP16 store floats in 16 bits (bfloat16 and IEEE half), kernels compute in float. See misc/Half.h.
+// kINT8 holds quantized values, e.g. the weights and activations of fc_int8. See misc/Int8.h.
+enum VariableType : size_t { kFLOAT32 = 0, kINT32 = 1, kCSR_FLOAT32 = 2, kBF16 = 3, kFP16 = 4, kINT8 = 5 };
+
+inline bool isHalf(VariableType type) { return type == kBF16 || type == kFP16; }
+
+// The bytes of an element of a dense variable.
+inline size_t elementSize(VariableType type) { return type == kINT8 ? 1 : isHalf(type) ? 2 : 4; }
+
+// Variables are told apart by name: the parameters contain ".param", the gradient of x is x.grad (and the rows of a
+// row-sparse one x.grad.rows), the optimizer states of a parameter p are p.state.<kind>.
+inline bool isGradName(const std::string& name) { return name.find(".grad") != std::string::npos; }
+inline bool isStateName(const std::string& name) {
+  return name.find(".param") != std::string::npos && name.find(".state.") != std::string::npos && !isGradName(name);
+}
+inline bool isParamName(const std::string& name) {
+  return name.find(".param") != std::string::npos && !isGradName(name) && !isStateName(name);
+}
+
 class VariableAttr;
 
 class Variable final {
@@ -102,16 +179,45 @@ class VariableAttr final {
 
   bool operator!=(const VariableAttr& attr) const { return !this->operator==(attr); }
 
+  /**
+   * @brief bytes return the size of the buffer of the variable. A kCSR_FLOAT32 buffer holds dims_[0] + 1 row offsets,
+   * then maxNnz_ column indices and maxNnz_ values. The number of non-zeros is the last row offset.
+   */
+  size_t bytes() const {
+    static_assert(sizeof(float) == sizeof(int), "");
+    if (type_ == kCSR_FLOAT32) {
+      CHECK_EQ(dims_.size(), 2UL);
+      return (dims_[0] + 1 + 2 * maxNnz_) * sizeof(int);
+    }
+    return details::product(dims_) * elementSize(type_);
+  }
+
   std::string name_;
   bool needBackward_{true};
   SmallVec<size_t> dims_;
   VariableType type_;
   InitializeFN specialResetFunction_;  // when apply reset to vars, default is
-                                       // reset to zero.
+                                       // reset to zero. Parameters with it are
+                                       // initialized by it instead of randomly.
+  // For a gradient, whether it is the sum of several ops (or of none). It is then zeroed before each batch and the
+  // kernels add to it, otherwise its only writer overwrites it. Set by the backward stage.
+  bool accumulateGrad_{true};
+  // For a row-sparse gradient, the name of the int32 variable holding the parameter row of each of its rows. Rows
+  // after the first negative index are unused. Empty for a dense variable.
+  std::string sparseRows_;
+  size_t maxNnz_{0};  // capacity of non-zeros of a kCSR_FLOAT32 variable
 };
 
 using VariableAttrPtr = std::shared_ptr<VariableAttr>;
 
+/**
+ * Estimated work of a kernel invocation, used by the profiler and the benchmarks.
+ */
+struct OpCost {
+  double flops_{0};
+  double bytes_{0};  // bytes read and written
+};
+
 class Op final {
  public:
   std::string type_;
@@ -129,8 +235,8 @@ class OpMeta final {
  public:
   using ShapeInfererFN =
       std::function<void(const SmallVec<VariableAttrPtr>& inputs, const SmallVec<VariableAttrPtr>& outputs)>;
-  using RunOnDeviceFN = std::function<void(const SmallVec<Variable>& inputs, SmallVec<Variable>& outputs,
-                                           const Map<std::string, Any> attrs)>;
+  using RunOnDeviceFN =
+      std::function<void(const SmallVec<Variable>& inputs, SmallVec<Variable>& outputs, const OpAttrs& attrs)>;
 
   using GradFN = std::function<SmallVec<Op>(
       const SmallVec<VariableAttrPtr>& inputs, const SmallVec<VariableAttrPtr>& outputs,
@@ -139,10 +245,27 @@ class OpMeta final {
   using GradVariablesOp = std::function<void(const SmallVec<VariableAttrPtr>& I, const SmallVec<VariableAttrPtr>& O,
                                              SmallVec<VariableAttrPtr>* IG, SmallVec<VariableAttrPtr>* OG)>;
 
+  using CostFN =
+      std::function<OpCost(const SmallVec<VariableAttrPtr>& inputs, const SmallVec<VariableAttrPtr>& outputs)>;
+
+  using SupportsFN =
+      std::function<bool(const SmallVec<VariableAttrPtr>& inputs, const SmallVec<VariableAttrPtr>& outputs)>;
+
+  // Another CPU implementation of the op, e.g. a GEMM partitioned otherwise. It computes the same result as
+  // kernels[kDEVICE_CPU], which is the variant named "default". supports_ is empty when it runs on any input.
+  struct KernelVariant {
+    std::string name_;
+    RunOnDeviceFN kernel_;
+    SupportsFN supports_;
+  };
+
   std::string type_;
   ShapeInfererFN shapeInferer_;
   SmallVec<std::shared_ptr<AttributeMeta>> attrMeta_;
+  std::function<OpAttrs()> newAttrs_;  // the attribute struct of the kernels, see setAttrs
   RunOnDeviceFN kernels[kNUM_DEVICES];
+  // The engine picks the fastest of the default kernel and these for each shape, see engine::Autotuner.
+  SmallVec<KernelVariant> cpuVariants_;
   GradFN grad_;
   GradVariablesOp gradVars_{[](const SmallVec<VariableAttrPtr>& I, const SmallVec<VariableAttrPtr>& O,
                                SmallVec<VariableAttrPtr>* OG, SmallVec<VariableAttrPtr>* IG) {
@@ -153,6 +276,9 @@ class OpMeta final {
         auto retv = std::make_shared<VariableAttr>();
         *retv = *ptr;
         retv->name_ += ".grad";
+        if (isHalf(retv->type_)) {
+          retv->type_ = kFLOAT32;  // gradients are accumulated in float
+        }
         return retv;
       } else {
         return nullptr;
@@ -164,6 +290,64 @@ class OpMeta final {
     std::transform(I.begin(), I.end(), IG->begin(), transformImpl);
     std::transform(O.begin(), O.end(), OG->begin(), transformImpl);
   }};
+  CostFN cost_{defaultCost};
+  // (input, output) index pairs which could share a buffer, i.e. the kernel is correct when the output overwrites
+  // the input. The inplace stage decides whether they really share one.
+  SmallVec<std::pair<size_t, size_t>> inplace_;
+
+  // The kernels read the attributes from an S, whose fields are set by the bind_ of attrMeta_.
+  template <typename S>
+  void setAttrs() {
+    newAttrs_ = OpAttrs::create<S>;
+  }
+
+  /**
+   * @brief checkAttrs check attrs by attrMeta_, i.e. set the default values of the missing attributes and run the
+   * constraints.
+   */
+  void checkAttrs(Map<std::string, Any>* attrs) const {
+    for (auto& attrMeta : attrMeta_) {
+      attrMeta->constraints_->check(attrMeta->name_, attrs);
+    }
+  }
+
+  /**
+   * @brief bindAttrs return the attributes of an op as the struct its kernels read. They are checked first, so an op
+   * created by a stage, without defaults, is bound too. Each bound attribute must store into the struct of setAttrs.
+   */
+  OpAttrs bindAttrs(Map<std::string, Any> attrs) const {
+    checkAttrs(&attrs);
+    if (!newAttrs_) {
+      for (auto& attrMeta : attrMeta_) {
+        CHECK(!attrMeta->bind_) << "Attribute " << attrMeta->name_ << " of " << type_ << " is bound without setAttrs";
+      }
+      return OpAttrs();
+    }
+    OpAttrs retv = newAttrs_();
+    for (auto& attrMeta : attrMeta_) {
+      if (attrMeta->bind_) {
+        CHECK(*attrMeta->attrsType_ == *retv.type())
+            << "Attribute " << attrMeta->name_ << " of " << type_ << " is bound to another struct than setAttrs";
+        attrMeta->bind_(attrs.at(attrMeta->name_), retv.data());
+      }
+    }
+    return retv;
+  }
+
+  // default cost is one flop per output element, and touching every input and output once.
+  static OpCost defaultCost(const SmallVec<VariableAttrPtr>& inputs, const SmallVec<VariableAttrPtr>& outputs) {
+    OpCost cost;
+    for (auto& vars : {&inputs, &outputs}) {
+      for (auto& v : *vars) {
+        if (v == nullptr) continue;
+        cost.bytes_ += v->bytes();
+        if (vars == &outputs) {
+          cost.flops_ += details::product(v->dims_);
+        }
+      }
+    }
+    return cost;
+  }
 
   static Map<std::string, OpMeta> gAllOpMeta_;
 };
@@ -173,6 +357,30 @@ class Graph final {
   Map<std::string, VariableAttrPtr> variables_;
   SmallVecN<Op, 10> ops_;
 
+  /**
+   * @brief clone return a deep copy of the graph. Copying a graph only copies the pointers of VariableAttr, so the
+   * copy shares dims with the origin. A clone could be resized independently.
+   */
+  Graph clone() const {
+    Graph g;
+    for (auto& var : variables_) {
+      g.variables_[var.first] = std::make_shared<VariableAttr>(*var.second);
+    }
+    auto remap = [&g](SmallVec<VariableAttrPtr>* vars) {
+      for (auto& var : *vars) {
+        if (var != nullptr) {
+          var = g.variables_.at(var->name_);
+        }
+      }
+    };
+    g.ops_ = ops_;
+    for (auto& op : g.ops_) {
+      remap(&op.inputs_);
+      remap(&op.outputs_);
+    }
+    return g;
+  }
+
   template <bool failWhenMismatchDims = false>
   VariableAttrPtr createOrResizeVar(const std::string& name, const SmallVec<size_t>& dim, bool need_backward,
                                     VariableType type) {
@@ -40,9 +40,31 @@ static void backward(Graph& g, const Map<std::string, Any>& attrs) {
 
     auto ops = opMeta.grad_(I, O, OG, IG);
     for (auto& o : ops) {
+      for (auto& out : o.outputs_) {  // e.g. the rows of a row-sparse gradient
+        if (out != nullptr) {
+          out = g.createOrResizeVar(out);
+        }
+      }
       g.ops_.push_back(o);
     }
   }
+
+  // A gradient written by a single op is overwritten by it, so it needs no zeroing before each batch.
+  Map<std::string, size_t> numWriters;
+  for (auto& op : g.ops_) {
+    for (auto& o : op.outputs_) {
+      if (o != nullptr) {
+        ++numWriters[o->name_];
+      }
+    }
+  }
+  for (auto& var : g.variables_) {
+    if (isGradName(var.first)) {
+      var.second->accumulateGrad_ = numWriters[var.first] != 1;
+      CHECK(var.second->sparseRows_.empty() || numWriters[var.first] == 1)
+          << "The row-sparse gradient " << var.first << " could only be written by one op";
+    }
+  }
 }
 
 static util::InitFunction init([] { compilers().insert({"backward", backward}); });
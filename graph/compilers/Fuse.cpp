@@ -0,0 +1,109 @@
+#include "boost/algorithm/string.hpp"
+#include "graph/ComputationGraph.h"
+#include "misc/InitFunction.h"
+
+namespace nnet {
+namespace graph {
+
+static Map<std::string, Vec<size_t>> readers(const Graph& g) {
+  Map<std::string, Vec<size_t>> retv;
+  for (size_t i = 0; i < g.ops_.size(); ++i) {
+    for (auto& in : g.ops_[i].inputs_) {
+      if (in != nullptr) {
+        retv[in->name_].push_back(i);
+      }
+    }
+  }
+  return retv;
+}
+
+static bool writtenBetween(const Graph& g, const VariableAttrPtr& var, size_t begin, size_t end) {
+  for (size_t i = begin + 1; i < end; ++i) {
+    for (auto& out : g.ops_[i].outputs_) {
+      if (out != nullptr && out->name_ == var->name_) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static void removeOps(Graph& g, const Set<size_t>& removed) {
+  SmallVecN<Op, 10> ops;
+  for (size_t i = 0; i < g.ops_.size(); ++i) {
+    if (removed.count(i) == 0) {
+      ops.push_back(std::move(g.ops_[i]));
+    }
+  }
+  g.ops_ = std::move(ops);
+}
+
+/**
+ * softmax + cross_entropy -> softmax_cross_entropy. The probabilities stay an output, but their gradient is not
+ * propagated, so the other readers of them must not need backward (e.g. error_rate).
+ */
+static size_t fuseSoftmaxCrossEntropy(Graph& g) {
+  auto varReaders = readers(g);
+  Set<size_t> removed;
+  for (size_t i = 0; i < g.ops_.size(); ++i) {
+    if (g.ops_[i].type_ != "softmax") continue;
+    auto P = g.ops_[i].outputs_[0];
+    size_t xe = -1UL;
+    bool fusible = true;
+    for (auto j : varReaders[P->name_]) {
+      auto& reader = g.ops_[j];
+      if (reader.type_ == "cross_entropy" && reader.inputs_[0] == P && xe == -1UL) {
+        xe = j;
+        continue;
+      }
+      for (auto& out : reader.outputs_) {
+        fusible &= out == nullptr || !out->needBackward_;
+      }
+    }
+    if (!fusible || xe == -1UL || writtenBetween(g, g.ops_[xe].inputs_[1], i, xe)) continue;
+    auto& xeOp = g.ops_[xe];
+    P->needBackward_ = false;
+    g.ops_[i] = Op("softmax_cross_entropy", {g.ops_[i].inputs_[0], xeOp.inputs_[1]}, {P, xeOp.outputs_[0]});
+    removed.insert(xe);
+  }
+  removeOps(g, removed);
+  return removed.size();
+}
+
+/**
+ * fc + sigmoid -> fc_bias_act, when the output of fc is only read by the activation and its input is dense.
+ */
+static size_t fuseFcActivation(Graph& g) {
+  auto varReaders = readers(g);
+  Set<size_t> removed;
+  for (size_t i = 0; i < g.ops_.size(); ++i) {
+    if (g.ops_[i].type_ != "fc" || g.ops_[i].inputs_[0]->type_ == kCSR_FLOAT32) continue;
+    auto Z = g.ops_[i].outputs_[0];
+    auto& zReaders = varReaders[Z->name_];
+    if (zReaders.size() != 1 || g.ops_[zReaders[0]].type_ != "sigmoid") continue;
+    auto& act = g.ops_[zReaders[0]];
+    Map<std::string, Any> attrs = {{"activation", act.type_}};
+    g.ops_[i] = Op("fc_bias_act", g.ops_[i].inputs_, act.outputs_, attrs);
+    g.variables_.erase(Z->name_);
+    removed.insert(zReaders[0]);
+  }
+  removeOps(g, removed);
+  return removed.size();
+}
+
+/**
+ * fuse rewrites chains of ops into fused kernels, to save passes over the batch. It must run before backward, the
+ * gradients of the fused ops are fused too.
+ */
+static void fuse(Graph& g, const Map<std::string, Any>& attrs) {
+  for (auto& op : g.ops_) {
+    CHECK(!boost::algorithm::ends_with(op.type_, "_grad")) << "fuse must run before backward";
+  }
+  size_t numXE = fuseSoftmaxCrossEntropy(g);
+  size_t numFC = fuseFcActivation(g);
+  LOG(INFO) << "fuse creates " << numXE << " softmax_cross_entropy, " << numFC << " fc_bias_act";
+}
+
+static util::InitFunction init([] { compilers().insert({"fuse", fuse}); });
+}
+}
@@ -0,0 +1,72 @@
+#include "graph/ComputationGraph.h"
+#include "misc/InitFunction.h"
+
+namespace nnet {
+namespace graph {
+
+/**
+ * inference keeps only the ops needed to produce the variables of attr `fetch`, i.e. it removes the gradient ops,
+ * the optimizer ops, and the losses or metrics which are not fetched.
+ *
+ * Parameters are inputs of the inference graph, so the ops writing them (optimizers) are never kept, and they are
+ * replaced by read-only copies (needBackward_ = false). The variables no kept op uses, including every `.grad`, are
+ * removed from the graph, so requestResource does not allocate them. Buffers are still looked up by name, so an
+ * inference graph run on the workspace it was trained in reads the trained parameters.
+ */
+static void inference(Graph& g, const Map<std::string, Any>& attrs) {
+  auto fetch = any_cast<SmallVec<std::string>>(attrs.at("fetch"));
+  Set<std::string> needed;
+  for (auto& name : fetch) {
+    CHECK(g.variables_.find(name) != g.variables_.end()) << "Cannot fetch " << name;
+    needed.insert(name);
+  }
+
+  Vec<bool> keep(g.ops_.size(), false);
+  for (size_t i = g.ops_.size(); i-- > 0;) {
+    auto& op = g.ops_[i];
+    for (auto& o : op.outputs_) {
+      if (o != nullptr && !isParamName(o->name_) && !isStateName(o->name_) && needed.erase(o->name_) != 0) {
+        keep[i] = true;
+      }
+    }
+    if (!keep[i]) continue;
+    for (auto& in : op.inputs_) {
+      if (in != nullptr) {
+        needed.insert(in->name_);
+      }
+    }
+  }
+
+  Graph pruned;
+  auto remap = [&](SmallVec<VariableAttrPtr>* vars) {
+    for (auto& var : *vars) {
+      if (var == nullptr) continue;
+      auto it = pruned.variables_.find(var->name_);
+      if (it == pruned.variables_.end()) {
+        auto attr = var;
+        if (isParamName(var->name_)) {
+          attr = std::make_shared<VariableAttr>(*var);
+          attr->needBackward_ = false;
+        }
+        it = pruned.variables_.insert({var->name_, attr}).first;
+      }
+      var = it->second;
+    }
+  };
+  for (size_t i = 0; i < g.ops_.size(); ++i) {
+    if (!keep[i]) continue;
+    pruned.ops_.push_back(g.ops_[i]);
+    remap(&pruned.ops_.back().inputs_);
+    remap(&pruned.ops_.back().outputs_);
+  }
+  for (auto& name : fetch) {
+    pruned.variables_.insert({name, g.variables_.at(name)});
+  }
+  LOG(INFO) << "inference keeps " << pruned.ops_.size() << " of " << g.ops_.size() << " ops, "
+            << pruned.variables_.size() << " of " << g.variables_.size() << " variables";
+  g = std::move(pruned);
+}
+
+static util::InitFunction init([] { compilers().insert({"inference", inference}); });
+}
+}
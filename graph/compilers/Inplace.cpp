@@ -0,0 +1,79 @@
+#include "graph/ComputationGraph.h"
+#include "memory/Workspace.h"
+#include "misc/InitFunction.h"
+
+namespace nnet {
+namespace graph {
+
+namespace {
+struct Usage {
+  size_t numWriters_{0};
+  size_t firstRead_{-1UL};
+  size_t lastRead_{0};
+  size_t lastWrite_{0};
+  bool isFeed_{false};  // read before any op writes it
+};
+}
+
+/**
+ * inplace lets the output of an op share the buffer of its input in the workspace, for the pairs declared in
+ * OpMeta::inplace_. It must run before requestResource or planMemory.
+ *
+ * A pair shares a buffer when the op is the last one touching the input, and the only op writing the output. The
+ * input must not be a parameter or a feed, since their values are used across runs. Variables with a special reset
+ * function (the loss gradient) or in an arena of the workspace keep their own buffer.
+ */
+static void inplace(Graph& g, const Map<std::string, Any>& attrs) {
+  auto w = any_cast<memory::Workspace*>(attrs.at("workspace"));
+  Map<std::string, Usage> usages;
+  for (size_t i = 0; i < g.ops_.size(); ++i) {
+    auto& op = g.ops_[i];
+    for (auto& in : op.inputs_) {
+      if (in == nullptr) continue;
+      auto& u = usages[in->name_];
+      u.isFeed_ |= u.numWriters_ == 0;
+      u.firstRead_ = std::min(u.firstRead_, i);
+      u.lastRead_ = i;
+    }
+    for (auto& out : op.outputs_) {
+      if (out == nullptr) continue;
+      auto& u = usages[out->name_];
+      ++u.numWriters_;
+      u.lastWrite_ = i;
+    }
+  }
+  for (auto& var : g.variables_) {
+    w->unshareBuffer(var.first);
+  }
+
+  auto isParam = [](const std::string& name) { return isParamName(name) || isStateName(name); };
+  size_t numShared = 0;
+  for (size_t i = 0; i < g.ops_.size(); ++i) {
+    auto& op = g.ops_[i];
+    for (auto& pair : OpMeta::gAllOpMeta_.at(op.type_).inplace_) {
+      auto& in = op.inputs_[pair.first];
+      auto& out = op.outputs_[pair.second];
+      if (in == nullptr || out == nullptr || in->name_ == out->name_ || in->dims_ != out->dims_ ||
+          in->type_ != out->type_ || isParam(in->name_) || isParam(out->name_) || in->specialResetFunction_ ||
+          out->specialResetFunction_ || w->inArena(in->name_) || w->inArena(out->name_)) {
+        continue;
+      }
+      auto& inUsage = usages.at(in->name_);
+      auto& outUsage = usages.at(out->name_);
+      size_t numReads = std::count_if(op.inputs_.begin(), op.inputs_.end(), [&in](const VariableAttrPtr& v) {
+        return v != nullptr && v->name_ == in->name_;
+      });
+      bool inDead = !inUsage.isFeed_ && inUsage.lastRead_ == i && numReads == 1 && inUsage.lastWrite_ < i;
+      bool outFresh = outUsage.numWriters_ == 1 && outUsage.firstRead_ > i;
+      if (inDead && outFresh) {
+        w->shareBuffer(out->name_, in->name_);
+        ++numShared;
+      }
+    }
+  }
+  LOG(INFO) << "inplace shares the buffers of " << numShared << " outputs";
+}
+
+static util::InitFunction init([] { compilers().insert({"inplace", inplace}); });
+}
+}
@@ -0,0 +1,136 @@
+#include "graph/ComputationGraph.h"
+#include "memory/Workspace.h"
+#include "misc/InitFunction.h"
+
+namespace nnet {
+namespace graph {
+
+namespace {
+struct LiveRange {
+  VariableAttrPtr var_;
+  size_t size_;
+  size_t begin_;  // index of the first op which needs the memory
+  size_t end_;    // index of the last op which reads it
+  size_t offset_;
+};
+
+constexpr size_t kAlignment = 64;
+
+size_t alignSize(size_t size) { return (size + kAlignment - 1) / kAlignment * kAlignment; }
+
+std::string toMB(size_t bytes) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.2fMB", bytes / 1048576.0);
+  return buf;
+}
+}
+
+/**
+ * planMemory could be used instead of requestResource. It computes the live range of every variable over the op list,
+ * and packs the variables whose live ranges do not overlap at the same offsets of one arena.
+ *
+ * Only the intermediate variables are packed. A variable stays in its own buffer when its value is used outside of
+ * the op list: parameters, feeds (read before any op writes them), and outputs no op reads. Variables of an arena of
+ * the workspace (see packParameters) stay in it. Accumulated gradients are zeroed before running, so they are live
+ * from the first op. Variables sharing a buffer (see the inplace stage) are packed as one.
+ */
+static void planMemory(Graph& g, const Map<std::string, Any>& attrs) {
+  auto w = any_cast<memory::Workspace*>(attrs.at("workspace"));
+  Map<std::string, size_t> firstWrite;
+  Map<std::string, size_t> lastRead;
+  Set<std::string> feeds;
+  for (size_t i = 0; i < g.ops_.size(); ++i) {
+    auto& op = g.ops_[i];
+    for (auto& in : op.inputs_) {
+      if (in == nullptr) continue;
+      if (firstWrite.find(in->name_) == firstWrite.end()) {
+        feeds.insert(in->name_);
+      }
+      lastRead[in->name_] = i;
+    }
+    for (auto& out : op.outputs_) {
+      if (out != nullptr) {
+        firstWrite.insert({out->name_, i});
+      }
+    }
+  }
+
+  // Variables sharing a buffer (see the inplace stage) are planned as one, with the union of their live ranges.
+  Map<std::string, LiveRange> groups;
+  Set<std::string> persistent;
+  size_t totalSize = 0;
+  for (auto& item : g.variables_) {
+    auto& name = item.first;
+    auto& root = w->bufferName(name);
+    size_t size = item.second->bytes();
+    totalSize += size;
+    bool isParam = isParamName(name) || isStateName(name);
+    auto writeIt = firstWrite.find(name);
+    auto readIt = lastRead.find(name);
+    if (isParam || writeIt == firstWrite.end() || readIt == lastRead.end() || feeds.count(name) != 0 || size == 0 ||
+        w->inArena(name)) {
+      persistent.insert(root);
+      continue;
+    }
+    bool zeroed = isGradName(name) && item.second->accumulateGrad_;
+    size_t begin = zeroed ? 0 : writeIt->second;
+    auto it = groups.find(root);
+    if (it == groups.end()) {
+      groups.insert({root, {g.variables_.at(root), alignSize(size), begin, readIt->second, 0}});
+    } else {
+      it->second.begin_ = std::min(it->second.begin_, begin);
+      it->second.end_ = std::max(it->second.end_, readIt->second);
+    }
+  }
+
+  Vec<LiveRange> ranges;
+  size_t persistentSize = 0;
+  for (auto& root : persistent) {
+    auto buf = w->varBuffers_.find(root);
+    if (buf != w->varBuffers_.end() && dynamic_cast<memory::ViewVariableBuffer*>(buf->second.get()) != nullptr &&
+        !w->inArena(root)) {
+      w->eraseBuffer(root);  // was packed by a previous plan
+    }
+    persistentSize += (*w)(g.variables_.at(root))->getSize();
+  }
+  for (auto& group : groups) {
+    if (persistent.count(group.first) == 0) {
+      ranges.push_back(group.second);
+    }
+  }
+
+  // Greedy by size: place the largest variables first, each at the lowest offset where it does not overlap any
+  // placed variable which is alive at the same time.
+  std::sort(ranges.begin(), ranges.end(), [](const LiveRange& a, const LiveRange& b) {
+    return a.size_ != b.size_ ? a.size_ > b.size_ : a.var_->name_ < b.var_->name_;
+  });
+  size_t arenaSize = 0;
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    auto& r = ranges[i];
+    Vec<std::pair<size_t, size_t>> used;
+    for (size_t j = 0; j < i; ++j) {
+      auto& placed = ranges[j];
+      if (placed.begin_ <= r.end_ && r.begin_ <= placed.end_) {
+        used.push_back({placed.offset_, placed.offset_ + placed.size_});
+      }
+    }
+    std::sort(used.begin(), used.end());
+    r.offset_ = 0;
+    for (auto& u : used) {
+      if (r.offset_ + r.size_ <= u.first) break;
+      r.offset_ = std::max(r.offset_, u.second);
+    }
+    arenaSize = std::max(arenaSize, r.offset_ + r.size_);
+  }
+
+  auto arena = std::make_shared<memory::CpuVariableBuffer>(std::max(arenaSize, kAlignment));
+  for (auto& r : ranges) {
+    w->setBuffer(r.var_->name_, std::make_shared<memory::ViewVariableBuffer>(arena, r.offset_, r.var_->bytes()));
+  }
+  LOG(INFO) << "planMemory packs " << ranges.size() << " buffers for " << g.variables_.size() << " variables, peak "
+            << toMB(totalSize) << " -> " << toMB(persistentSize + arenaSize) << " (arena " << toMB(arenaSize) << ")";
+}
+
+static util::InitFunction init([] { compilers().insert({"planMemory", planMemory}); });
+}
+}
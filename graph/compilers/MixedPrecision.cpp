@@ -0,0 +1,50 @@
+#include "boost/algorithm/string.hpp"
+#include "graph/ComputationGraph.h"
+#include "misc/InitFunction.h"
+
+namespace nnet {
+namespace graph {
+
+static bool isFC(const Op& op) { return op.type_ == "fc" || op.type_ == "fc_bias_act"; }
+
+/**
+ * mixedPrecision stores the activations between fully connected layers in 16 bits, halving their memory and the
+ * bandwidth to read them. The attribute precision is "bf16" (default) or "fp16".
+ *
+ * The output of a fc or fc_bias_act becomes 16-bit when every op reading it is a fc or fc_bias_act reading it as X.
+ * These kernels convert row blocks to float and accumulate in float. Weights stay float, they are the master weights
+ * the optimizer updates, and gradients are always float. It must run before backward, e.g. right after fuse.
+ */
+static void mixedPrecision(Graph& g, const Map<std::string, Any>& attrs) {
+  for (auto& op : g.ops_) {
+    CHECK(!boost::algorithm::ends_with(op.type_, "_grad")) << "mixedPrecision must run before backward";
+  }
+  auto it = attrs.find("precision");
+  std::string precision = it == attrs.end() ? "bf16" : any_cast<std::string>(it->second);
+  CHECK(precision == "bf16" || precision == "fp16") << "Unknown precision " << precision;
+  VariableType type = precision == "bf16" ? kBF16 : kFP16;
+
+  Map<std::string, bool> onlyReadByFC;
+  for (auto& op : g.ops_) {
+    for (size_t i = 0; i < op.inputs_.size(); ++i) {
+      if (op.inputs_[i] == nullptr) continue;
+      auto res = onlyReadByFC.insert({op.inputs_[i]->name_, true});
+      res.first->second &= isFC(op) && i == 0;
+    }
+  }
+  size_t numConverted = 0;
+  for (auto& op : g.ops_) {
+    if (!isFC(op)) continue;
+    auto& out = op.outputs_[0];
+    auto readIt = onlyReadByFC.find(out->name_);
+    if (out->type_ == kFLOAT32 && readIt != onlyReadByFC.end() && readIt->second) {
+      out->type_ = type;
+      ++numConverted;
+    }
+  }
+  LOG(INFO) << "mixedPrecision stores " << numConverted << " activations in " << precision;
+}
+
+static util::InitFunction init([] { compilers().insert({"mixedPrecision", mixedPrecision}); });
+}
+}
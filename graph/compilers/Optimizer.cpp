@@ -1,37 +1,107 @@
+#include <algorithm>
+#include <cstring>
 #include "boost/algorithm/string.hpp"
 #include "graph/ComputationGraph.h"
 #include "misc/InitFunction.h"
 
 namespace nnet {
 namespace graph {
+
+// The state variables of each optimizer, one per parameter, named <param>.state.<kind>. A state has the dims of its
+// parameter, but the step of adam which is a single float. Inputs of an optimizer op are {param, grad, (rows,)
+// states...}, its outputs {param, states...}.
+static const Map<std::string, SmallVec<std::string>>& optimizerStates() {
+  static Map<std::string, SmallVec<std::string>> states = {
+      {"sgd", {}}, {"momentum", {"velocity"}}, {"adagrad", {"accum"}}, {"adam", {"m", "v", "step"}}};
+  return states;
+}
+
+/**
+ * optimizer appends an update op of every parameter. A row-sparse gradient (see lookup_table) is updated by the sparse
+ * version of the optimizer, which only touches the rows of the parameter in the gradient.
+ *
+ * With fuse_optimizer, the dense parameters are instead updated by a single op, whose inputs are {params, grads,
+ * states} with the states grouped by kind. Its kernel updates all of them as one flat array, so a model of many small
+ * parameters does not pay a kernel dispatch per parameter. The updates then no longer overlap the backward pass in a
+ * ThreadedEngine.
+ */
 static void optimizer(Graph& g, const Map<std::string, Any>& attrs) {
-  for (auto varPtr : g.variables_) {
-    auto optimizer = any_cast<std::string>(attrs.at("optimizer"));
-    if (boost::algorithm::contains(varPtr.first, ".grad") && boost::algorithm::contains(varPtr.first, ".param")) {
+  auto optimizer = any_cast<std::string>(attrs.at("optimizer"));
+  auto statesIt = optimizerStates().find(optimizer);
+  CHECK(statesIt != optimizerStates().end()) << "Not supported optimizer " << optimizer;
+  auto fuseIt = attrs.find("fuse_optimizer");
+  bool fuse = fuseIt != attrs.end() && any_cast<bool>(fuseIt->second);
+
+  auto appendOp = [&](const std::string& type) -> Op& {
+    g.ops_.emplace_back();
+    graph::Op& op = g.ops_.back();
+    op.type_ = type;
+    auto& meta = OpMeta::gAllOpMeta_[type];
+    for (auto& attrMeta : meta.attrMeta_) {
+      auto attrsIt = attrs.find(attrMeta->name_);
+      if (attrsIt != attrs.end()) {
+        op.attrs_[attrsIt->first] = attrsIt->second;
+      }
+    }
+    meta.checkAttrs(&op.attrs_);
+    return op;
+  };
+  auto createState = [&](const VariableAttrPtr& param, const std::string& kind) {
+    SmallVec<size_t> dims = kind == "step" ? SmallVec<size_t>{1} : param->dims_;
+    auto state = g.createOrResizeVar(param->name_ + ".state." + kind, dims, false, kFLOAT32);
+    state->specialResetFunction_ = [](Variable var) { std::memset(var.buffer_->get(), 0, var.buffer_->getSize()); };
+    return state;
+  };
+
+  SmallVec<std::pair<VariableAttrPtr, VariableAttrPtr>> dense;  // (param, grad), fused into one op
+  auto variables = g.variables_;  // states are added to g
+  for (auto varPtr : variables) {
+    if (boost::algorithm::ends_with(varPtr.first, ".grad") && boost::algorithm::contains(varPtr.first, ".param")) {
       auto paramKey = boost::algorithm::replace_last_copy(varPtr.first, ".grad", "");
       auto it = g.variables_.find(paramKey);
       CHECK_NE(it, g.variables_.end());
-      g.ops_.emplace_back();
-      graph::Op& op = g.ops_.back();
-      op.type_ = optimizer;
-      auto& meta = OpMeta::gAllOpMeta_[op.type_];
-
-      Map<std::string, Any> opAttr;
-      for (auto& attrMeta : meta.attrMeta_) {
-        auto attrsIt = attrs.find(attrMeta->name_);
-        if (attrsIt != attrs.end()) {
-          opAttr[attrsIt->first] = attrsIt->second;
-        }
+      bool sparse = !varPtr.second->sparseRows_.empty();
+      if (fuse && !sparse) {
+        dense.push_back({it->second, varPtr.second});
+        continue;
       }
-      op.attrs_ = opAttr;
+      graph::Op& op = appendOp(sparse ? "sparse_" + optimizer : optimizer);
       op.inputs_ = {it->second, varPtr.second};
       op.outputs_ = {it->second};
-      for (auto& attrMeta : meta.attrMeta_) {
-        attrMeta->constraints_->check(attrMeta->name_, &op.attrs_);
+      if (sparse) {
+        op.inputs_.push_back(g.variables_.at(varPtr.second->sparseRows_));
+      }
+      for (auto& kind : statesIt->second) {
+        auto state = createState(it->second, kind);
+        op.inputs_.push_back(state);
+        op.outputs_.push_back(state);
+      }
+    }
+  }
+
+  if (!dense.empty()) {
+    // sorted by name, so the layout of the op does not depend on the order of the hash map.
+    std::sort(dense.begin(), dense.end(), [](const std::pair<VariableAttrPtr, VariableAttrPtr>& a,
+                                             const std::pair<VariableAttrPtr, VariableAttrPtr>& b) {
+      return a.first->name_ < b.first->name_;
+    });
+    graph::Op& op = appendOp(optimizer);
+    for (auto& p : dense) {
+      op.inputs_.push_back(p.first);
+      op.outputs_.push_back(p.first);
+    }
+    for (auto& p : dense) {
+      op.inputs_.push_back(p.second);
+    }
+    for (auto& kind : statesIt->second) {
+      for (auto& p : dense) {
+        auto state = createState(p.first, kind);
+        op.inputs_.push_back(state);
+        op.outputs_.push_back(state);
       }
     }
   }
 }
 static util::InitFunction init([] { compilers().insert({"optimizer", optimizer}); });
 }
-}
\ No newline at end of file
+}
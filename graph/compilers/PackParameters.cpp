@@ -0,0 +1,65 @@
+#include <algorithm>
+#include "graph/ComputationGraph.h"
+#include "memory/Workspace.h"
+#include "misc/InitFunction.h"
+
+namespace nnet {
+namespace graph {
+
+/**
+ * packParameters places the parameters in the arena "param" of the workspace, their gradients in the arena "grad", and
+ * the optimizer states (<param>.state.<kind>) in an arena "state.<kind>" per kind, all in the same order: the
+ * parameters with a dense gradient sorted by name, then the others. So the engine zeros every gradient at once, the
+ * fused optimizer updates every parameter as one array, and replicas all-reduce one buffer.
+ *
+ * Only dense float variables are packed, a row-sparse gradient keeps its own buffer. It must run before inplace,
+ * requestResource or planMemory, and does nothing when the arenas are already packed.
+ */
+static void packParameters(Graph& g, const Map<std::string, Any>& attrs) {
+  auto w = any_cast<memory::Workspace*>(attrs.at("workspace"));
+  auto dense = [](const VariableAttrPtr& var) { return var->type_ == kFLOAT32 && var->sparseRows_.empty(); };
+  const std::string stateInfix = ".state.";
+  Vec<VariableAttrPtr> withGrad, others;
+  Map<std::string, Vec<VariableAttrPtr>> states;  // by the name of their parameter
+  for (auto& item : g.variables_) {
+    auto& name = item.first;
+    if (!dense(item.second)) continue;
+    if (isStateName(name)) {
+      states[name.substr(0, name.find(stateInfix))].push_back(item.second);
+      continue;
+    }
+    if (!isParamName(name)) continue;
+    auto grad = g.variables_.find(name + ".grad");
+    bool packGrad = grad != g.variables_.end() && dense(grad->second) && grad->second->bytes() == item.second->bytes();
+    (packGrad ? withGrad : others).push_back(item.second);
+  }
+  auto byName = [](const VariableAttrPtr& a, const VariableAttrPtr& b) { return a->name_ < b->name_; };
+  std::sort(withGrad.begin(), withGrad.end(), byName);
+  std::sort(others.begin(), others.end(), byName);
+
+  SmallVec<VariableAttrPtr> params, grads;
+  Map<std::string, SmallVec<VariableAttrPtr>> stateArenas;
+  for (auto* vars : {&withGrad, &others}) {
+    for (auto& param : *vars) {
+      params.push_back(param);
+      if (vars == &withGrad) {
+        grads.push_back(g.variables_.at(param->name_ + ".grad"));
+      }
+      auto it = states.find(param->name_);
+      if (it == states.end()) continue;
+      std::sort(it->second.begin(), it->second.end(), byName);
+      for (auto& state : it->second) {
+        stateArenas["state." + state->name_.substr(param->name_.size() + stateInfix.size())].push_back(state);
+      }
+    }
+  }
+  w->packArena("param", params);
+  w->packArena("grad", grads);
+  for (auto& arena : stateArenas) {
+    w->packArena(arena.first, arena.second);
+  }
+}
+
+static util::InitFunction init([] { compilers().insert({"packParameters", packParameters}); });
+}
+}
@@ -0,0 +1,79 @@
+#include <cmath>
+#include "boost/algorithm/string.hpp"
+#include "graph/ComputationGraph.h"
+#include "misc/InitFunction.h"
+#include "misc/Int8.h"
+
+namespace nnet {
+namespace graph {
+
+static bool isFC(const Op& op) { return op.type_ == "fc" || op.type_ == "fc_bias_act"; }
+
+/**
+ * quantize rewrites the fc and fc_bias_act of an inference graph to fc_int8, post-training. It runs after the
+ * inference stage. The attr calibration maps the inputs of the ops to their largest magnitude over sample batches, an
+ * input is quantized by steps of it / 127. The attr packed_weights names the weights already quantized per output
+ * channel into the workspace, as <weight>.int8, .int8_scale and .int8_sum, which become parameters of the graph, and
+ * the float weights are removed from it. Both come from engine::Calibrator. Ops with an input not calibrated, e.g.
+ * sparse, or a weight not packed stay float.
+ *
+ * The output of a fc_int8 only read as the input of other fc_int8 is requantized to kINT8 by the op writing it, so it
+ * is never stored as float.
+ */
+static void quantize(Graph& g, const Map<std::string, Any>& attrs) {
+  for (auto& op : g.ops_) {
+    CHECK(!boost::algorithm::ends_with(op.type_, "_grad")) << "quantize runs on an inference graph";
+  }
+  auto calibration = any_cast<Map<std::string, float>>(attrs.at("calibration"));
+  auto packedWeights = any_cast<Set<std::string>>(attrs.at("packed_weights"));
+
+  Set<std::string> floatWeights;
+  size_t numQuantized = 0;
+  for (auto& op : g.ops_) {
+    if (!isFC(op) || (op.inputs_[0]->type_ != kFLOAT32 && !isHalf(op.inputs_[0]->type_))) continue;
+    auto range = calibration.find(op.inputs_[0]->name_);
+    auto W = op.inputs_[1];
+    if (range == calibration.end() || packedWeights.count(W->name_) == 0) continue;
+    size_t k = W->dims_[0], n = W->dims_[1];
+    auto packed = g.createOrResizeVar(
+        W->name_ + ".int8", {util::roundUp(k, util::kInt8GroupRows), util::roundUp(n, util::kInt8PanelCols)}, false,
+        kINT8);
+    auto scales = g.createOrResizeVar(W->name_ + ".int8_scale", {n, 1}, false, kFLOAT32);
+    auto sums = g.createOrResizeVar(W->name_ + ".int8_sum", {n, 1}, false, kINT32);
+    Map<std::string, Any> int8Attrs = {
+        {"input_scale", std::max(range->second, 1e-30f) / 127},
+        {"output_scale", 1.0f / 127},
+        {"activation", std::string(op.type_ == "fc_bias_act" ? "sigmoid" : "none")}};
+    op = Op("fc_int8", {op.inputs_[0], packed, op.inputs_[2], scales, sums}, op.outputs_, int8Attrs);
+    floatWeights.insert(W->name_);
+    ++numQuantized;
+  }
+
+  Map<std::string, Vec<Op*>> readers;
+  for (auto& op : g.ops_) {
+    for (size_t i = 0; i < op.inputs_.size(); ++i) {
+      if (op.inputs_[i] == nullptr) continue;
+      readers[op.inputs_[i]->name_].push_back(op.type_ == "fc_int8" && i == 0 ? &op : nullptr);
+      floatWeights.erase(op.inputs_[i]->name_);  // still read by a float op
+    }
+  }
+  size_t numRequantized = 0;
+  for (auto& op : g.ops_) {
+    if (op.type_ != "fc_int8") continue;
+    auto& out = op.outputs_[0];
+    auto& outReaders = readers[out->name_];
+    if (outReaders.empty() || std::find(outReaders.begin(), outReaders.end(), nullptr) != outReaders.end()) continue;
+    out->type_ = kINT8;
+    op.attrs_["output_scale"] = outReaders[0]->attrs_.at("input_scale");  // the readers have the same calibration
+    ++numRequantized;
+  }
+  for (auto& name : floatWeights) {
+    g.variables_.erase(name);
+  }
+  LOG(INFO) << "quantize creates " << numQuantized << " fc_int8 with the " << util::int8KernelName(util::kINT8_AUTO)
+            << " kernel, " << numRequantized << " int8 activations";
+}
+
+static util::InitFunction init([] { compilers().insert({"quantize", quantize}); });
+}
+}
@@ -1,9 +1,17 @@
 #include <Eigen/SparseCore>
+#include <chrono>
 #include <iostream>
 // should use glog instead of elpp, because we could throw a Error when
 // log(Fatal)
 #include <easylogging++.h>
-#include <mnist/mnist_reader.hpp>
+#include <unistd.h>
+#include "api/GraphBuilder.h"
+#include "data/Checkpoint.h"
+#include "data/DataLoader.h"
+#include "data/Mnist.h"
+#include "engine/Autotuner.h"
+#include "engine/Calibrator.h"
+#include "engine/DataParallelTrainer.h"
 #include "engine/Engine.h"
 #include "graph/ComputationGraph.h"
 #include "memory/Workspace.h"
@@ -11,137 +19,144 @@
 #include "misc/Error.h"
 #include "misc/InitFunction.h"
 
-namespace nnet {
-namespace api {
-enum ActivationType { kSigmoid, kSoftmax };
+// Build the MNIST MLP with its backward and optimizer ops. Return the loss and the error rate variables. With a
+// precision of bf16 or fp16, the hidden activations are stored in 16 bits.
+static std::pair<nnet::graph::VariableAttrPtr, nnet::graph::VariableAttrPtr> BuildMnistMLP(
+    nnet::graph::Graph* g, nnet::memory::Workspace& w, size_t batchSize, const std::string& precision = "float32") {
+  nnet::api::GraphBuilder builder(w, g);
+  auto xVar = g->createOrResizeVar("X", {batchSize, 784}, false, nnet::graph::kFLOAT32);
 
-const char* toString(ActivationType act) {
-  switch (act) {
-    case kSigmoid:
-      return "sigmoid";
-    case kSoftmax:
-      return "softmax";
-    default:
-      LOG(FATAL) << "Not supported act " << act;
+  auto hidden = builder.fullyConnected("fc1", xVar, 100, true);
+  hidden = builder.fullyConnected("fc2", hidden, 100, true);
+  auto prediction = builder.fullyConnected("prediction", hidden, 10, true, nnet::api::kSoftmax);
+  auto labelVar = g->createOrResizeVar("Label", {batchSize, 1}, false, nnet::graph::kINT32);
+  auto loss = builder.crossEntropy("xe_loss", prediction, labelVar);
+  auto errorRate = builder.errorRate("error_rate", prediction, labelVar);
+  auto avgLoss = builder.mean("avg_loss", loss);
+
+  nnet::graph::compileGraph(g, {"fuse"});
+  if (precision != "float32") {
+    nnet::graph::compileGraph(g, {"mixedPrecision"}, {{"precision", precision}});
   }
+  builder.backward(avgLoss);
+  nnet::graph::compileGraph(g, {"optimizer"},
+                            {{"optimizer", std::string("sgd")}, {"learning_rate", 1.0f}, {"fuse_optimizer", true}});
+  return {avgLoss, errorRate};
 }
 
-class GraphBuilder {
- public:
-  explicit inline GraphBuilder(memory::Workspace& workspace, graph::Graph* g) : graph_(g), workspace_(workspace) {}
-
-  void addOp(const std::string& type, const SmallVec<graph::VariableAttrPtr>& inputs,
-             const SmallVec<graph::VariableAttrPtr>& outputs,
-             const Map<std::string, Any>& attrs = Map<std::string, Any>()) {
-    this->graph_->ops_.emplace_back();
-    graph::Op& op = this->graph_->ops_.back();
-    op.type_ = type;
-    op.attrs_ = attrs;
-    op.inputs_ = inputs;
-    op.outputs_ = outputs;
-    graph::OpMeta& meta = graph::OpMeta::gAllOpMeta_[op.type_];
-    meta.shapeInferer_(inputs, outputs);
-    for (auto& attrMeta : meta.attrMeta_) {
-      attrMeta->constraints_->check(attrMeta->name_, &op.attrs_);
-    }
+// Map the MNIST dataset file, MNIST is converted to dataset files in the current directory on the first run, and
+// again when the files were written in an older format. Files converted with uint8 pixels (see nnet_convert_mnist)
+// are read as well.
+static std::unique_ptr<nnet::data::MappedDataset> OpenMnist(bool test) {
+  std::string path = test ? "./mnist-test.nnet" : "./mnist-train.nnet";
+  if (!nnet::data::MappedDataset::readable(path)) {
+    nnet::data::convertMnist("./3rdparty/mnist/", ".");
   }
+  return std::unique_ptr<nnet::data::MappedDataset>(new nnet::data::MappedDataset(path));
+}
 
-  graph::VariableAttrPtr crossEntropy(const std::string& paramPrefix, graph::VariableAttrPtr input,
-                                      graph::VariableAttrPtr label) {
-    auto loss = graph_->createOrResizeVar(paramPrefix + ".output", {0}, true, graph::kFLOAT32);
-    addOp("cross_entropy", {input, label}, {loss});
-    return loss;
+// Evaluate the error rate on the test set, with a graph pruned to the ops computing the error rate. With the attrs
+// of the quantize stage, the fully connected layers run in int8. Return the error rate, and the seconds the engine ran
+// in *seconds.
+static float TestMnist(const nnet::graph::Graph& trainGraph, nnet::memory::Workspace& w,
+                       const std::string& errorRateName, const nnet::Map<std::string, nnet::Any>* quantize = nullptr,
+                       double* seconds = nullptr) {
+  nnet::graph::Graph g = trainGraph.clone();
+  nnet::graph::compileGraph(&g, {"inference"}, {{"fetch", nnet::SmallVec<std::string>{errorRateName}}});
+  if (quantize != nullptr) {
+    nnet::graph::compileGraph(&g, {"quantize"}, *quantize);
   }
-
-  graph::VariableAttrPtr errorRate(const std::string& paramPrefix, graph::VariableAttrPtr prediction,
-                                   graph::VariableAttrPtr label) {
-    auto errorRate = graph_->createOrResizeVar(paramPrefix, {0}, false, graph::kFLOAT32);
-    addOp("error_rate", {prediction, label}, {errorRate});
-    return errorRate;
+  nnet::engine::NaiveEngine engine(w, g);
+  auto dataset = OpenMnist(true);
+  nnet::data::DataLoaderOptions loaderOptions;
+  loaderOptions.batchSize_ = g.variables_.at("X")->dims_[0];
+  loaderOptions.shuffle_ = false;
+  nnet::data::DataLoader loader(*dataset, {{g.variables_.at("X"), "X"}, {g.variables_.at("Label"), "Label"}},
+                                loaderOptions);
+  size_t numBatches = loader.numBatches();
+  float errorRate = 0;
+  std::chrono::steady_clock::duration elapsed{0};
+  for (size_t i = 0; i < numBatches; ++i) {
+    loader.next(w);
+    auto begin = std::chrono::steady_clock::now();
+    engine.run();
+    elapsed += std::chrono::steady_clock::now() - begin;
+    errorRate += *(float*)w.getVar(g.variables_.at(errorRateName)).buffer_->get();
   }
-
-  graph::VariableAttrPtr mean(const std::string& paramPrefix, graph::VariableAttrPtr input) {
-    auto mean = graph_->createOrResizeVar(paramPrefix + ".output", {0}, true, graph::kFLOAT32);
-    addOp("mean", {input}, {mean});
-    return mean;
+  if (seconds != nullptr) {
+    *seconds = std::chrono::duration<double>(elapsed).count();
   }
+  return errorRate / numBatches;
+}
 
-  graph::VariableAttrPtr fullyConnected(const std::string& paramPrefix, graph::VariableAttrPtr input, size_t size,
-                                        bool withBias = true, const ActivationType& act = kSigmoid,
-                                        bool allocParam = true) {
-    CHECK_EQ(input->dims_.size(), 2UL);
-    auto layerWidth = input->dims_[1];
-
-    auto paramVar =
-        graph_->createOrResizeVar(paramPrefix + ".param.weight.0", {layerWidth, size}, true, graph::kFLOAT32);
-    workspace_(paramVar);
-    SmallVec<graph::VariableAttrPtr> inputs = {input, paramVar, nullptr};
-    if (withBias) {
-      auto biasVar = graph_->createOrResizeVar(paramPrefix + ".param.bias", {size, 1}, true, graph::kFLOAT32);
-      workspace_(biasVar);
-      inputs.back() = biasVar;
+// The attrs of the quantize stage: the inputs of the fully connected layers calibrated over the first training
+// batches, and their weights packed into w.
+static nnet::Map<std::string, nnet::Any> CalibrateMnist(const nnet::graph::Graph& trainGraph,
+                                                        nnet::memory::Workspace& w, const std::string& errorRateName,
+                                                        size_t numBatches = 10) {
+  nnet::graph::Graph g = trainGraph.clone();
+  nnet::graph::compileGraph(&g, {"inference"}, {{"fetch", nnet::SmallVec<std::string>{errorRateName}}});
+  // The layers are run in a workspace of their own, which shares the parameters. In the training workspace the
+  // memory is planned, an input could be overwritten before the calibrator reads it.
+  nnet::memory::Workspace calibrationW;
+  for (auto& var : g.variables_) {
+    if (nnet::graph::isParamName(var.first)) {
+      calibrationW.setBuffer(var.first, w(var.second));
     }
-
-    auto fcOpOut = graph_->createOrResizeVar(paramPrefix + "fc.output", {0}, true, graph::kFLOAT32);
-
-    addOp("fc", inputs, {fcOpOut});
-
-    auto finalOutput = graph_->createOrResizeVar(paramPrefix + ".output", {0}, true, graph::kFLOAT32);
-
-    addOp(toString(act), {fcOpOut}, {finalOutput});
-    return finalOutput;
   }
-
-  // backward
-  void backward(graph::VariableAttrPtr loss) {
-    Map<std::string, Any> attrs;
-    attrs.insert({"loss_name", loss->name_});
-    graph::compileGraph(graph_, {"backward"}, attrs);
-  };
-
- private:
-  graph::Graph* graph_;
-  memory::Workspace& workspace_;
-};
-}
+  nnet::engine::NaiveEngine engine(calibrationW, g);
+  nnet::engine::Calibrator calibrator(g);
+  auto dataset = OpenMnist(false);
+  nnet::data::DataLoaderOptions loaderOptions;
+  loaderOptions.batchSize_ = g.variables_.at("X")->dims_[0];
+  nnet::data::DataLoader loader(*dataset, {{g.variables_.at("X"), "X"}, {g.variables_.at("Label"), "Label"}},
+                                loaderOptions);
+  for (size_t i = 0; i < std::min(numBatches, loader.numBatches()); ++i) {
+    loader.next(calibrationW);
+    engine.run();
+    calibrator.observe(calibrationW);
+  }
+  return {{"calibration", calibrator.ranges()}, {"packed_weights", calibrator.packWeights(w)}};
 }
 
-static void TrainMnistOnePass(size_t numPasses = 10, bool printGradMean = false) {
+static void TrainMnistOnePass(size_t numPasses = 10, bool printGradMean = false,
+                              const std::string& engineType = "naive", size_t numThreads = 1,
+                              const std::string& tracePath = "", const std::string& checkpointPath = "",
+                              const std::string& precision = "float32", const std::string& autotunePath = "") {
   nnet::graph::Graph g;
   constexpr size_t BATCH_SIZE = 1000;
   nnet::memory::Workspace w;
+  auto outputs = BuildMnistMLP(&g, w, BATCH_SIZE, precision);
+  auto avgLoss = outputs.first;
+  auto errorRate = outputs.second;
+
+  auto enginePtr = nnet::engine::createEngine(engineType, w, g, numThreads);
+  auto& engine = *enginePtr;
+  engine.setPlanMemory(true);
+  engine.setPackParameters(true);
+  if (!checkpointPath.empty() && access(checkpointPath.c_str(), R_OK) == 0) {
+    nnet::data::restoreCheckpoint(g, w, checkpointPath);  // go on from the last saved pass
+  } else {
+    engine.randomize();
+  }
+  nnet::engine::Profiler profiler;
+  if (!tracePath.empty()) {
+    engine.setProfiler(&profiler);
+  }
+  nnet::engine::Autotuner autotuner(autotunePath);
+  if (!autotunePath.empty()) {
+    engine.setAutotuner(&autotuner);
+  }
 
-  nnet::api::GraphBuilder builder(w, &g);
-  auto xVar = g.createOrResizeVar("X", {BATCH_SIZE, 784}, false, nnet::graph::kFLOAT32);
-
-  auto hidden = builder.fullyConnected("fc1", xVar, 100, true);
-  hidden = builder.fullyConnected("fc2", hidden, 100, true);
-  auto prediction = builder.fullyConnected("prediction", hidden, 10, true, nnet::api::kSoftmax);
-  auto labelVar = g.createOrResizeVar("Label", {BATCH_SIZE, 1}, false, nnet::graph::kINT32);
-  auto loss = builder.crossEntropy("xe_loss", prediction, labelVar);
-  auto errorRate = builder.errorRate("error_rate", prediction, labelVar);
-  auto avgLoss = builder.mean("avg_loss", loss);
-
-  builder.backward(avgLoss);
-  nnet::graph::compileGraph(&g, {"optimizer"}, {{"optimizer", std::string("sgd")}, {"learning_rate", 1.0f}});
-
-  nnet::engine::NaiveEngine engine(w, g);
-  engine.randomize();
-
-  auto dataset = mnist::read_dataset_direct<std::vector, std::vector<uint8_t>>("./3rdparty/mnist/");
+  auto dataset = OpenMnist(false);
+  nnet::data::DataLoaderOptions loaderOptions;
+  loaderOptions.batchSize_ = BATCH_SIZE;
+  nnet::data::DataLoader loader(*dataset, {{g.variables_.at("X"), "X"}, {g.variables_.at("Label"), "Label"}},
+                                loaderOptions);
+  std::future<void> checkpointing;
   for (size_t passId = 0; passId < numPasses; ++passId) {
-    for (size_t i = 0; i < dataset.training_images.size() / BATCH_SIZE; ++i) {
-      auto buf = (float*)w(xVar)->get();
-      auto labelBuf = (int*)w(labelVar)->get();
-      for (size_t j = 0; j < BATCH_SIZE; ++j) {
-        auto& img = dataset.training_images[j + i * BATCH_SIZE];
-        auto& lbl = dataset.training_labels[j + i * BATCH_SIZE];
-        for (size_t k = 0; k < 784; ++k) {
-          buf[j * 784 + k] = img[k];
-        }
-        labelBuf[j] = lbl;
-      }
-      nnet::eigen::cast<nnet::eigen::Matrix>(w.getVar(xVar)).array() /= 255.0;
+    for (size_t i = 0; i < loader.numBatches(); ++i) {
+      loader.next(w);  // shuffled, gathered while the previous batch was running
       engine.resetOrCreateGradient();
       engine.run(false);
       if (printGradMean) {
@@ -153,14 +168,64 @@ static void TrainMnistOnePass(size_t numPasses = 10, bool printGradMean = false)
       LOG(INFO) << "MNIST pass-id=" << passId << " batch-id=" << i << " XE-Loss = " << *avgLossArr.data()
                 << " error_rate = " << *errRateArr.data() * 100 << "%";
     }
+    if (!checkpointPath.empty()) {
+      checkpointing = nnet::data::saveCheckpoint(g, w, checkpointPath);  // waits for the previous save, if any
+    }
   }
+  LOG(INFO) << "Data loader waited for " << loader.numStalls() << " of " << numPasses * loader.numBatches()
+            << " batches";
+  if (!tracePath.empty()) {
+    profiler.printSummary(std::cout);
+    profiler.writeChromeTrace(tracePath);
+  }
+  double floatSeconds, int8Seconds;
+  float floatErrorRate = TestMnist(g, w, errorRate->name_, nullptr, &floatSeconds);
+  auto quantize = CalibrateMnist(g, w, errorRate->name_);
+  float int8ErrorRate = TestMnist(g, w, errorRate->name_, &quantize, &int8Seconds);
+  LOG(INFO) << "MNIST test error_rate = " << floatErrorRate * 100 << "% in " << floatSeconds * 1000 << "ms, int8 "
+            << int8ErrorRate * 100 << "% in " << int8Seconds * 1000 << "ms";
+  auto stats = nnet::memory::cpuAllocator().stats();
+  LOG(INFO) << "CPU allocator: live " << stats.liveBytes_ << " bytes, peak " << stats.peakBytes_ << " bytes, "
+            << stats.numAllocs_ << " allocations, " << stats.numSystemAllocs_ << " from the system";
 }
 
-int main() {
+static void TrainMnistDataParallel(size_t numPasses = 10, size_t numReplicas = 2) {
+  nnet::graph::Graph g;
+  constexpr size_t BATCH_SIZE = 1000;
+  nnet::memory::Workspace w;
+  auto outputs = BuildMnistMLP(&g, w, BATCH_SIZE);
+  nnet::engine::DataParallelTrainer trainer(g, numReplicas);
+  trainer.randomize();
+
+  auto dataset = OpenMnist(false);
+  for (size_t passId = 0; passId < numPasses; ++passId) {
+    for (size_t i = 0; i < dataset->numRecords() / BATCH_SIZE; ++i) {
+      dataset->copy(trainer.getFeed("X"), "X", i * BATCH_SIZE);  // the trainer splits the feeds to its replicas
+      dataset->copy(trainer.getFeed("Label"), "Label", i * BATCH_SIZE);
+      trainer.run();
+      LOG(INFO) << "MNIST pass-id=" << passId << " batch-id=" << i
+                << " XE-Loss = " << trainer.fetchMean(outputs.first->name_)
+                << " error_rate = " << trainer.fetchMean(outputs.second->name_) * 100 << "%";
+    }
+  }
+}
+
+int main(int argc, char** argv) {
   nnet::util::InitFunction::apply();
+  nnet::memory::cpuAllocator().setHugePages(true);
   bool runMNIST = true;
+  std::string engineType = argc > 1 ? argv[1] : "naive";  // naive, threaded or data_parallel
+  size_t numThreads = argc > 2 ? std::stoul(argv[2]) : 1;  // 0 means one thread per core, or number of replicas
+  std::string tracePath = argc > 3 ? argv[3] : "";          // profile and write a chrome://tracing file
+  std::string checkpointPath = argc > 4 ? argv[4] : "";     // restored if it exists, saved after every pass
+  std::string precision = argc > 5 ? argv[5] : "float32";   // or bf16, fp16 for the activations
+  std::string autotunePath = argc > 6 ? argv[6] : "";       // autotune the kernels, cached in this file
   if (runMNIST) {
-    TrainMnistOnePass(10);
+    if (engineType == "data_parallel") {
+      TrainMnistDataParallel(10, std::max(numThreads, 1UL));
+    } else {
+      TrainMnistOnePass(10, false, engineType, numThreads, tracePath, checkpointPath, precision, autotunePath);
+    }
   }
 
   return 0;
@@ -0,0 +1,69 @@
+#include "CpuAllocator.h"
+#include <easylogging++.h>
+#include <sys/mman.h>
+#include <cstdlib>
+
+namespace nnet {
+namespace memory {
+
+size_t CpuAllocator::sizeClass(size_t size) {
+  if (size <= kAlignment) {
+    return kAlignment;
+  }
+  size_t pow = 1UL << (63 - __builtin_clzl(size - 1));  // the largest power of two less than size
+  size_t step = pow / 4;
+  return (size + step - 1) / step * step;
+}
+
+void* CpuAllocator::allocate(size_t size, size_t* capacity) {
+  size_t cls = sizeClass(size);
+  *capacity = cls;
+  {
+    std::lock_guard<std::mutex> g(mu_);
+    ++stats_.numAllocs_;
+    stats_.liveBytes_ += cls;
+    stats_.peakBytes_ = std::max(stats_.peakBytes_, stats_.liveBytes_);
+    auto it = freeBlocks_.find(cls);
+    if (it != freeBlocks_.end() && !it->second.empty()) {
+      void* ptr = it->second.back();
+      it->second.pop_back();
+      stats_.cachedBytes_ -= cls;
+      return ptr;
+    }
+    ++stats_.numSystemAllocs_;
+  }
+  bool huge = hugePages_ && cls >= kHugePageSize;
+  void* ptr = nullptr;
+  CHECK_EQ(posix_memalign(&ptr, huge ? kHugePageSize : kAlignment, cls), 0) << "Cannot allocate " << cls << " bytes";
+  if (huge) {
+    madvise(ptr, cls, MADV_HUGEPAGE);  // only a hint, it fails when THP is disabled
+  }
+  return ptr;
+}
+
+void CpuAllocator::deallocate(void* ptr, size_t capacity) {
+  if (ptr == nullptr) return;
+  std::lock_guard<std::mutex> g(mu_);
+  ++stats_.numFrees_;
+  stats_.liveBytes_ -= capacity;
+  stats_.cachedBytes_ += capacity;
+  freeBlocks_[capacity].push_back(ptr);
+}
+
+void CpuAllocator::release() {
+  std::lock_guard<std::mutex> g(mu_);
+  for (auto& blocks : freeBlocks_) {
+    for (auto ptr : blocks.second) {
+      free(ptr);
+    }
+  }
+  freeBlocks_.clear();
+  stats_.cachedBytes_ = 0;
+}
+
+CpuAllocator& cpuAllocator() {
+  static CpuAllocator* gAllocator = new CpuAllocator();  // never destroyed, buffers could outlive static objects
+  return *gAllocator;
+}
+}
+}
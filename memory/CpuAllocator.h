@@ -0,0 +1,64 @@
+#pragma once
+#include <cstddef>
+#include <mutex>
+#include "misc/Typedef.h"
+
+namespace nnet {
+namespace memory {
+
+struct AllocatorStats {
+  size_t liveBytes_{0};    // bytes of the blocks in use, rounded up to their size class
+  size_t peakBytes_{0};    // maximum of liveBytes_
+  size_t cachedBytes_{0};  // bytes of the free blocks kept for reuse
+  size_t numAllocs_{0};
+  size_t numFrees_{0};
+  size_t numSystemAllocs_{0};  // allocations which missed the cache
+};
+
+/**
+ * CpuAllocator is a caching allocator of the buffers of variables. A size is rounded up to its size class (four
+ * classes per power of two), and a freed block is kept in the free list of its class, so buffers are reused across
+ * variables and resizes do not go to the system allocator every mini-batch.
+ *
+ * Blocks are 64-byte aligned. With huge pages enabled, blocks of at least 2MB are 2MB aligned and advised to be
+ * backed by transparent huge pages. It is thread safe.
+ */
+class CpuAllocator final {
+ public:
+  static constexpr size_t kAlignment = 64;
+  static constexpr size_t kHugePageSize = 2UL << 20;
+
+  CpuAllocator() = default;
+  CpuAllocator(const CpuAllocator&) = delete;
+  ~CpuAllocator() { release(); }
+
+  // Allocate a block of at least size bytes, its real size is returned in capacity.
+  void* allocate(size_t size, size_t* capacity);
+
+  // Return a block to the cache, capacity is the one returned by allocate.
+  void deallocate(void* ptr, size_t capacity);
+
+  // Free the cached blocks to the system.
+  void release();
+
+  void setHugePages(bool hugePages) { hugePages_ = hugePages; }
+
+  AllocatorStats stats() const {
+    std::lock_guard<std::mutex> g(mu_);
+    return stats_;
+  }
+
+  // The size class of a size, the smallest of 2^k, 1.25 * 2^k, 1.5 * 2^k and 1.75 * 2^k not less than it.
+  static size_t sizeClass(size_t size);
+
+ private:
+  mutable std::mutex mu_;
+  Map<size_t, Vec<void*>> freeBlocks_;  // by size class
+  AllocatorStats stats_;
+  bool hugePages_{false};
+};
+
+// The allocator of the CPU buffers of all workspaces.
+extern CpuAllocator& cpuAllocator();
+}
+}
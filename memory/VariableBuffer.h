@@ -2,6 +2,7 @@
 #include <easylogging++.h>
 #include <cstddef>
 #include <memory>
+#include "CpuAllocator.h"
 #include "misc/Error.h"
 #include "misc/Typedef.h"
 
@@ -30,25 +31,75 @@ class VariableBuffer {
 
 using VariableBufferPtr = std::shared_ptr<VariableBuffer>;
 
+// A buffer from cpuAllocator(). Growing it beyond its capacity drops its content.
 class CpuVariableBuffer : public VariableBuffer {
  public:
   CpuVariableBuffer() = default;
 
-  CpuVariableBuffer(size_t size) : VariableBuffer(size, size) { CHECK_EQ(posix_memalign(&buf_, 32UL, size), 0); }
+  CpuVariableBuffer(size_t size) : VariableBuffer(size, 0) { buf_ = cpuAllocator().allocate(size, &capacity_); }
 
-  ~CpuVariableBuffer() { free(buf_); }
+  ~CpuVariableBuffer() { cpuAllocator().deallocate(buf_, capacity_); }
 
   Device device() const override { return kDEVICE_CPU; }
 
   void resize(size_t newSize) override {
     if (newSize > capacity_) {
-      void* tmp;
-      CHECK_EQ(posix_memalign(&tmp, 32UL, newSize), 0);
-      free(buf_);
-      buf_ = tmp;
+      cpuAllocator().deallocate(buf_, capacity_);
+      buf_ = cpuAllocator().allocate(newSize, &capacity_);
     }
     size_ = newSize;
   }
 };
+
+/**
+ * ViewVariableBuffer is a slice of another buffer, e.g. of the arena the memory planner packs variables in. It keeps
+ * the arena alive, and cannot grow beyond the slice.
+ */
+class ViewVariableBuffer : public VariableBuffer {
+ public:
+  ViewVariableBuffer(const VariableBufferPtr& arena, size_t offset, size_t size)
+      : VariableBuffer(size, size), arena_(arena) {
+    CHECK_LE(offset + size, arena->getSize());
+    buf_ = (char*)arena->get() + offset;
+  }
+
+  Device device() const override { return arena_->device(); }
+
+  void resize(size_t newSize) override {
+    CHECK_LE(newSize, capacity_) << "A view cannot grow, plan the memory again";
+    size_ = newSize;
+  }
+
+ private:
+  VariableBufferPtr arena_;
+};
+
+/**
+ * ExternalVariableBuffer points at memory owned by another object, e.g. at the records of a memory-mapped dataset.
+ * It keeps the owner alive, and could be retargeted to other memory of it, e.g. to the next batch, without copying.
+ */
+class ExternalVariableBuffer : public VariableBuffer {
+ public:
+  ExternalVariableBuffer(const std::shared_ptr<void>& owner, void* ptr, size_t size)
+      : VariableBuffer(size, size), owner_(owner) {
+    buf_ = ptr;
+  }
+
+  Device device() const override { return kDEVICE_CPU; }
+
+  void resize(size_t newSize) override {
+    CHECK_LE(newSize, capacity_) << "An external buffer cannot grow, retarget it";
+    size_ = newSize;
+  }
+
+  void retarget(const std::shared_ptr<void>& owner, void* ptr, size_t size) {
+    owner_ = owner;
+    buf_ = ptr;
+    size_ = capacity_ = size;
+  }
+
+ private:
+  std::shared_ptr<void> owner_;
+};
 }
 }
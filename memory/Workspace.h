@@ -1,4 +1,5 @@
 #pragma once
+#include <cstring>
 #include "VariableBuffer.h"
 #include "graph/ComputationGraph.h"
 
@@ -16,6 +17,7 @@ class Workspace final {
     if (dev == kDEVICE_CPU) {
       auto buf = std::make_shared<CpuVariableBuffer>(size);
       varBuffers_.insert({name, buf});
+      ++generation_;
       return buf;
     } else {
       LOG(FATAL) << "Not implemented";
@@ -24,14 +26,121 @@ class Workspace final {
   }
 
   std::shared_ptr<VariableBuffer> operator()(const graph::VariableAttrPtr& attr) {
-    size_t sz = details::product(attr->dims_);
-    static_assert(sizeof(float) == sizeof(int), "");
-    sz *= sizeof(float);
-    return createOrResizeBuffer(attr->name_, sz, kDEVICE_CPU);
+    return createOrResizeBuffer(bufferName(attr->name_), attr->bytes(), kDEVICE_CPU);
   }
 
   graph::Variable getVar(const graph::VariableAttrPtr& attr) { return {attr, this->operator()(attr)}; }
 
+  // Let a variable use the buffer of another one, e.g. an output overwriting its input. See the inplace stage.
+  void shareBuffer(const std::string& name, const std::string& target) {
+    auto root = bufferName(target);
+    CHECK_NE(root, name);
+    aliases_[name] = root;
+    varBuffers_.erase(name);
+    ++generation_;
+  }
+
+  void unshareBuffer(const std::string& name) { generation_ += aliases_.erase(name); }
+
+  // The name the buffer of a variable is registered with.
+  const std::string& bufferName(const std::string& name) const {
+    auto it = aliases_.find(name);
+    return it == aliases_.end() ? name : it->second;
+  }
+
+  // The buffer registered with a name, nullptr if none.
+  VariableBuffer* findBuffer(const std::string& name) const {
+    auto it = varBuffers_.find(bufferName(name));
+    return it == varBuffers_.end() ? nullptr : it->second.get();
+  }
+
+  // Replace the buffer of a variable, e.g. by a view of an arena.
+  void setBuffer(const std::string& name, const std::shared_ptr<VariableBuffer>& buf) {
+    varBuffers_[name] = buf;
+    ++generation_;
+  }
+
+  void eraseBuffer(const std::string& name) {
+    varBuffers_.erase(name);
+    ++generation_;
+  }
+
+  /**
+   * @brief generation return a counter bumped whenever a name gets another buffer (or none), but not when an external
+   * buffer is retargeted. Who caches buffers, e.g. an ExecutionPlan, only looks them up again after it changed.
+   * varBuffers_ must not be changed directly for it to hold.
+   */
+  size_t generation() const { return generation_; }
+
+  // Let a variable read memory of an owner without copying. An external buffer set before is retargeted, so the
+  // buffer object of the variable stays the same across calls.
+  void setExternal(const std::string& name, const std::shared_ptr<void>& owner, void* ptr, size_t size) {
+    auto& root = bufferName(name);
+    auto it = varBuffers_.find(root);
+    auto buf = it == varBuffers_.end() ? nullptr : dynamic_cast<ExternalVariableBuffer*>(it->second.get());
+    if (buf != nullptr) {
+      buf->retarget(owner, ptr, size);
+    } else {
+      setBuffer(root, std::make_shared<ExternalVariableBuffer>(owner, ptr, size));
+    }
+  }
+
+  /**
+   * @brief packArena place the variables one after the other in one allocation, registered as the arena name, and
+   * make the buffer of each a view of it. The values are copied, variables without a buffer are zeroed. Operations on
+   * all of them, e.g. zeroing every gradient, then touch a single buffer. A variable of an arena cannot grow.
+   *
+   * Packing the same variables again does nothing, unless one got another buffer since, e.g. by restoreCheckpoint:
+   * they are then copied into a new arena.
+   */
+  VariableBufferPtr packArena(const std::string& name, const SmallVec<graph::VariableAttrPtr>& vars) {
+    auto it = arenas_.find(name);
+    if (it != arenas_.end()) {
+      if (isPacked(it->second, vars)) {
+        return it->second.buffer_;
+      }
+      for (auto& view : it->second.views_) {
+        arenaOf_.erase(view.first);
+      }
+      arenas_.erase(it);
+    }
+    if (vars.empty()) {
+      return nullptr;
+    }
+    size_t size = 0;
+    for (auto& var : vars) {
+      size += var->bytes();
+    }
+    Arena arena{std::make_shared<CpuVariableBuffer>(size), {}};
+    size_t offset = 0;
+    for (auto& var : vars) {
+      CHECK(arenaOf_.insert({var->name_, name}).second) << var->name_ << " is already in an arena";
+      unshareBuffer(var->name_);
+      auto view = std::make_shared<ViewVariableBuffer>(arena.buffer_, offset, var->bytes());
+      auto old = findBuffer(var->name_);
+      if (old != nullptr) {
+        CHECK_EQ(old->getSize(), view->getSize()) << "The values of " << var->name_ << " do not fit its dims";
+        std::memcpy(view->get(), old->get(), view->getSize());
+      } else {
+        std::memset(view->get(), 0, view->getSize());
+      }
+      setBuffer(var->name_, view);
+      arena.views_.push_back({var->name_, view});
+      offset += var->bytes();
+    }
+    arenas_.insert({name, arena});
+    return arena.buffer_;
+  }
+
+  // The arena registered by packArena, nullptr if none.
+  VariableBufferPtr arena(const std::string& name) const {
+    auto it = arenas_.find(name);
+    return it == arenas_.end() ? nullptr : it->second.buffer_;
+  }
+
+  // Whether the buffer of a variable is a view of an arena.
+  bool inArena(const std::string& name) const { return arenaOf_.find(name) != arenaOf_.end(); }
+
   std::shared_ptr<VariableBuffer> createOrResizeBuffer(const std::string& name, size_t size, Device dev) {
     auto it = varBuffers_.find(name);
     if (it != varBuffers_.end()) {  // already set
@@ -42,6 +151,31 @@ class Workspace final {
       return createBuffer(name, size, dev);
     }
   }
+
+ private:
+  struct Arena {
+    VariableBufferPtr buffer_;
+    SmallVec<std::pair<std::string, VariableBufferPtr>> views_;  // in the order of the arena
+  };
+
+  bool isPacked(const Arena& arena, const SmallVec<graph::VariableAttrPtr>& vars) const {
+    if (arena.views_.size() != vars.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < vars.size(); ++i) {
+      auto& view = arena.views_[i];
+      if (view.first != vars[i]->name_ || findBuffer(view.first) != view.second.get() ||
+          view.second->getSize() != vars[i]->bytes()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  Map<std::string, std::string> aliases_;
+  Map<std::string, Arena> arenas_;
+  Map<std::string, std::string> arenaOf_;  // the arena of each packed variable
+  size_t generation_{0};
 };
 }
 }
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+
+namespace nnet {
+namespace util {
+
+/**
+ * A reusable barrier for a fixed number of threads.
+ */
+class Barrier final {
+ public:
+  explicit Barrier(size_t numThreads) : numThreads_(numThreads) {}
+
+  void wait() {
+    std::unique_lock<std::mutex> l(mu_);
+    size_t generation = generation_;
+    if (++numWaiting_ == numThreads_) {
+      numWaiting_ = 0;
+      ++generation_;
+      cv_.notify_all();
+    } else {
+      cv_.wait(l, [this, generation] { return generation != generation_; });
+    }
+  }
+
+ private:
+  size_t numThreads_;
+  size_t numWaiting_{0};
+  size_t generation_{0};
+  std::mutex mu_;
+  std::condition_variable cv_;
+};
+}
+}
@@ -1,7 +1,9 @@
 #pragma once
 #include <Eigen/Dense>
+#include <Eigen/SparseCore>
 #include <type_traits>
 #include "graph/ComputationGraph.h"
+#include "misc/Half.h"
 namespace nnet {
 
 // some typedefs for eigen matrix, and inplace casting from tensor to eigen matrix.
@@ -11,12 +13,14 @@ namespace eigen {
 using Vector = Eigen::Matrix<float, Eigen::Dynamic, 1>;  // for vector, row major and col major are same.
 using IVector = Eigen::Matrix<int, Eigen::Dynamic, 1>;   // Int Vector.
 using Matrix = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+using SparseMatrix = Eigen::SparseMatrix<float, Eigen::RowMajor, int>;  // for kCSR_FLOAT32
 using Tensor = graph::Variable;
 
 // cast for matrix like
 template <typename T>
 inline Eigen::Map<std::enable_if_t<!T::IsVectorAtCompileTime, T>> cast(const Tensor& t) {
   CHECK_EQ(t.attr_->dims_.size(), 2);
+  CHECK(!graph::isHalf(t.attr_->type_)) << t.attr_->name_ << " is 16-bit, see castRows";
   return Eigen::Map<T>(reinterpret_cast<typename T::value_type*>(t.buffer_->get()), t.attr_->dims_[0],
                        t.attr_->dims_[1]);
 }
@@ -24,8 +28,58 @@ inline Eigen::Map<std::enable_if_t<!T::IsVectorAtCompileTime, T>> cast(const Ten
 // cast for vector like
 template <typename T>
 inline Eigen::Map<std::enable_if_t<T::IsVectorAtCompileTime, T>> cast(const Tensor& t) {
+  CHECK(!graph::isHalf(t.attr_->type_)) << t.attr_->name_ << " is 16-bit, see castRows";
   return Eigen::Map<T>(reinterpret_cast<typename T::value_type*>(t.buffer_->get()), details::product(t.attr_->dims_));
 };
 
+/**
+ * @brief castRows return the rows [begin, end) of a float matrix of any type. The rows of a kFLOAT32 variable are
+ * mapped in place. The rows of a kBF16 or kFP16 variable are converted to float into scratch, unless load is false,
+ * e.g. for an output, and are written back by storeRows.
+ */
+inline Eigen::Map<Matrix> castRows(const Tensor& t, size_t begin, size_t end, Matrix* scratch, bool load = true) {
+  CHECK_EQ(t.attr_->dims_.size(), 2);
+  size_t cols = t.attr_->dims_[1];
+  if (!graph::isHalf(t.attr_->type_)) {
+    return Eigen::Map<Matrix>(reinterpret_cast<float*>(t.buffer_->get()) + begin * cols, end - begin, cols);
+  }
+  scratch->resize(end - begin, cols);
+  if (load) {
+    util::toFloat(reinterpret_cast<uint16_t*>(t.buffer_->get()) + begin * cols, t.attr_->type_, scratch->data(),
+                  (end - begin) * cols);
+  }
+  return Eigen::Map<Matrix>(scratch->data(), end - begin, cols);
+}
+
+// Write rows given by castRows to a 16-bit variable, from row begin. Nothing to do for a kFLOAT32 variable.
+inline void storeRows(const Tensor& t, size_t begin, const Eigen::Map<Matrix>& rows) {
+  if (graph::isHalf(t.attr_->type_)) {
+    util::fromFloat(rows.data(), t.attr_->type_, reinterpret_cast<uint16_t*>(t.buffer_->get()) + begin * rows.cols(),
+                    rows.size());
+  }
+}
+
+// The arrays of a kCSR_FLOAT32 variable, to fill it.
+struct CSR {
+  int* rowOffsets_;  // rows + 1, the last one is the number of non-zeros
+  int* cols_;
+  float* values_;
+};
+
+inline CSR csr(const Tensor& t) {
+  CHECK_EQ(t.attr_->type_, graph::kCSR_FLOAT32);
+  auto rowOffsets = reinterpret_cast<int*>(t.buffer_->get());
+  auto cols = rowOffsets + t.attr_->dims_[0] + 1;
+  return {rowOffsets, cols, reinterpret_cast<float*>(cols + t.attr_->maxNnz_)};
+}
+
+// cast for kCSR_FLOAT32
+inline Eigen::Map<SparseMatrix> castCSR(const Tensor& t) {
+  CSR m = csr(t);
+  int nnz = m.rowOffsets_[t.attr_->dims_[0]];
+  CHECK_LE((size_t)nnz, t.attr_->maxNnz_);
+  return Eigen::Map<SparseMatrix>(t.attr_->dims_[0], t.attr_->dims_[1], nnz, m.rowOffsets_, m.cols_, m.values_);
+}
+
 }  // namespace eigen
 }  // namespace nnet
\ No newline at end of file
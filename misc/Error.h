@@ -4,6 +4,7 @@
 
 #ifndef NAIVENET_ERROR_H
 #define NAIVENET_ERROR_H
+#include <stdarg.h>
 #include <stdlib.h>
 #include <memory>
 #include <string>
@@ -42,7 +43,7 @@ class Error : public std::exception {
     }
   }
 
-  const char* what() const _NOEXCEPT { return msg(); }
+  const char* what() const noexcept { return msg(); }
 
   /**
    * @brief operator bool, return True if there is something error.
@@ -0,0 +1,241 @@
+#include "Gemm.h"
+#include <easylogging++.h>
+#include <algorithm>
+#include <cstring>
+#include "ThreadPool.h"
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+namespace nnet {
+namespace util {
+
+// The blocks of k, of the rows of C and of the columns of C. A packed block of A (kMC x kKC) fits in L2, a sliver of
+// packed B (kKC x NR) in L1. kMC is a multiple of every MR.
+constexpr size_t kKC = 256;
+constexpr size_t kMC = 144;
+constexpr size_t kNC = 2048;
+
+/**
+ * A micro-kernel computes the MR x NR tile of the product of kc columns of a packed sliver of A (MR floats for each
+ * k) and kc rows of a packed sliver of B (NR floats for each k). It writes acc, or c + acc when add, then adds bias
+ * when it is not nullptr.
+ */
+using MicroKernelFN = void (*)(size_t kc, const float* a, const float* b, float* c, size_t ldc, bool add,
+                               const float* bias);
+
+struct MicroKernel {
+  size_t mr_;
+  size_t nr_;
+  MicroKernelFN fn_;
+};
+
+template <size_t MR, size_t NR>
+static void microKernelGeneric(size_t kc, const float* a, const float* b, float* c, size_t ldc, bool add,
+                               const float* bias) {
+  float acc[MR][NR] = {{0}};
+  for (size_t p = 0; p < kc; ++p, a += MR, b += NR) {
+    for (size_t i = 0; i < MR; ++i) {
+      for (size_t j = 0; j < NR; ++j) {
+        acc[i][j] += a[i] * b[j];
+      }
+    }
+  }
+  for (size_t i = 0; i < MR; ++i) {
+    for (size_t j = 0; j < NR; ++j) {
+      float v = acc[i][j];
+      if (add) v += c[i * ldc + j];
+      if (bias != nullptr) v += bias[j];
+      c[i * ldc + j] = v;
+    }
+  }
+}
+
+#ifdef __x86_64__
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+static void microKernelAvx2(size_t kc, const float* a, const float* b, float* c, size_t ldc, bool add,
+                            const float* bias) {
+  constexpr size_t MR = 6;
+  __m256 acc[MR][2];
+#pragma GCC unroll 6
+  for (size_t i = 0; i < MR; ++i) {
+    acc[i][0] = acc[i][1] = _mm256_setzero_ps();
+  }
+  for (size_t p = 0; p < kc; ++p, a += MR, b += 16) {
+    __m256 b0 = _mm256_loadu_ps(b), b1 = _mm256_loadu_ps(b + 8);
+#pragma GCC unroll 6
+    for (size_t i = 0; i < MR; ++i) {
+      __m256 ai = _mm256_broadcast_ss(a + i);
+      acc[i][0] = _mm256_fmadd_ps(ai, b0, acc[i][0]);
+      acc[i][1] = _mm256_fmadd_ps(ai, b1, acc[i][1]);
+    }
+  }
+#pragma GCC unroll 6
+  for (size_t i = 0; i < MR; ++i) {
+#pragma GCC unroll 2
+    for (size_t j = 0; j < 2; ++j) {
+      __m256 v = acc[i][j];
+      if (add) v = _mm256_add_ps(v, _mm256_loadu_ps(c + i * ldc + 8 * j));
+      if (bias != nullptr) v = _mm256_add_ps(v, _mm256_loadu_ps(bias + 8 * j));
+      _mm256_storeu_ps(c + i * ldc + 8 * j, v);
+    }
+  }
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+static void microKernelAvx512(size_t kc, const float* a, const float* b, float* c, size_t ldc, bool add,
+                              const float* bias) {
+  constexpr size_t MR = 12;
+  __m512 acc[MR][2];
+#pragma GCC unroll 12
+  for (size_t i = 0; i < MR; ++i) {
+    acc[i][0] = acc[i][1] = _mm512_setzero_ps();
+  }
+  for (size_t p = 0; p < kc; ++p, a += MR, b += 32) {
+    __m512 b0 = _mm512_loadu_ps(b), b1 = _mm512_loadu_ps(b + 16);
+#pragma GCC unroll 12
+    for (size_t i = 0; i < MR; ++i) {
+      __m512 ai = _mm512_set1_ps(a[i]);
+      acc[i][0] = _mm512_fmadd_ps(ai, b0, acc[i][0]);
+      acc[i][1] = _mm512_fmadd_ps(ai, b1, acc[i][1]);
+    }
+  }
+#pragma GCC unroll 12
+  for (size_t i = 0; i < MR; ++i) {
+#pragma GCC unroll 2
+    for (size_t j = 0; j < 2; ++j) {
+      __m512 v = acc[i][j];
+      if (add) v = _mm512_add_ps(v, _mm512_loadu_ps(c + i * ldc + 16 * j));
+      if (bias != nullptr) v = _mm512_add_ps(v, _mm512_loadu_ps(bias + 16 * j));
+      _mm512_storeu_ps(c + i * ldc + 16 * j, v);
+    }
+  }
+}
+#pragma GCC pop_options
+#endif
+
+static MicroKernel microKernel(SimdIsa isa) {
+  CHECK(hasSimdIsa(isa)) << "The CPU cannot run " << simdIsaName(isa);
+  switch (isa) {
+#ifdef __x86_64__
+    case kISA_AVX512:
+      return {12, 32, microKernelAvx512};
+    case kISA_AVX2:
+      return {6, 16, microKernelAvx2};
+#endif
+    default:
+      return {4, 8, microKernelGeneric<4, 8>};
+  }
+}
+
+// Pack the rows [i, i + mr) and the columns [p, p + kc) of op(A) as a sliver of MR floats for each k, zero padded.
+static void packA(bool transA, const float* A, size_t lda, size_t i, size_t mr, size_t p, size_t kc, size_t MR,
+                  float* dst) {
+  for (size_t l = 0; l < kc; ++l, dst += MR) {
+    for (size_t r = 0; r < MR; ++r) {
+      dst[r] = r >= mr ? 0 : transA ? A[(p + l) * lda + i + r] : A[(i + r) * lda + p + l];
+    }
+  }
+}
+
+// Pack the rows [p, p + kc) and the columns [j, j + nr) of op(B) as a sliver of NR floats for each k, zero padded.
+static void packB(bool transB, const float* B, size_t ldb, size_t p, size_t kc, size_t j, size_t nr, size_t NR,
+                  float* dst) {
+  for (size_t l = 0; l < kc; ++l, dst += NR) {
+    if (!transB) {
+      std::memcpy(dst, B + (p + l) * ldb + j, nr * sizeof(float));
+    } else {
+      for (size_t c = 0; c < nr; ++c) dst[c] = B[(j + c) * ldb + p + l];
+    }
+    std::fill(dst + nr, dst + NR, 0.0f);
+  }
+}
+
+void gemm(bool transA, bool transB, size_t m, size_t n, size_t k, const float* A, size_t lda, const float* B,
+          size_t ldb, float* C, size_t ldc, const GemmEpilogue& epilogue, SimdIsa isa) {
+  if (m == 0 || n == 0) return;
+  auto kernel = microKernel(isa);
+  const size_t MR = kernel.mr_, NR = kernel.nr_;
+  if (k == 0) {
+    for (size_t i = 0; i < m; ++i) {
+      float* c = C + i * ldc;
+      for (size_t j = 0; j < n; ++j) {
+        float v = epilogue.accumulate_ ? c[j] : 0.0f;
+        c[j] = epilogue.bias_ != nullptr ? v + epilogue.bias_[j] : v;
+      }
+      if (epilogue.tanh_) vecTanh(c, c, n);
+    }
+    return;
+  }
+
+  ThreadPool* pool = ThreadPool::current();
+  size_t numThreads = pool == nullptr ? 1 : pool->size() + 1;
+  static thread_local Vec<float> gPackedB;
+  for (size_t jc = 0; jc < n; jc += kNC) {
+    size_t nc = std::min(kNC, n - jc);
+    size_t numSlivers = (nc + NR - 1) / NR;
+    for (size_t pc = 0; pc < k; pc += kKC) {
+      size_t kc = std::min(kKC, k - pc);
+      bool add = epilogue.accumulate_ || pc != 0;
+      bool last = pc + kc == k;
+      gPackedB.resize(numSlivers * NR * kc);
+      float* packedB = gPackedB.data();  // the buffer of this thread, shared with the tasks
+      parallelFor(numSlivers, 8, [&](size_t begin, size_t end) {
+        for (size_t s = begin; s < end; ++s) {
+          packB(transB, B, ldb, pc, kc, jc + s * NR, std::min(NR, nc - s * NR), NR, packedB + s * NR * kc);
+        }
+      });
+
+      // A task computes a block of kMC rows and a group of slivers of B. The columns are split as well when there
+      // are fewer blocks of rows than threads, e.g. for a small batch.
+      size_t numBlocks = (m + kMC - 1) / kMC;
+      size_t numGroups = std::min(numSlivers, (numThreads + numBlocks - 1) / numBlocks);
+      size_t sliversPerGroup = (numSlivers + numGroups - 1) / numGroups;
+      numGroups = (numSlivers + sliversPerGroup - 1) / sliversPerGroup;
+      parallelFor(numBlocks * numGroups, 1, [&](size_t begin, size_t end) {
+        static thread_local Vec<float> gPackedA;
+        for (size_t t = begin; t < end; ++t) {
+          size_t ic = t / numGroups * kMC, mc = std::min(kMC, m - ic);
+          size_t numRowSlivers = (mc + MR - 1) / MR;
+          gPackedA.resize(numRowSlivers * MR * kc);
+          for (size_t r = 0; r < numRowSlivers; ++r) {
+            packA(transA, A, lda, ic + r * MR, std::min(MR, mc - r * MR), pc, kc, MR, gPackedA.data() + r * MR * kc);
+          }
+          size_t firstSliver = t % numGroups * sliversPerGroup;
+          for (size_t s = firstSliver; s < std::min(numSlivers, firstSliver + sliversPerGroup); ++s) {
+            size_t j = jc + s * NR, nr = std::min(NR, nc - s * NR);
+            const float* bias = last && epilogue.bias_ != nullptr ? epilogue.bias_ + j : nullptr;
+            for (size_t r = 0; r < numRowSlivers; ++r) {
+              size_t i = ic + r * MR, mr = std::min(MR, mc - r * MR);
+              float* c = C + i * ldc + j;
+              const float* a = gPackedA.data() + r * MR * kc;
+              const float* b = packedB + s * NR * kc;
+              if (mr == MR && nr == NR) {
+                kernel.fn_(kc, a, b, c, ldc, add, bias);
+              } else {  // an edge tile, computed whole in a scratch tile, in the same order
+                float tile[12 * 32];
+                kernel.fn_(kc, a, b, tile, NR, false, nullptr);
+                for (size_t x = 0; x < mr; ++x) {
+                  for (size_t y = 0; y < nr; ++y) {
+                    float v = tile[x * NR + y];
+                    if (add) v += c[x * ldc + y];
+                    if (bias != nullptr) v += bias[y];
+                    c[x * ldc + y] = v;
+                  }
+                }
+              }
+              if (last && epilogue.tanh_) {
+                for (size_t x = 0; x < mr; ++x) vecTanh(c + x * ldc, c + x * ldc, nr);
+              }
+            }
+          }
+        }
+      });
+    }
+  }
+}
+}
+}
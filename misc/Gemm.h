@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include "VecMath.h"
+
+namespace nnet {
+namespace util {
+
+/**
+ * What gemm does with the product of a tile of C, after its last block of k and while the tile is still in cache.
+ */
+struct GemmEpilogue {
+  bool accumulate_{false};      // C += op(A) op(B), otherwise C = op(A) op(B)
+  const float* bias_{nullptr};  // n floats added to every row of C, or nullptr
+  bool tanh_{false};            // C = tanh(C) after the bias, i.e. the sigmoid op
+};
+
+/**
+ * @brief gemm compute C = op(A) op(B) of row-major float matrices, then apply the epilogue. op(A) is m x k, A is m x k
+ * or, when transA, k x m. op(B) is k x n, B is k x n or, when transB, n x k. lda, ldb and ldc are the row strides, so
+ * the gradients of fc are computed without transposing a matrix.
+ *
+ * The matrices are packed in blocks sized for the L1 and L2 caches, and each MR x NR tile of C is accumulated in
+ * registers by a micro-kernel of the instruction set: 12 x 32 for AVX-512, 6 x 16 for AVX2 and 4 x 8 in portable C++
+ * otherwise. The tiles of C are split over ThreadPool::current(), every element is summed in the same order whatever
+ * the number of threads is.
+ */
+void gemm(bool transA, bool transB, size_t m, size_t n, size_t k, const float* A, size_t lda, const float* B,
+          size_t ldb, float* C, size_t ldc, const GemmEpilogue& epilogue = GemmEpilogue(),
+          SimdIsa isa = bestSimdIsa());
+}
+}
@@ -0,0 +1,88 @@
+#include "Half.h"
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+namespace nnet {
+namespace util {
+
+#ifdef __x86_64__
+__attribute__((target("avx2,f16c"))) static void toFloatAVX2(const uint16_t* src, graph::VariableType type,
+                                                               float* dst, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    auto h = _mm_loadu_si128((const __m128i*)(src + i));
+    __m256 f;
+    if (type == graph::kBF16) {
+      f = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16));
+    } else {
+      f = _mm256_cvtph_ps(h);
+    }
+    _mm256_storeu_ps(dst + i, f);
+  }
+  for (; i < n; ++i) {
+    dst[i] = type == graph::kBF16 ? bf16ToFloat(src[i]) : fp16ToFloat(src[i]);
+  }
+}
+
+__attribute__((target("avx2,f16c"))) static void fromFloatAVX2(const float* src, graph::VariableType type,
+                                                                 uint16_t* dst, size_t n) {
+  size_t i = 0;
+  if (type == graph::kBF16) {
+    auto one = _mm256_set1_epi32(1);
+    auto bias = _mm256_set1_epi32(0x7fff);
+    auto absMask = _mm256_set1_epi32(0x7fffffff);
+    auto inf = _mm256_set1_epi32(0x7f800000);
+    for (; i + 8 <= n; i += 8) {
+      auto u = _mm256_loadu_si256((const __m256i*)(src + i));
+      // NaNs take the scalar path, so the rounding below never turns one into infinity.
+      if (!_mm256_testz_si256(_mm256_cmpgt_epi32(_mm256_and_si256(u, absMask), inf), _mm256_set1_epi32(-1))) break;
+      auto lsb = _mm256_and_si256(_mm256_srli_epi32(u, 16), one);
+      auto r = _mm256_srli_epi32(_mm256_add_epi32(u, _mm256_add_epi32(bias, lsb)), 16);
+      // pack the 32-bit lanes to 16 bits, packus works per 128-bit half so fix the order of the 64-bit quarters.
+      auto packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(r, r), 0xd8);
+      _mm_storeu_si128((__m128i*)(dst + i), _mm256_castsi256_si128(packed));
+    }
+  } else {
+    for (; i + 8 <= n; i += 8) {
+      _mm_storeu_si128((__m128i*)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+    }
+  }
+  for (; i < n; ++i) {
+    dst[i] = type == graph::kBF16 ? floatToBF16(src[i]) : floatToFP16(src[i]);
+  }
+}
+
+static bool hasAVX2F16C() {
+  static bool has = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+  return has;
+}
+#endif
+
+void toFloat(const uint16_t* src, graph::VariableType type, float* dst, size_t n) {
+  CHECK(graph::isHalf(type));
+#ifdef __x86_64__
+  if (hasAVX2F16C()) {
+    toFloatAVX2(src, type, dst, n);
+    return;
+  }
+#endif
+  for (size_t i = 0; i < n; ++i) {
+    dst[i] = type == graph::kBF16 ? bf16ToFloat(src[i]) : fp16ToFloat(src[i]);
+  }
+}
+
+void fromFloat(const float* src, graph::VariableType type, uint16_t* dst, size_t n) {
+  CHECK(graph::isHalf(type));
+#ifdef __x86_64__
+  if (hasAVX2F16C()) {
+    fromFloatAVX2(src, type, dst, n);
+    return;
+  }
+#endif
+  for (size_t i = 0; i < n; ++i) {
+    dst[i] = type == graph::kBF16 ? floatToBF16(src[i]) : floatToFP16(src[i]);
+  }
+}
+}
+}
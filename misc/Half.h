@@ -0,0 +1,66 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include "graph/ComputationGraph.h"
+
+namespace nnet {
+namespace util {
+
+// Conversions of the 16-bit float types, see graph::kBF16 and graph::kFP16. Rounding is to nearest even.
+
+inline float bf16ToFloat(uint16_t h) {
+  uint32_t u = (uint32_t)h << 16;
+  float f;
+  std::memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+inline uint16_t floatToBF16(float f) {
+  uint32_t u;
+  std::memcpy(&u, &f, sizeof(u));
+  if ((u & 0x7fffffff) > 0x7f800000) {
+    return (u >> 16) | 0x40;  // keep NaN a quiet NaN, rounding could make it infinity
+  }
+  u += 0x7fff + ((u >> 16) & 1);
+  return u >> 16;
+}
+
+inline float fp16ToFloat(uint16_t h) {
+  uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  uint32_t exp = (h >> 10) & 0x1f;
+  uint32_t mant = h & 0x3ff;
+  if (exp == 0) {  // zero or subnormal, mant * 2^-24
+    float f = mant * (1.0f / 16777216.0f);
+    return sign != 0 ? -f : f;
+  }
+  uint32_t u = sign | (exp == 31 ? 0x7f800000 | (mant << 13) : ((exp + 112) << 23) | (mant << 13));
+  float f;
+  std::memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+inline uint16_t floatToFP16(float f) {
+  uint32_t u;
+  std::memcpy(&u, &f, sizeof(u));
+  uint16_t sign = (u >> 16) & 0x8000;
+  uint32_t absBits = u & 0x7fffffff;
+  if (absBits > 0x7f800000) return sign | 0x7e00;    // NaN
+  if (absBits >= 0x477ff000) return sign | 0x7c00;  // rounds to infinity from 65520 on
+  if (absBits < 0x38800000) {                        // subnormal, below 2^-14
+    float a;
+    std::memcpy(&a, &absBits, sizeof(a));
+    return sign | (uint16_t)std::nearbyint(a * 16777216.0f);
+  }
+  absBits += 0xc8000fff + ((absBits >> 13) & 1);  // rebias the exponent from 127 to 15, and round
+  return sign | (absBits >> 13);
+}
+
+/**
+ * Convert n values between float and a 16-bit type (kBF16 or kFP16). They are vectorized with AVX2 and F16C when the
+ * CPU has them, whatever the build flags.
+ */
+void toFloat(const uint16_t* src, graph::VariableType type, float* dst, size_t n);
+void fromFloat(const float* src, graph::VariableType type, uint16_t* dst, size_t n);
+}
+}
@@ -0,0 +1,226 @@
+#include "Int8.h"
+#include <easylogging++.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+namespace nnet {
+namespace util {
+
+static inline int quantize(float x, float invScale) {
+  return (int)std::nearbyint(std::min(127.0f, std::max(-127.0f, x * invScale)));
+}
+
+// The reference kernel, and the order of the packed weights.
+static void gemmScalar(const uint8_t* x, size_t m, size_t kPad, const int8_t* packed, size_t nPad, int32_t* out) {
+  size_t groups = kPad / kInt8GroupRows;
+  for (size_t i = 0; i < m; ++i) {
+    for (size_t j = 0; j < nPad; ++j) {
+      const int8_t* w = packed + (j / kInt8PanelCols) * groups * 64 + (j % kInt8PanelCols) * kInt8GroupRows;
+      int32_t acc = 0;
+      for (size_t k = 0; k < kPad; ++k) {
+        acc += (int32_t)x[i * kPad + k] * w[(k / kInt8GroupRows) * 64 + k % kInt8GroupRows];
+      }
+      out[i * nPad + j] = acc;
+    }
+  }
+}
+
+#ifdef __x86_64__
+// R rows of x at once, each 64-byte group of a panel is loaded once for the R rows.
+template <int R>
+__attribute__((target("avx512f,avx512bw,avx512vnni"))) static inline void gemmRowsVNNI(const uint8_t* x, size_t kPad,
+                                                                                      const int8_t* packed,
+                                                                                      size_t nPad, int32_t* out) {
+  size_t groups = kPad / kInt8GroupRows;
+  for (size_t p = 0; p < nPad / kInt8PanelCols; ++p) {
+    const int8_t* w = packed + p * groups * 64;
+    __m512i acc[R];
+    for (int r = 0; r < R; ++r) acc[r] = _mm512_setzero_si512();
+    for (size_t g = 0; g < groups; ++g) {
+      auto b = _mm512_loadu_si512(w + g * 64);
+      for (int r = 0; r < R; ++r) {
+        int32_t a;
+        std::memcpy(&a, x + r * kPad + g * kInt8GroupRows, sizeof(a));
+        acc[r] = _mm512_dpbusd_epi32(acc[r], _mm512_set1_epi32(a), b);
+      }
+    }
+    for (int r = 0; r < R; ++r) _mm512_storeu_si512(out + r * nPad + p * kInt8PanelCols, acc[r]);
+  }
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vnni"))) static void gemmVNNI(const uint8_t* x, size_t m, size_t kPad,
+                                                                            const int8_t* packed, size_t nPad,
+                                                                            int32_t* out) {
+  size_t i = 0;
+  for (; i + 4 <= m; i += 4) gemmRowsVNNI<4>(x + i * kPad, kPad, packed, nPad, out + i * nPad);
+  for (; i < m; ++i) gemmRowsVNNI<1>(x + i * kPad, kPad, packed, nPad, out + i * nPad);
+}
+
+/**
+ * Without VNNI, 8 columns at a time: the int8 weights and uint8 activations are widened to 16 bits and multiplied by
+ * madd, which adds pairs of products into int32. maddubs would multiply the bytes directly, but it saturates the sum
+ * of a pair at int16, e.g. 255 * 127 * 2, and would differ from the VNNI kernel.
+ */
+template <int R>
+__attribute__((target("avx2"))) static inline void gemmRowsAVX2(const uint8_t* x, size_t kPad, const int8_t* packed,
+                                                                size_t nPad, int32_t* out) {
+  size_t groups = kPad / kInt8GroupRows;
+  for (size_t p = 0; p < nPad / kInt8PanelCols; ++p) {
+    for (size_t h = 0; h < 2; ++h) {
+      const int8_t* w = packed + p * groups * 64 + h * 32;
+      // lo and hi hold the sums of the first and last two products of a group, for the columns 0-3 and 4-7.
+      __m256i lo[R], hi[R];
+      for (int r = 0; r < R; ++r) lo[r] = hi[r] = _mm256_setzero_si256();
+      for (size_t g = 0; g < groups; ++g) {
+        auto b = _mm256_loadu_si256((const __m256i*)(w + g * 64));
+        auto b0 = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(b));
+        auto b1 = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(b, 1));
+        for (int r = 0; r < R; ++r) {
+          int32_t a;
+          std::memcpy(&a, x + r * kPad + g * kInt8GroupRows, sizeof(a));
+          auto a16 = _mm256_cvtepu8_epi16(_mm_set1_epi32(a));
+          lo[r] = _mm256_add_epi32(lo[r], _mm256_madd_epi16(b0, a16));
+          hi[r] = _mm256_add_epi32(hi[r], _mm256_madd_epi16(b1, a16));
+        }
+      }
+      for (int r = 0; r < R; ++r) {
+        // hadd sums the pairs per 128-bit half, to columns 0 1 4 5 | 2 3 6 7, the permute restores the order.
+        auto sums = _mm256_permute4x64_epi64(_mm256_hadd_epi32(lo[r], hi[r]), 0xd8);
+        _mm256_storeu_si256((__m256i*)(out + r * nPad + p * kInt8PanelCols + h * 8), sums);
+      }
+    }
+  }
+}
+
+__attribute__((target("avx2"))) static void gemmAVX2(const uint8_t* x, size_t m, size_t kPad, const int8_t* packed,
+                                                     size_t nPad, int32_t* out) {
+  size_t i = 0;
+  for (; i + 4 <= m; i += 4) gemmRowsAVX2<4>(x + i * kPad, kPad, packed, nPad, out + i * nPad);
+  for (; i < m; ++i) gemmRowsAVX2<1>(x + i * kPad, kPad, packed, nPad, out + i * nPad);
+}
+
+// 8 values at a time, rounded to nearest even like std::nearbyint, and packed with saturation to bytes.
+__attribute__((target("avx2"))) static size_t quantizeAVX2(const float* x, float scale, bool isUnsigned,
+                                                           uint8_t* out, size_t n) {
+  auto inv = _mm256_set1_ps(1.0f / scale);
+  auto lower = _mm256_set1_ps(-127.0f);
+  auto upper = _mm256_set1_ps(127.0f);
+  auto zeroPoint = _mm_set1_epi8(isUnsigned ? (char)0x80 : 0);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    auto v = _mm256_min_ps(upper, _mm256_max_ps(lower, _mm256_mul_ps(_mm256_loadu_ps(x + i), inv)));
+    auto q = _mm256_cvtps_epi32(v);
+    auto q16 = _mm_packs_epi32(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1));
+    auto q8 = _mm_xor_si128(_mm_packs_epi16(q16, q16), zeroPoint);  // int8 + 128 is int8 xor 0x80
+    _mm_storel_epi64((__m128i*)(out + i), q8);
+  }
+  return i;
+}
+#endif
+
+bool hasInt8Kernel(Int8Kernel kernel) {
+  switch (kernel) {
+    case kINT8_AUTO:
+    case kINT8_SCALAR:
+      return true;
+#ifdef __x86_64__
+    case kINT8_AVX2: {
+      static bool has = __builtin_cpu_supports("avx2");
+      return has;
+    }
+    case kINT8_AVX512_VNNI: {
+      static bool has = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+                        __builtin_cpu_supports("avx512vnni");
+      return has;
+    }
+#endif
+    default:
+      return false;
+  }
+}
+
+Int8Kernel bestInt8Kernel() {
+  static Int8Kernel best = hasInt8Kernel(kINT8_AVX512_VNNI) ? kINT8_AVX512_VNNI
+                                                            : hasInt8Kernel(kINT8_AVX2) ? kINT8_AVX2 : kINT8_SCALAR;
+  return best;
+}
+
+const char* int8KernelName(Int8Kernel kernel) {
+  switch (kernel) {
+    case kINT8_AUTO:
+      return int8KernelName(bestInt8Kernel());
+    case kINT8_SCALAR:
+      return "scalar";
+    case kINT8_AVX2:
+      return "avx2";
+    case kINT8_AVX512_VNNI:
+      return "avx512_vnni";
+  }
+  return "unknown";
+}
+
+void packInt8Weights(const float* w, size_t k, size_t n, int8_t* packed, float* scales, int32_t* sums) {
+  size_t kPad = roundUp(k, kInt8GroupRows);
+  size_t groups = kPad / kInt8GroupRows;
+  std::memset(packed, 0, kPad * roundUp(n, kInt8PanelCols));
+  for (size_t j = 0; j < n; ++j) {
+    float maxAbs = 0;
+    for (size_t i = 0; i < k; ++i) {
+      maxAbs = std::max(maxAbs, std::abs(w[i * n + j]));
+    }
+    scales[j] = maxAbs > 0 ? maxAbs / 127 : 1.0f;
+    int8_t* panel = packed + (j / kInt8PanelCols) * groups * 64 + (j % kInt8PanelCols) * kInt8GroupRows;
+    int32_t sum = 0;
+    for (size_t i = 0; i < k; ++i) {
+      int q = quantize(w[i * n + j], 1.0f / scales[j]);
+      panel[(i / kInt8GroupRows) * 64 + i % kInt8GroupRows] = (int8_t)q;
+      sum += q;
+    }
+    sums[j] = sum;
+  }
+}
+
+static void quantizeBytes(const float* x, float scale, bool isUnsigned, uint8_t* out, size_t n) {
+  size_t i = 0;
+#ifdef __x86_64__
+  if (hasInt8Kernel(kINT8_AVX2)) {
+    i = quantizeAVX2(x, scale, isUnsigned, out, n);
+  }
+#endif
+  float inv = 1.0f / scale;
+  for (; i < n; ++i) {
+    out[i] = (uint8_t)(quantize(x[i], inv) + (isUnsigned ? 128 : 0));
+  }
+}
+
+void quantizeU8(const float* x, float scale, uint8_t* out, size_t n) { quantizeBytes(x, scale, true, out, n); }
+
+void quantizeS8(const float* x, float scale, int8_t* out, size_t n) {
+  quantizeBytes(x, scale, false, (uint8_t*)out, n);
+}
+
+void gemmU8S8(const uint8_t* x, size_t m, size_t kPad, const int8_t* packed, size_t nPad, int32_t* out,
+              Int8Kernel kernel) {
+  CHECK_EQ(kPad % kInt8GroupRows, 0UL);
+  CHECK_EQ(nPad % kInt8PanelCols, 0UL);
+  kernel = kernel == kINT8_AUTO ? bestInt8Kernel() : kernel;
+  CHECK(hasInt8Kernel(kernel)) << "The CPU cannot run the int8 kernel " << int8KernelName(kernel);
+  switch (kernel) {
+#ifdef __x86_64__
+    case kINT8_AVX512_VNNI:
+      gemmVNNI(x, m, kPad, packed, nPad, out);
+      break;
+    case kINT8_AVX2:
+      gemmAVX2(x, m, kPad, packed, nPad, out);
+      break;
+#endif
+    default:
+      gemmScalar(x, m, kPad, packed, nPad, out);
+  }
+}
+}
+}
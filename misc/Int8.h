@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace nnet {
+namespace util {
+
+/**
+ * The int8 GEMM of fc_int8. Activations are uint8 with a zero point of 128, i.e. their int8 value plus 128, so they
+ * are the unsigned operand of the VNNI dot product. Weights are int8, packed in panels of 16 columns: for each group
+ * of 4 rows, the 4 values of each column of the panel, 64 bytes which are an operand of the dot product. Products are
+ * accumulated in int32, every kernel computes exactly the same result.
+ */
+enum Int8Kernel { kINT8_AUTO, kINT8_SCALAR, kINT8_AVX2, kINT8_AVX512_VNNI };
+
+constexpr size_t kInt8PanelCols = 16;
+constexpr size_t kInt8GroupRows = 4;
+
+inline size_t roundUp(size_t n, size_t multiple) { return (n + multiple - 1) / multiple * multiple; }
+
+// Whether the CPU runs a kernel, whatever the build flags, and the fastest one it runs.
+bool hasInt8Kernel(Int8Kernel kernel);
+Int8Kernel bestInt8Kernel();
+const char* int8KernelName(Int8Kernel kernel);
+
+/**
+ * @brief packInt8Weights quantize w (k x n, row major) per column, i.e. per output channel: scales[j] is
+ * max |w(:, j)| / 127, and sums[j] the sum of the int8 column, to remove the zero point of the activations. packed
+ * holds roundUp(k, 4) x roundUp(n, 16) bytes, the padding is zero.
+ */
+void packInt8Weights(const float* w, size_t k, size_t n, int8_t* packed, float* scales, int32_t* sums);
+
+// Quantize n floats by scale, the value of a step: round(x / scale) clamped to [-127, 127], plus 128 for uint8.
+void quantizeU8(const float* x, float scale, uint8_t* out, size_t n);
+void quantizeS8(const float* x, float scale, int8_t* out, size_t n);
+
+/**
+ * @brief gemmU8S8 out = x * packed, out is m x nPad int32 and x is m x kPad uint8, both row major. kPad and nPad are
+ * the padded dims of packInt8Weights, the padding of x is multiplied by zero weights.
+ */
+void gemmU8S8(const uint8_t* x, size_t m, size_t kPad, const int8_t* packed, size_t nPad, int32_t* out,
+              Int8Kernel kernel = kINT8_AUTO);
+}
+}
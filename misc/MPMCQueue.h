@@ -0,0 +1,91 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace nnet {
+namespace util {
+
+/**
+ * A bounded multi-producer multi-consumer queue without locks (Dmitry Vyukov's design). Each cell has a sequence
+ * number telling whether it is ready to be written or read at a position, so producers and consumers only contend on
+ * their own position counter. The capacity is rounded up to a power of two.
+ *
+ * tryPush and tryPop never block, they return false when the queue is full or empty.
+ */
+template <typename T>
+class MPMCQueue final {
+ public:
+  explicit MPMCQueue(size_t capacity) {
+    size_t n = 2;
+    while (n < capacity) n *= 2;
+    mask_ = n - 1;
+    cells_.reset(new Cell[n]);
+    for (size_t i = 0; i < n; ++i) {
+      cells_[i].seq_.store(i, std::memory_order_relaxed);
+    }
+  }
+  MPMCQueue(const MPMCQueue&) = delete;
+
+  size_t capacity() const { return mask_ + 1; }
+
+  bool tryPush(T value) {
+    size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->seq_.load(std::memory_order_acquire);
+      auto diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        return false;  // full
+      } else {
+        pos = enqueuePos_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value_ = std::move(value);
+    cell->seq_.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool tryPop(T* value) {
+    size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->seq_.load(std::memory_order_acquire);
+      auto diff = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (diff == 0) {
+        if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        return false;  // empty
+      } else {
+        pos = dequeuePos_.load(std::memory_order_relaxed);
+      }
+    }
+    *value = std::move(cell->value_);
+    cell->seq_.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Whether a tryPop could succeed now. Only a hint when other threads pop concurrently.
+  bool empty() const {
+    size_t pos = dequeuePos_.load(std::memory_order_acquire);
+    return cells_[pos & mask_].seq_.load(std::memory_order_acquire) != pos + 1;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> seq_;
+    T value_;
+  };
+
+  // the positions are on their own cache lines, producers and consumers do not share them.
+  alignas(64) std::atomic<size_t> enqueuePos_{0};
+  alignas(64) std::atomic<size_t> dequeuePos_{0};
+  std::unique_ptr<Cell[]> cells_;
+  size_t mask_;
+};
+}
+}
@@ -0,0 +1,194 @@
+#pragma once
+#include <easylogging++.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "Typedef.h"
+
+namespace nnet {
+namespace util {
+
+/**
+ * A work-stealing thread pool. Each worker owns a task deque. A task scheduled from a worker is pushed to the back of
+ * that worker's deque and popped LIFO, so successors of an op stay on the core that produced their inputs. Idle
+ * workers steal from the front of the other deques.
+ *
+ * The pool a kernel should use for intra-op parallelism is ThreadPool::current(). It is the pool of the worker thread,
+ * or the pool installed by a ThreadPool::Scope (e.g. by the engine around running kernels).
+ */
+class ThreadPool final {
+ public:
+  using Task = std::function<void()>;
+
+  explicit ThreadPool(size_t numThreads) : queues_(numThreads) {
+    CHECK_GT(numThreads, 0UL);
+    for (auto& q : queues_) {
+      q.reset(new Queue());
+    }
+    for (size_t i = 0; i < numThreads; ++i) {
+      threads_.emplace_back([this, i] { this->loop(i); });
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> g(mu_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : threads_) {
+      t.join();
+    }
+  }
+
+  class Scope final {
+   public:
+    explicit Scope(ThreadPool* pool) : prev_(current()) { current() = pool; }
+    ~Scope() { current() = prev_; }
+
+   private:
+    ThreadPool* prev_;
+  };
+
+  static ThreadPool*& current() {
+    static thread_local ThreadPool* pool = nullptr;
+    return pool;
+  }
+
+  size_t size() const { return threads_.size(); }
+
+  /**
+   * @brief parallelRun invoke fn(0) ... fn(n - 1) in parallel and return when all of them are done. The calling
+   * thread runs items as well, and only waits for items another thread already started, so it is safe to call it
+   * from a task of the same pool.
+   */
+  void parallelRun(size_t n, const std::function<void(size_t)>& fn) {
+    struct State {
+      std::atomic<size_t> next_{0};
+      std::atomic<size_t> done_{0};
+      size_t n_;
+      const std::function<void(size_t)>* fn_;
+      std::mutex mu_;
+      std::condition_variable cv_;
+
+      void work() {
+        for (size_t i = next_++; i < n_; i = next_++) {
+          (*fn_)(i);
+          if (++done_ == n_) {
+            std::lock_guard<std::mutex> g(mu_);
+            cv_.notify_all();
+          }
+        }
+      }
+    };
+    auto state = std::make_shared<State>();
+    state->n_ = n;
+    state->fn_ = &fn;
+    for (size_t i = 1; i < std::min(n, size() + 1); ++i) {
+      schedule([state] { state->work(); });
+    }
+    state->work();
+    std::unique_lock<std::mutex> l(state->mu_);
+    state->cv_.wait(l, [&state] { return state->done_ == state->n_; });
+  }
+
+  void schedule(Task task) {
+    size_t qid = workerId() != -1UL && current() == this ? workerId() : (next_++ % queues_.size());
+    {
+      std::lock_guard<std::mutex> g(queues_[qid]->mu_);
+      queues_[qid]->tasks_.push_back(std::move(task));
+    }
+    {
+      std::lock_guard<std::mutex> g(mu_);
+      ++pending_;
+    }
+    cv_.notify_one();
+  }
+
+ private:
+  struct Queue {
+    std::mutex mu_;
+    std::deque<Task> tasks_;
+  };
+
+  static size_t& workerId() {
+    static thread_local size_t id = -1UL;
+    return id;
+  }
+
+  bool pop(size_t id, Task* task) {
+    {
+      auto& q = *queues_[id];
+      std::lock_guard<std::mutex> g(q.mu_);
+      if (!q.tasks_.empty()) {
+        *task = std::move(q.tasks_.back());
+        q.tasks_.pop_back();
+        return true;
+      }
+    }
+    for (size_t i = 1; i < queues_.size(); ++i) {
+      auto& q = *queues_[(id + i) % queues_.size()];
+      std::lock_guard<std::mutex> g(q.mu_);
+      if (!q.tasks_.empty()) {
+        *task = std::move(q.tasks_.front());
+        q.tasks_.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void loop(size_t id) {
+    workerId() = id;
+    current() = this;
+    Task task;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> l(mu_);
+        cv_.wait(l, [this] { return stop_ || pending_ != 0; });
+        if (pending_ == 0) {  // stopped and drained
+          return;
+        }
+        --pending_;
+      }
+      // pending_ counts queued tasks, so a task is guaranteed to be found.
+      while (!pop(id, &task)) {
+        std::this_thread::yield();
+      }
+      task();
+    }
+  }
+
+  Vec<std::unique_ptr<Queue>> queues_;
+  Vec<std::thread> threads_;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  size_t pending_{0};
+  bool stop_{false};
+  std::atomic<size_t> next_{0};
+};
+
+/**
+ * @brief parallelFor call fn(begin, end) over [0, n) split in chunks of grain items, using ThreadPool::current().
+ * The chunks only depend on n and grain, so kernels give the same result whatever the number of threads is.
+ */
+inline void parallelFor(size_t n, size_t grain, const std::function<void(size_t begin, size_t end)>& fn) {
+  size_t numChunks = (n + grain - 1) / grain;
+  auto chunk = [&](size_t c) { fn(c * grain, std::min(n, (c + 1) * grain)); };
+  ThreadPool* pool = ThreadPool::current();
+  if (pool == nullptr || numChunks <= 1) {
+    for (size_t c = 0; c < numChunks; ++c) {
+      chunk(c);
+    }
+  } else {
+    pool->parallelRun(numChunks, chunk);
+  }
+}
+}
+}
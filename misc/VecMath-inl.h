@@ -0,0 +1,106 @@
+// The SIMD algorithms of VecMath.cpp. It is included once per instruction set, in a namespace defining the vector
+// operations V and under the matching #pragma GCC target, so it has no include guard. They are the Cephes
+// approximations: a reduction of the argument, a polynomial, and a reconstruction by the exponent bits.
+
+using F = V::F;
+
+static inline F absV(F x) { return V::asFloat(V::andi(V::asInt(x), V::seti(0x7fffffff))); }
+
+// 2^n, for n in [-126, 127].
+static inline F pow2V(V::I n) { return V::asFloat(V::shl23(V::addi(n, V::seti(127)))); }
+
+static inline F expV(F x) {
+  const F hi = V::set(88.72283f), lo = V::set(-87.33654f);
+  F xc = V::min(V::max(x, lo), hi);
+  // x = n ln2 + r, |r| <= ln2 / 2. ln2 is split in two so n ln2 is exact.
+  V::I n = V::round(V::mul(xc, V::set(1.44269504088896341f)));
+  F fn = V::toFloat(n);
+  F r = V::fma(fn, V::set(-0.693359375f), xc);
+  r = V::fma(fn, V::set(2.12194440e-4f), r);
+  F y = V::set(1.9875691500e-4f);
+  y = V::fma(y, r, V::set(1.3981999507e-3f));
+  y = V::fma(y, r, V::set(8.3334519073e-3f));
+  y = V::fma(y, r, V::set(4.1665795894e-2f));
+  y = V::fma(y, r, V::set(1.6666665459e-1f));
+  y = V::fma(y, r, V::set(5.0000001201e-1f));
+  y = V::fma(y, V::mul(r, r), V::add(r, V::set(1.0f)));
+  // n is in [-126, 128], 2^n is two factors so each is a normal float.
+  V::I half = V::sra1(n);
+  y = V::mul(V::mul(y, pow2V(half)), pow2V(V::subi(n, half)));
+  y = V::select(V::gt(x, hi), V::set(INFINITY), y);
+  y = V::select(V::lt(x, lo), V::set(0.0f), y);
+  return V::select(V::isNaN(x), x, y);
+}
+
+static inline F logV(F x) {
+  // x = m 2^e, m in [sqrt(0.5), sqrt(2)). Subnormals are scaled to normals first.
+  V::M subnormal = V::lt(x, V::set(1.17549435e-38f));
+  F xn = V::select(subnormal, V::mul(x, V::set(8388608.0f)), x);
+  V::I bits = V::asInt(xn);
+  F e = V::toFloat(V::subi(V::shr23(bits), V::seti(126)));
+  e = V::sub(e, V::select(subnormal, V::set(23.0f), V::set(0.0f)));
+  F m = V::asFloat(V::ori(V::andi(bits, V::seti(0x007fffff)), V::seti(0x3f000000)));  // in [0.5, 1)
+  V::M small = V::lt(m, V::set(0.707106781186547524f));
+  e = V::sub(e, V::select(small, V::set(1.0f), V::set(0.0f)));
+  m = V::sub(V::add(m, V::select(small, m, V::set(0.0f))), V::set(1.0f));
+  F z = V::mul(m, m);
+  F y = V::set(7.0376836292e-2f);
+  y = V::fma(y, m, V::set(-1.1514610310e-1f));
+  y = V::fma(y, m, V::set(1.1676998740e-1f));
+  y = V::fma(y, m, V::set(-1.2420140846e-1f));
+  y = V::fma(y, m, V::set(1.4249322787e-1f));
+  y = V::fma(y, m, V::set(-1.6668057665e-1f));
+  y = V::fma(y, m, V::set(2.0000714765e-1f));
+  y = V::fma(y, m, V::set(-2.4999993993e-1f));
+  y = V::fma(y, m, V::set(3.3333331174e-1f));
+  y = V::mul(V::mul(y, m), z);
+  y = V::fma(e, V::set(-2.12194440e-4f), y);
+  y = V::fma(z, V::set(-0.5f), y);
+  F r = V::fma(e, V::set(0.693359375f), V::add(m, y));
+  r = V::select(V::eq(x, V::set(0.0f)), V::set(-INFINITY), r);
+  r = V::select(V::lt(x, V::set(0.0f)), V::set(NAN), r);
+  r = V::select(V::eq(x, V::set(INFINITY)), x, r);
+  return V::select(V::isNaN(x), x, r);
+}
+
+static inline F tanhV(F x) {
+  F ax = absV(x);
+  // |x| > 0.625: 1 - 2 / (exp(2|x|) + 1) with the sign of x, it is 1 when exp overflows.
+  F big = V::sub(V::set(1.0f), V::div(V::set(2.0f), V::add(expV(V::add(ax, ax)), V::set(1.0f))));
+  big = V::asFloat(V::ori(V::asInt(big), V::andi(V::asInt(x), V::seti(0x80000000))));
+  // otherwise x + x^3 P(x^2).
+  F z = V::mul(x, x);
+  F p = V::set(-5.70498872745e-3f);
+  p = V::fma(p, z, V::set(2.06390887954e-2f));
+  p = V::fma(p, z, V::set(-5.37397155531e-2f));
+  p = V::fma(p, z, V::set(1.33314422036e-1f));
+  p = V::fma(p, z, V::set(-3.33332819422e-1f));
+  F small = V::fma(V::mul(p, z), x, x);
+  return V::select(V::gt(ax, V::set(0.625f)), big, small);
+}
+
+static inline F sigmoidV(F x) {
+  return V::div(V::set(1.0f), V::add(V::set(1.0f), expV(V::sub(V::set(0.0f), x))));
+}
+
+// Whole vectors, then the tail through a padded vector, so every element is computed by the same instructions.
+template <F (*fn)(F)>
+static inline void applyV(const float* x, float* y, size_t n) {
+  size_t i = 0;
+  for (; i + V::kWidth <= n; i += V::kWidth) {
+    V::store(y + i, fn(V::load(x + i)));
+  }
+  if (i < n) {
+    float buf[V::kWidth] = {0};
+    std::memcpy(buf, x + i, (n - i) * sizeof(float));
+    V::store(buf, fn(V::load(buf)));
+    std::memcpy(y + i, buf, (n - i) * sizeof(float));
+  }
+}
+
+static void expArray(const float* x, float* y, size_t n) { applyV<expV>(x, y, n); }
+static void logArray(const float* x, float* y, size_t n) { applyV<logV>(x, y, n); }
+static void tanhArray(const float* x, float* y, size_t n) { applyV<tanhV>(x, y, n); }
+static void sigmoidArray(const float* x, float* y, size_t n) { applyV<sigmoidV>(x, y, n); }
+
+static const VecMathKernels kKernels = {expArray, logArray, tanhArray, sigmoidArray};
@@ -0,0 +1,222 @@
+#include "VecMath.h"
+#include <easylogging++.h>
+#include <cmath>
+#include <cstring>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+namespace nnet {
+namespace util {
+
+namespace scalar {
+static void expArray(const float* x, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) y[i] = std::exp(x[i]);
+}
+static void logArray(const float* x, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) y[i] = std::log(x[i]);
+}
+static void tanhArray(const float* x, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) y[i] = std::tanh(x[i]);
+}
+static void sigmoidArray(const float* x, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) y[i] = 1.0f / (1.0f + std::exp(-x[i]));
+}
+static const VecMathKernels kKernels = {expArray, logArray, tanhArray, sigmoidArray};
+}
+
+#ifdef __x86_64__
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+namespace sse4 {
+struct V {
+  using F = __m128;
+  using I = __m128i;
+  using M = __m128;
+  static constexpr size_t kWidth = 4;
+  static F set(float v) { return _mm_set1_ps(v); }
+  static I seti(int v) { return _mm_set1_epi32(v); }
+  static F load(const float* p) { return _mm_loadu_ps(p); }
+  static void store(float* p, F v) { _mm_storeu_ps(p, v); }
+  static F add(F a, F b) { return _mm_add_ps(a, b); }
+  static F sub(F a, F b) { return _mm_sub_ps(a, b); }
+  static F mul(F a, F b) { return _mm_mul_ps(a, b); }
+  static F div(F a, F b) { return _mm_div_ps(a, b); }
+  static F fma(F a, F b, F c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }  // no FMA before AVX2
+  static F min(F a, F b) { return _mm_min_ps(a, b); }
+  static F max(F a, F b) { return _mm_max_ps(a, b); }
+  static M lt(F a, F b) { return _mm_cmplt_ps(a, b); }
+  static M gt(F a, F b) { return _mm_cmpgt_ps(a, b); }
+  static M eq(F a, F b) { return _mm_cmpeq_ps(a, b); }
+  static M isNaN(F a) { return _mm_cmpunord_ps(a, a); }
+  static F select(M m, F a, F b) { return _mm_blendv_ps(b, a, m); }
+  static I round(F a) { return _mm_cvtps_epi32(a); }
+  static F toFloat(I a) { return _mm_cvtepi32_ps(a); }
+  static I addi(I a, I b) { return _mm_add_epi32(a, b); }
+  static I subi(I a, I b) { return _mm_sub_epi32(a, b); }
+  static I andi(I a, I b) { return _mm_and_si128(a, b); }
+  static I ori(I a, I b) { return _mm_or_si128(a, b); }
+  static I shl23(I a) { return _mm_slli_epi32(a, 23); }
+  static I shr23(I a) { return _mm_srli_epi32(a, 23); }
+  static I sra1(I a) { return _mm_srai_epi32(a, 1); }
+  static F asFloat(I a) { return _mm_castsi128_ps(a); }
+  static I asInt(F a) { return _mm_castps_si128(a); }
+};
+#include "VecMath-inl.h"
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+namespace avx2 {
+struct V {
+  using F = __m256;
+  using I = __m256i;
+  using M = __m256;
+  static constexpr size_t kWidth = 8;
+  static F set(float v) { return _mm256_set1_ps(v); }
+  static I seti(int v) { return _mm256_set1_epi32(v); }
+  static F load(const float* p) { return _mm256_loadu_ps(p); }
+  static void store(float* p, F v) { _mm256_storeu_ps(p, v); }
+  static F add(F a, F b) { return _mm256_add_ps(a, b); }
+  static F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+  static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+  static F div(F a, F b) { return _mm256_div_ps(a, b); }
+  static F fma(F a, F b, F c) { return _mm256_fmadd_ps(a, b, c); }
+  static F min(F a, F b) { return _mm256_min_ps(a, b); }
+  static F max(F a, F b) { return _mm256_max_ps(a, b); }
+  static M lt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+  static M gt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+  static M eq(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+  static M isNaN(F a) { return _mm256_cmp_ps(a, a, _CMP_UNORD_Q); }
+  static F select(M m, F a, F b) { return _mm256_blendv_ps(b, a, m); }
+  static I round(F a) { return _mm256_cvtps_epi32(a); }
+  static F toFloat(I a) { return _mm256_cvtepi32_ps(a); }
+  static I addi(I a, I b) { return _mm256_add_epi32(a, b); }
+  static I subi(I a, I b) { return _mm256_sub_epi32(a, b); }
+  static I andi(I a, I b) { return _mm256_and_si256(a, b); }
+  static I ori(I a, I b) { return _mm256_or_si256(a, b); }
+  static I shl23(I a) { return _mm256_slli_epi32(a, 23); }
+  static I shr23(I a) { return _mm256_srli_epi32(a, 23); }
+  static I sra1(I a) { return _mm256_srai_epi32(a, 1); }
+  static F asFloat(I a) { return _mm256_castsi256_ps(a); }
+  static I asInt(F a) { return _mm256_castps_si256(a); }
+};
+#include "VecMath-inl.h"
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+namespace avx512 {
+struct V {
+  using F = __m512;
+  using I = __m512i;
+  using M = __mmask16;
+  static constexpr size_t kWidth = 16;
+  // The intrinsics below which GCC defines with an undefined pass-through (e.g. _mm512_min_ps) warn under -Wall, their
+  // zero-masked forms with every lane set compile to the same instructions.
+  static constexpr M kAll = 0xFFFF;
+  static F set(float v) { return _mm512_set1_ps(v); }
+  static I seti(int v) { return _mm512_set1_epi32(v); }
+  static F load(const float* p) { return _mm512_loadu_ps(p); }
+  static void store(float* p, F v) { _mm512_storeu_ps(p, v); }
+  static F add(F a, F b) { return _mm512_add_ps(a, b); }
+  static F sub(F a, F b) { return _mm512_sub_ps(a, b); }
+  static F mul(F a, F b) { return _mm512_mul_ps(a, b); }
+  static F div(F a, F b) { return _mm512_div_ps(a, b); }
+  static F fma(F a, F b, F c) { return _mm512_fmadd_ps(a, b, c); }
+  static F min(F a, F b) { return _mm512_maskz_min_ps(kAll, a, b); }
+  static F max(F a, F b) { return _mm512_maskz_max_ps(kAll, a, b); }
+  static M lt(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+  static M gt(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+  static M eq(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+  static M isNaN(F a) { return _mm512_cmp_ps_mask(a, a, _CMP_UNORD_Q); }
+  static F select(M m, F a, F b) { return _mm512_mask_blend_ps(m, b, a); }
+  static I round(F a) { return _mm512_maskz_cvtps_epi32(kAll, a); }
+  static F toFloat(I a) { return _mm512_maskz_cvtepi32_ps(kAll, a); }
+  static I addi(I a, I b) { return _mm512_add_epi32(a, b); }
+  static I subi(I a, I b) { return _mm512_sub_epi32(a, b); }
+  static I andi(I a, I b) { return _mm512_and_si512(a, b); }
+  static I ori(I a, I b) { return _mm512_or_si512(a, b); }
+  static I shl23(I a) { return _mm512_maskz_slli_epi32(kAll, a, 23); }
+  static I shr23(I a) { return _mm512_maskz_srli_epi32(kAll, a, 23); }
+  static I sra1(I a) { return _mm512_maskz_srai_epi32(kAll, a, 1); }
+  static F asFloat(I a) { return _mm512_castsi512_ps(a); }
+  static I asInt(F a) { return _mm512_castps_si512(a); }
+};
+#include "VecMath-inl.h"
+}
+#pragma GCC pop_options
+#endif
+
+bool hasSimdIsa(SimdIsa isa) {
+  switch (isa) {
+    case kISA_SCALAR:
+      return true;
+#ifdef __x86_64__
+    case kISA_SSE4: {
+      static bool has = __builtin_cpu_supports("sse4.1");
+      return has;
+    }
+    case kISA_AVX2: {
+      static bool has = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+      return has;
+    }
+    case kISA_AVX512: {
+      static bool has = __builtin_cpu_supports("avx512f");
+      return has;
+    }
+#endif
+    default:
+      return false;
+  }
+}
+
+SimdIsa bestSimdIsa() {
+  static SimdIsa best = [] {
+    for (int isa = kNUM_ISAS - 1; isa > kISA_SCALAR; --isa) {
+      if (hasSimdIsa((SimdIsa)isa)) return (SimdIsa)isa;
+    }
+    return kISA_SCALAR;
+  }();
+  return best;
+}
+
+const char* simdIsaName(SimdIsa isa) {
+  switch (isa) {
+    case kISA_SCALAR:
+      return "scalar";
+    case kISA_SSE4:
+      return "sse4";
+    case kISA_AVX2:
+      return "avx2";
+    case kISA_AVX512:
+      return "avx512";
+    default:
+      return "unknown";
+  }
+}
+
+const VecMathKernels& vecMathKernels(SimdIsa isa) {
+  CHECK(hasSimdIsa(isa)) << "The CPU cannot run " << simdIsaName(isa);
+  switch (isa) {
+#ifdef __x86_64__
+    case kISA_SSE4:
+      return sse4::kKernels;
+    case kISA_AVX2:
+      return avx2::kKernels;
+    case kISA_AVX512:
+      return avx512::kKernels;
+#endif
+    default:
+      return scalar::kKernels;
+  }
+}
+
+const VecMathKernels& vecMath() {
+  static const VecMathKernels& best = vecMathKernels(bestSimdIsa());
+  return best;
+}
+}
+}
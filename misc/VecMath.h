@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+
+namespace nnet {
+namespace util {
+
+/**
+ * Vectorized exp, log, tanh and sigmoid of n floats, y may be x. They have a variant per instruction set, the best one
+ * the CPU runs is picked once at startup by CPUID, whatever the build flags. The scalar variant calls the C library.
+ *
+ * The error to the exact result, over the finite floats, is at most:
+ *   exp      1.5 ulp. The SIMD variants underflow to 0 below -87.34 (no subnormal results), and overflow to inf above
+ *            88.72.
+ *   log      1 ulp. log(0) is -inf, log of a negative number is NaN.
+ *   tanh     2.5 ulp.
+ *   sigmoid  2.5 ulp. Results below 1.2e-38 (x < -87.34) may be subnormal or 0.
+ * NaN inputs give NaN. The VecMath case of engine_test measures them over a sample of all floats.
+ */
+enum SimdIsa { kISA_SCALAR, kISA_SSE4, kISA_AVX2, kISA_AVX512, kNUM_ISAS };
+
+using VecMathFN = void (*)(const float* x, float* y, size_t n);
+
+struct VecMathKernels {
+  VecMathFN exp_;
+  VecMathFN log_;
+  VecMathFN tanh_;
+  VecMathFN sigmoid_;
+};
+
+bool hasSimdIsa(SimdIsa isa);
+SimdIsa bestSimdIsa();
+const char* simdIsaName(SimdIsa isa);
+
+// The kernels of an instruction set the CPU runs, e.g. to compare them in tests and benchmarks.
+const VecMathKernels& vecMathKernels(SimdIsa isa);
+
+// The kernels of bestSimdIsa().
+const VecMathKernels& vecMath();
+
+inline void vecExp(const float* x, float* y, size_t n) { vecMath().exp_(x, y, n); }
+inline void vecLog(const float* x, float* y, size_t n) { vecMath().log_(x, y, n); }
+inline void vecTanh(const float* x, float* y, size_t n) { vecMath().tanh_(x, y, n); }
+inline void vecSigmoid(const float* x, float* y, size_t n) { vecMath().sigmoid_(x, y, n); }
+}
+}
@@ -0,0 +1,85 @@
+#include "EigenOp-inl.h"
+
+namespace nnet {
+namespace eigen_ops {
+
+struct AdagradAttrs {
+  float learningRate_;
+  float epsilon_;
+};
+
+/**
+ * adagrad scales the learning rate of each weight by the accumulated squares of its gradients: A += G * G,
+ * W -= learning_rate * G / (sqrt(A) + epsilon). The inputs are {params, grads, accums}, the outputs {params, accums}.
+ */
+static void AdagradOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  size_t n = inputs.size() - outputs.size();
+  float learning_rate = attrs.get<AdagradAttrs>().learningRate_;
+  float epsilon = attrs.get<AdagradAttrs>().epsilon_;
+  multiTensorFor({&outputs[0], &inputs[n], &outputs[n]}, n, rowGrain(6), [&](size_t t, size_t begin, size_t end) {
+    auto W = segment(outputs[t], begin, end).array();
+    auto G = segment(inputs[n + t], begin, end).array();
+    auto A = segment(outputs[n + t], begin, end).array();
+    A += G.square();
+    W -= learning_rate * G / (A.sqrt() + epsilon);
+  });
+}
+
+// sparse_adagrad is adagrad for a row-sparse gradient, the inputs are {param, grad, rows, accum}.
+static void SparseAdagradOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  auto W = cast<Matrix>(outputs[0]);
+  auto G = cast<Matrix>(inputs[1]);
+  auto rows = (const int *)inputs[2].buffer_->get();
+  auto A = cast<Matrix>(outputs[1]);
+  float learning_rate = attrs.get<AdagradAttrs>().learningRate_;
+  float epsilon = attrs.get<AdagradAttrs>().epsilon_;
+  parallelFor(numSparseRows(inputs[2]), rowGrain(G.cols() * 5), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      auto a = A.row(rows[i]).array();
+      auto g = G.row(i).array();
+      a += g.square();
+      W.row(rows[i]).array() -= learning_rate * g / (a.sqrt() + epsilon);
+    }
+  });
+}
+
+static void SparseAdagradShapeImpl(const SmallVec<VariableAttrPtr> &inputs,
+                                   const SmallVec<VariableAttrPtr> &outputs) {
+  CHECK_EQ(inputs[1]->dims_[1], inputs[0]->dims_[1]);
+  CHECK_EQ(inputs[2]->dims_[0], inputs[1]->dims_[0]);
+  checkUpdatedInPlace(inputs, outputs, 1, 2);  // the grad and its rows
+  CHECK_EQ(inputs[3]->dims_, inputs[0]->dims_);
+  outputs[0]->dims_ = inputs[0]->dims_;
+  outputs[1]->dims_ = inputs[0]->dims_;
+}
+
+static graph::OpCost AdagradCost(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
+  return optimizerCost(inputs, outputs, 6, 5);
+}
+
+static graph::OpCost SparseAdagradCost(const SmallVec<VariableAttrPtr> &inputs,
+                                       const SmallVec<VariableAttrPtr> &outputs) {
+  graph::OpCost cost;
+  double n = details::product(inputs[1]->dims_);
+  cost.flops_ = 6 * n;
+  cost.bytes_ = 5 * n * sizeof(float);
+  return cost;
+}
+
+static InitFunction init([] {
+  for (auto sparse : {false, true}) {
+    OpMeta meta;
+    meta.type_ = sparse ? "sparse_adagrad" : "adagrad";
+    meta.kernels[kDEVICE_CPU] = sparse ? SparseAdagradOpImpl : AdagradOpImpl;
+    meta.shapeInferer_ = sparse ? SparseAdagradShapeImpl : optimizerShape;
+    meta.cost_ = sparse ? SparseAdagradCost : AdagradCost;
+    meta.setAttrs<AdagradAttrs>();
+    meta.attrMeta_.push_back(AttributeMeta::create<float>("learning_rate", "LR for adagrad"));
+    meta.attrMeta_.back()->bind(&AdagradAttrs::learningRate_).constraints<float>().defaultValue(0.01);
+    meta.attrMeta_.push_back(AttributeMeta::create<float>("epsilon", "added to the root of the accumulator"));
+    meta.attrMeta_.back()->bind(&AdagradAttrs::epsilon_).constraints<float>().defaultValue(1e-6);
+    OpMeta::gAllOpMeta_[meta.type_] = meta;
+  }
+});
+}
+}
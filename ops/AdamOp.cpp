@@ -0,0 +1,117 @@
+#include "EigenOp-inl.h"
+
+namespace nnet {
+namespace eigen_ops {
+
+struct AdamAttrs {
+  float learningRate_;
+  float beta1_;
+  float beta2_;
+  float epsilon_;
+};
+
+// The learning rate of step t of adam, with the bias corrections of the first and second moments folded in.
+static float adamLearningRate(const AdamAttrs &attrs, float t) {
+  return attrs.learningRate_ * std::sqrt(1 - std::pow(attrs.beta2_, t)) / (1 - std::pow(attrs.beta1_, t));
+}
+
+/**
+ * adam keeps moving averages of the gradient and of its square per weight: M = beta1 * M + (1 - beta1) * G,
+ * V = beta2 * V + (1 - beta2) * G * G, W -= lr_t * M / (sqrt(V) + epsilon), where lr_t is the learning rate with the
+ * bias corrections of step t. The inputs are {params, grads, Ms, Vs, steps}, the outputs {params, Ms, Vs, steps}. A
+ * step is a float per param, the number of updates it had.
+ */
+static void AdamOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  size_t n = inputs.size() - outputs.size();
+  auto &adam = attrs.get<AdamAttrs>();
+  float beta1 = adam.beta1_, beta2 = adam.beta2_, epsilon = adam.epsilon_;
+  SmallVec<float> lr(n);
+  bool sameStep = true;  // the params could then be updated as one array
+  for (size_t t = 0; t < n; ++t) {
+    float &step = *(float *)outputs[3 * n + t].buffer_->get();
+    lr[t] = adamLearningRate(adam, ++step);
+    sameStep &= lr[t] == lr[0];
+  }
+  SmallVec<const Variable *> groups = {&outputs[0], &inputs[n], &outputs[n], &outputs[2 * n]};
+  auto update = [&](size_t t, size_t begin, size_t end) {
+    auto W = segment(outputs[t], begin, end).array();
+    auto G = segment(inputs[n + t], begin, end).array();
+    auto M = segment(outputs[n + t], begin, end).array();
+    auto V = segment(outputs[2 * n + t], begin, end).array();
+    M = beta1 * M + (1 - beta1) * G;
+    V = beta2 * V + (1 - beta2) * G.square();
+    W -= lr[t] * M / (V.sqrt() + epsilon);
+  };
+  multiTensorFor(groups, n, rowGrain(10), update, sameStep);
+}
+
+/**
+ * sparse_adam is adam for a row-sparse gradient, the inputs are {param, grad, rows, M, V, step}. The moments of a row
+ * only decay when the row is in the gradient, i.e. the lazy Adam of TensorFlow.
+ */
+static void SparseAdamOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  auto W = cast<Matrix>(outputs[0]);
+  auto G = cast<Matrix>(inputs[1]);
+  auto rows = (const int *)inputs[2].buffer_->get();
+  auto M = cast<Matrix>(outputs[1]);
+  auto V = cast<Matrix>(outputs[2]);
+  auto &adam = attrs.get<AdamAttrs>();
+  float beta1 = adam.beta1_, beta2 = adam.beta2_, epsilon = adam.epsilon_;
+  float &step = *(float *)outputs[3].buffer_->get();
+  float lr = adamLearningRate(adam, ++step);
+  parallelFor(numSparseRows(inputs[2]), rowGrain(G.cols() * 10), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      auto m = M.row(rows[i]).array();
+      auto v = V.row(rows[i]).array();
+      auto g = G.row(i).array();
+      m = beta1 * m + (1 - beta1) * g;
+      v = beta2 * v + (1 - beta2) * g.square();
+      W.row(rows[i]).array() -= lr * m / (v.sqrt() + epsilon);
+    }
+  });
+}
+
+static void SparseAdamShapeImpl(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
+  CHECK_EQ(inputs[1]->dims_[1], inputs[0]->dims_[1]);
+  CHECK_EQ(inputs[2]->dims_[0], inputs[1]->dims_[0]);
+  checkUpdatedInPlace(inputs, outputs, 1, 2);  // the grad and its rows
+  CHECK_EQ(inputs[3]->dims_, inputs[0]->dims_);
+  CHECK_EQ(inputs[4]->dims_, inputs[0]->dims_);
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    outputs[i]->dims_ = inputs[i == 0 ? 0 : i + 2]->dims_;
+  }
+}
+
+static graph::OpCost AdamCost(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
+  return optimizerCost(inputs, outputs, 10, 7);
+}
+
+static graph::OpCost SparseAdamCost(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
+  graph::OpCost cost;
+  double n = details::product(inputs[1]->dims_);
+  cost.flops_ = 10 * n;
+  cost.bytes_ = 7 * n * sizeof(float);
+  return cost;
+}
+
+static InitFunction init([] {
+  for (auto sparse : {false, true}) {
+    OpMeta meta;
+    meta.type_ = sparse ? "sparse_adam" : "adam";
+    meta.kernels[kDEVICE_CPU] = sparse ? SparseAdamOpImpl : AdamOpImpl;
+    meta.shapeInferer_ = sparse ? SparseAdamShapeImpl : optimizerShape;
+    meta.cost_ = sparse ? SparseAdamCost : AdamCost;
+    meta.setAttrs<AdamAttrs>();
+    meta.attrMeta_.push_back(AttributeMeta::create<float>("learning_rate", "LR for adam"));
+    meta.attrMeta_.back()->bind(&AdamAttrs::learningRate_).constraints<float>().defaultValue(0.001);
+    meta.attrMeta_.push_back(AttributeMeta::create<float>("beta1", "decay of the first moment"));
+    meta.attrMeta_.back()->bind(&AdamAttrs::beta1_).constraints<float>().defaultValue(0.9);
+    meta.attrMeta_.push_back(AttributeMeta::create<float>("beta2", "decay of the second moment"));
+    meta.attrMeta_.back()->bind(&AdamAttrs::beta2_).constraints<float>().defaultValue(0.999);
+    meta.attrMeta_.push_back(AttributeMeta::create<float>("epsilon", "added to the root of the second moment"));
+    meta.attrMeta_.back()->bind(&AdamAttrs::epsilon_).constraints<float>().defaultValue(1e-8);
+    OpMeta::gAllOpMeta_[meta.type_] = meta;
+  }
+});
+}
+}
@@ -0,0 +1,76 @@
+#include <cstring>
+#include "EigenOp-inl.h"
+
+namespace nnet {
+namespace eigen_ops {
+
+static bool isFloat(graph::VariableType type) { return type == graph::kFLOAT32 || graph::isHalf(type); }
+
+/**
+ * cast converts a float variable between kFLOAT32, kBF16 and kFP16, to the type the output is created with. Its
+ * gradient is float, as every gradient, so cast_grad only copies it.
+ */
+static void castOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  auto from = inputs[0].attr_->type_;
+  auto to = outputs[0].attr_->type_;
+  auto src = (const char *)inputs[0].buffer_->get();
+  auto dst = (char *)outputs[0].buffer_->get();
+  parallelFor(details::product(inputs[0].attr_->dims_), 1UL << 14, [&](size_t begin, size_t end) {
+    if (from == to) {
+      size_t size = graph::elementSize(from);
+      std::memcpy(dst + begin * size, src + begin * size, (end - begin) * size);
+    } else if (from == graph::kFLOAT32) {
+      util::fromFloat((const float *)src + begin, to, (uint16_t *)dst + begin, end - begin);
+    } else if (to == graph::kFLOAT32) {
+      util::toFloat((const uint16_t *)src + begin, from, (float *)dst + begin, end - begin);
+    } else {  // between the 16-bit types, through float
+      float buf[256];
+      for (size_t i = begin; i < end; i += 256) {
+        size_t n = std::min<size_t>(256, end - i);
+        util::toFloat((const uint16_t *)src + i, from, buf, n);
+        util::fromFloat(buf, to, (uint16_t *)dst + i, n);
+      }
+    }
+  });
+}
+
+static void castShapeImpl(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
+  CHECK(isFloat(inputs[0]->type_) && isFloat(outputs[0]->type_)) << "cast only converts between float types";
+  outputs[0]->dims_ = inputs[0]->dims_;
+}
+
+static void castGradImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  auto GO = cast<Vector>(inputs[0]);
+  auto GX = cast<Vector>(outputs[0]);
+  assignOrAdd(accumulate(outputs[0]), GX, GO);
+}
+
+static SmallVec<Op> GetCastGradImpl(const SmallVec<VariableAttrPtr> &I, const SmallVec<VariableAttrPtr> &O,
+                                    const SmallVec<VariableAttrPtr> &OG, const SmallVec<VariableAttrPtr> &IG) {
+  Op op;
+  op.type_ = "cast_grad";
+  op.inputs_ = {OG[0]};
+  op.outputs_ = {IG[0]};
+  return {op};
+}
+
+static InitFunction init([] {
+  {
+    OpMeta meta;
+    meta.type_ = "cast";
+    meta.kernels[kDEVICE_CPU] = castOpImpl;
+    meta.shapeInferer_ = castShapeImpl;
+    meta.grad_ = GetCastGradImpl;
+    OpMeta::gAllOpMeta_[meta.type_] = meta;
+  }
+  {
+    OpMeta meta;
+    meta.type_ = "cast_grad";
+    meta.kernels[kDEVICE_CPU] = castGradImpl;
+    meta.shapeInferer_ = castShapeImpl;
+    meta.inplace_ = {{0, 0}};
+    OpMeta::gAllOpMeta_[meta.type_] = meta;
+  }
+});
+}
+}
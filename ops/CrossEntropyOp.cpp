@@ -3,8 +3,7 @@
 namespace nnet {
 namespace eigen_ops {
 
-static void XEOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs,
-                     const Map<std::string, Any> &attrs) {
+static void XEOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
   auto p = (float *)(inputs[0].buffer_->get());
   auto l = (int *)(inputs[1].buffer_->get());
   auto loss = (float *)(outputs[0].buffer_->get());
@@ -12,11 +11,13 @@ static void XEOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outpu
   auto batchSize = inputs[0].attr_->dims_[0];
   auto featureSize = inputs[0].attr_->dims_[1];
 
-  for (decltype(batchSize) i = 0; i < batchSize; ++i) {
-    auto label = l[i];
-    CHECK_LT(label, featureSize) << "Feature size = " << featureSize << ", but user given label is " << label;
-    loss[i] = -std::log(p[featureSize * i + l[i]]);
-  }
+  parallelFor(batchSize, rowGrain(20), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      auto label = l[i];
+      CHECK_LT(label, featureSize) << "Feature size = " << featureSize << ", but user given label is " << label;
+      loss[i] = -std::log(p[featureSize * i + l[i]]);
+    }
+  });
 }
 
 static void XEShapeImpl(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
@@ -25,19 +26,23 @@ static void XEShapeImpl(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<
   outputs[0]->dims_ = {inputs[0]->dims_[0], 1};
 }
 
-static void XEOpGradImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs,
-                         const Map<std::string, Any> &attrs) {
+static void XEOpGradImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
   size_t numSamples = inputs[0].attr_->dims_[0];
   size_t dim = inputs[0].attr_->dims_[1];
-  float *out = (float *)inputs[0].buffer_->get();
-  float *grad = (float *)outputs[0].buffer_->get();
-  int *lbl = (int *)inputs[1].buffer_->get();
-  for (size_t i = 0; i < numSamples; ++i, out += dim, grad += dim) {
-    grad[lbl[i]] -= 1 / out[lbl[i]];
-  }
   auto GO = cast<Vector>(inputs[2]).array();  // coeff
   auto GI = cast<Matrix>(outputs[0]).array();
-  GI.colwise() *= GO;
+  bool acc = accumulate(outputs[0]);
+  parallelFor(numSamples, rowGrain(dim), [&](size_t begin, size_t end) {
+    if (!acc) {
+      GI.middleRows(begin, end - begin) = 0;
+    }
+    float *out = (float *)inputs[0].buffer_->get() + begin * dim;
+    float *grad = (float *)outputs[0].buffer_->get() + begin * dim;
+    int *lbl = (int *)inputs[1].buffer_->get();
+    for (size_t i = begin; i < end; ++i, out += dim, grad += dim) {
+      grad[lbl[i]] -= GO[i] / out[lbl[i]];
+    }
+  });
 }
 
 static void XEGradShapeImpl(const SmallVec<graph::VariableAttrPtr> &inputs,
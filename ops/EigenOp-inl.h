@@ -2,6 +2,8 @@
 #include "engine/Engine.h"
 #include "misc/CastEigen.h"
 #include "misc/InitFunction.h"
+#include "misc/ThreadPool.h"
+#include "misc/VecMath.h"
 
 namespace nnet {
 namespace eigen_ops {
@@ -16,6 +18,131 @@ using graph::VariableAttrPtr;
 using graph::Op;
 using graph::OpMeta;
 using graph::AttributeMeta;
+using graph::OpAttrs;
 using graph::kDEVICE_CPU;
+using util::parallelFor;
+
+/**
+ * @brief accumulate return true when a kernel must add to a gradient output, because several ops write it. Otherwise
+ * the kernel overwrites it, it is not zeroed before running. See VariableAttr::accumulateGrad_.
+ */
+inline bool accumulate(const Variable &grad) { return grad.attr_->accumulateGrad_; }
+
+// dst += src when add, otherwise dst = src.
+template <typename Dst, typename Src>
+inline void assignOrAdd(bool add, Dst &&dst, const Src &src) {
+  if (add) {
+    dst += src;
+  } else {
+    dst = src;
+  }
+}
+
+/**
+ * @brief rowGrain return how many rows a task handles when a batch-wise kernel is partitioned over the thread pool.
+ * @param costPerRow approximate number of flops per row.
+ * @param minRows lower bound, e.g. to keep GEMM blocks large enough to be efficient.
+ */
+inline size_t rowGrain(size_t costPerRow, size_t minRows = 1) {
+  constexpr size_t kMinCostPerTask = 1UL << 15;
+  return std::max(minRows, (kMinCostPerTask + costPerRow - 1) / std::max(costPerRow, 1UL));
+}
+
+/**
+ * @brief multiTensorFor call fn(tensor, begin, end) over the floats of numTensors tensors as if they were one flat
+ * array, split in chunks of grain floats over ThreadPool::current(). A group points at the first of numTensors
+ * consecutive variables of the same sizes as those of the other groups, e.g. {&outputs[0], &inputs[n]} for the params
+ * and the grads of an optimizer. [begin, end) is a range of the tensor, a chunk spanning several tensors calls fn once
+ * per tensor. The fused optimizers update every parameter with it.
+ *
+ * When the tensors of each group are laid out one after the other, e.g. in the arenas of packParameters, and merge is
+ * true, they are seen as a single tensor: fn is called with tensor 0 and ranges running past its end.
+ */
+template <typename FN>
+inline void multiTensorFor(const SmallVec<const Variable *> &groups, size_t numTensors, size_t grain, FN fn,
+                           bool merge = true) {
+  SmallVec<size_t> offsets(numTensors + 1, 0);
+  for (size_t t = 0; t < numTensors; ++t) {
+    size_t size = details::product(groups[0][t].attr_->dims_);
+    offsets[t + 1] = offsets[t] + size;
+    for (auto group : groups) {
+      merge &= t + 1 == numTensors || (float *)group[t].buffer_->get() + size == group[t + 1].buffer_->get();
+    }
+  }
+  if (merge) {
+    offsets = {0, offsets.back()};
+  }
+  parallelFor(offsets.back(), grain, [&](size_t begin, size_t end) {
+    size_t t = std::upper_bound(offsets.begin(), offsets.end(), begin) - offsets.begin() - 1;
+    for (; begin < end; ++t) {
+      size_t stop = std::min(end, offsets[t + 1]);
+      if (stop > begin) {
+        fn(t, begin - offsets[t], stop - offsets[t]);
+      }
+      begin = stop;
+    }
+  });
+}
+
+// The floats [begin, end) of a dense float variable.
+inline Eigen::Map<Vector> segment(const Variable &var, size_t begin, size_t end) {
+  return Eigen::Map<Vector>((float *)var.buffer_->get() + begin, end - begin);
+}
+
+/**
+ * An optimizer op updates n parameters at once, its inputs are {params, grads, states} and its outputs
+ * {params, states}, where the states are grouped by kind, e.g. {velocity of each param}. n is 1 unless the optimizer
+ * stage fused the updates, see fuse_optimizer.
+ */
+inline size_t numOptimizedParams(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
+  return inputs.size() - outputs.size();
+}
+
+/**
+ * The optimizer kernels update the params and the states in place, so each output must be its input: the input i of
+ * the output i < n (a param), the input i + numGradInputs of a state.
+ */
+inline void checkUpdatedInPlace(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs,
+                                size_t n, size_t numGradInputs) {
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    CHECK_EQ(outputs[i]->name_, inputs[i < n ? i : i + numGradInputs]->name_) << "Optimizers update in place";
+  }
+}
+
+// Check the grads of an optimizer op have the dims of their params, and give every output the dims of its input.
+inline void optimizerShape(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
+  size_t n = numOptimizedParams(inputs, outputs);
+  CHECK_GT(n, 0UL);
+  checkUpdatedInPlace(inputs, outputs, n, n);
+  for (size_t i = 0; i < n; ++i) {
+    CHECK_EQ(details::product(inputs[n + i]->dims_), details::product(inputs[i]->dims_)) << inputs[i]->name_;
+  }
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    outputs[i]->dims_ = inputs[i < n ? i : n + i]->dims_;
+  }
+}
+
+// The cost of an optimizer op of flops and of floats read or written per element of its params.
+inline graph::OpCost optimizerCost(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs,
+                                   double flopsPerElement, double floatsPerElement) {
+  graph::OpCost cost;
+  size_t n = numOptimizedParams(inputs, outputs);
+  for (size_t i = 0; i < n; ++i) {
+    double elements = details::product(inputs[i]->dims_);
+    cost.flops_ += flopsPerElement * elements;
+    cost.bytes_ += floatsPerElement * elements * sizeof(float);
+  }
+  return cost;
+}
+
+/**
+ * @brief numSparseRows return the number of rows of a row-sparse gradient in use, i.e. the rows before the first
+ * negative index. See VariableAttr::sparseRows_.
+ */
+inline size_t numSparseRows(const Variable &rows) {
+  auto begin = (const int *)rows.buffer_->get();
+  auto end = begin + details::product(rows.attr_->dims_);
+  return std::find_if(begin, end, [](int row) { return row < 0; }) - begin;
+}
 }
 }
\ No newline at end of file
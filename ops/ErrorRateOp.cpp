@@ -2,19 +2,22 @@
 
 namespace nnet {
 namespace eigen_ops {
-static void errorRateOps(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs,
-                         const Map<std::string, Any> &attrs) {
+static void errorRateOps(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
   auto prob = cast<Matrix>(inputs[0]);
   auto lbl = cast<IVector>(inputs[1]);
-  Eigen::Index idx;
-  size_t cnt = 0;
-  for (decltype(prob.rows()) i = 0; i < prob.rows(); ++i) {
-    prob.row(i).maxCoeff(&idx);
-    auto l = lbl.data()[i];
-    if (l == idx) {
-      ++cnt;
+  std::atomic<size_t> cnt{0};
+  parallelFor(prob.rows(), rowGrain(prob.cols()), [&](size_t begin, size_t end) {
+    Eigen::Index idx;
+    size_t localCnt = 0;
+    for (size_t i = begin; i < end; ++i) {
+      prob.row(i).maxCoeff(&idx);
+      auto l = lbl.data()[i];
+      if (l == idx) {
+        ++localCnt;
+      }
     }
-  }
+    cnt += localCnt;
+  });
   auto rate = cast<Vector>(outputs[0]);
   rate[0] = (float)(1.0 - (double)(cnt) / lbl.size());
 }
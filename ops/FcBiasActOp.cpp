@@ -0,0 +1,170 @@
+#include "EigenOp-inl.h"
+#include "misc/Gemm.h"
+
+namespace nnet {
+namespace eigen_ops {
+
+/**
+ * fc_bias_act is fc followed by an activation, created by the fuse stage. The packed GEMM adds the bias and applies
+ * the activation to each tile of O right after its last product, while it is still in cache, and the output of fc is
+ * never materialized.
+ */
+static void FCBiasActOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  static thread_local Matrix gX, gO;  // X and O may be 16-bit, as in fc
+  auto W = cast<Matrix>(inputs[1]);
+  size_t rows = inputs[0].attr_->dims_[0];
+  auto x = eigen::castRows(inputs[0], 0, rows, &gX);
+  auto o = eigen::castRows(outputs[0], 0, rows, &gO, false);
+  util::GemmEpilogue epilogue;
+  epilogue.bias_ = inputs[2].attr_ != nullptr ? (const float *)inputs[2].buffer_->get() : nullptr;
+  epilogue.tanh_ = true;  // same as the sigmoid op
+  util::gemm(false, false, rows, W.cols(), W.rows(), x.data(), x.cols(), W.data(), W.cols(), o.data(), o.cols(),
+             epilogue);
+  eigen::storeRows(outputs[0], 0, o);
+}
+
+// fc_bias_act by Eigen's GEMM, the activation is applied to each row block right after its product.
+static void FCBiasActEigenOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  auto W = cast<Matrix>(inputs[1]);
+  bool withBias = inputs[2].attr_ != nullptr;
+  parallelFor(inputs[0].attr_->dims_[0], rowGrain(W.rows() * W.cols() * 2, 32), [&](size_t begin, size_t end) {
+    static thread_local Matrix gX, gO;  // X and O may be 16-bit, as in fc
+    auto x = eigen::castRows(inputs[0], begin, end, &gX);
+    auto o = eigen::castRows(outputs[0], begin, end, &gO, false);
+    o.noalias() = x * W;
+    if (withBias) {
+      auto B = eigen::cast<eigen::Vector>(inputs[2]);
+      o.rowwise() += B.transpose();
+    }
+    util::vecTanh(o.data(), o.data(), o.size());  // same as the sigmoid op
+    eigen::storeRows(outputs[0], begin, o);
+  });
+}
+
+static void FCBiasActOpShape(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
+  CHECK_EQ(inputs[1]->type_, graph::kFLOAT32) << "The weight of fc_bias_act is a float master weight";
+  outputs[0]->dims_ = {inputs[0]->dims_[0], inputs[1]->dims_[1]};
+}
+
+// The gradient of the fc output, GO * (1 - O^2), in a scratch buffer of the thread reused across calls.
+static Matrix &activationGrad(const Variable &output, const Variable &outputGrad) {
+  static thread_local Matrix gO, gScratch;
+  auto O = eigen::castRows(output, 0, output.attr_->dims_[0], &gO);
+  auto GO = cast<Matrix>(outputGrad);
+  Matrix &GZ = gScratch;
+  GZ.resize(O.rows(), O.cols());
+  parallelFor(GZ.rows(), rowGrain(GZ.cols() * 3), [&](size_t begin, size_t end) {
+    GZ.middleRows(begin, end - begin).array() =
+        GO.middleRows(begin, end - begin).array() * (1 - O.middleRows(begin, end - begin).array().square());
+  });
+  return GZ;
+}
+
+// GW = X^T * GZ and GX = GZ * W^T by the packed GEMM, without transposing X or W.
+static void FCBiasActGradOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  static thread_local Matrix gX;
+  auto X = eigen::castRows(inputs[0], 0, inputs[0].attr_->dims_[0], &gX);
+  auto W = cast<Matrix>(inputs[1]);
+  Matrix &GZ = activationGrad(inputs[2], inputs[3]);
+  size_t M = X.rows(), K = X.cols(), N = GZ.cols();
+  util::GemmEpilogue epilogue;
+  epilogue.accumulate_ = accumulate(outputs[0]);
+  util::gemm(true, false, K, N, M, X.data(), K, GZ.data(), N, (float *)outputs[0].buffer_->get(), N, epilogue);
+  if (outputs[1].attr_ != nullptr) {
+    epilogue.accumulate_ = accumulate(outputs[1]);
+    util::gemm(false, true, M, K, N, GZ.data(), N, W.data(), N, (float *)outputs[1].buffer_->get(), K, epilogue);
+  }
+  if (outputs[2].attr_ != nullptr) {
+    auto GB = eigen::cast<Vector>(outputs[2]);
+    assignOrAdd(accumulate(outputs[2]), GB, GZ.colwise().sum().transpose());
+  }
+}
+
+// fc_bias_act_grad by Eigen's GEMM.
+static void FCBiasActGradEigenOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs,
+                                     const OpAttrs &attrs) {
+  static thread_local Matrix gX;
+  auto X = eigen::castRows(inputs[0], 0, inputs[0].attr_->dims_[0], &gX);
+  auto W = cast<Matrix>(inputs[1]);
+  auto GW = cast<Matrix>(outputs[0]);
+  Matrix &GZ = activationGrad(inputs[2], inputs[3]);
+  parallelFor(GW.rows(), rowGrain(X.rows() * GZ.cols() * 2, 32), [&](size_t begin, size_t end) {
+    assignOrAdd(accumulate(outputs[0]), GW.middleRows(begin, end - begin).noalias(),
+                X.middleCols(begin, end - begin).transpose() * GZ);
+  });
+  if (outputs[1].attr_ != nullptr) {
+    auto GX = cast<Matrix>(outputs[1]);
+    parallelFor(GX.rows(), rowGrain(GZ.cols() * W.rows() * 2, 32), [&](size_t begin, size_t end) {
+      assignOrAdd(accumulate(outputs[1]), GX.middleRows(begin, end - begin).noalias(),
+                  GZ.middleRows(begin, end - begin) * W.transpose());
+    });
+  }
+  if (outputs[2].attr_ != nullptr) {
+    auto GB = eigen::cast<Vector>(outputs[2]);
+    assignOrAdd(accumulate(outputs[2]), GB, GZ.colwise().sum().transpose());
+  }
+}
+
+static void FCBiasActGradShape(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
+  auto X = inputs[0];
+  auto W = inputs[1];
+  outputs[0]->dims_ = W->dims_;
+  if (outputs[1]) {
+    outputs[1]->dims_ = X->dims_;
+  }
+  if (outputs[2]) {
+    outputs[2]->dims_ = {1, W->dims_[1]};
+  }
+}
+
+static graph::OpCost FCBiasActCost(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
+  auto cost = OpMeta::defaultCost(inputs, outputs);
+  double M = inputs[0]->dims_[0], K = inputs[0]->dims_[1], N = inputs[1]->dims_[1];
+  cost.flops_ = 2 * M * K * N + (inputs[2] ? M * N : 0) + M * N;
+  return cost;
+}
+
+static graph::OpCost FCBiasActGradCost(const SmallVec<VariableAttrPtr> &inputs,
+                                       const SmallVec<VariableAttrPtr> &outputs) {
+  auto cost = OpMeta::defaultCost(inputs, outputs);
+  double M = inputs[0]->dims_[0], K = inputs[0]->dims_[1], N = inputs[1]->dims_[1];
+  cost.flops_ = 3 * M * N + 2 * M * K * N * (outputs[1] ? 2 : 1) + (outputs[2] ? M * N : 0);
+  return cost;
+}
+
+static SmallVec<graph::Op> GetFCBiasActGrad(const SmallVec<VariableAttrPtr> &I, const SmallVec<VariableAttrPtr> &O,
+                                            const SmallVec<VariableAttrPtr> &OG, const SmallVec<VariableAttrPtr> &IG) {
+  graph::Op op;
+  op.type_ = "fc_bias_act_grad";
+  op.inputs_ = {I[0], I[1], O[0], OG[0]};
+  op.outputs_ = {IG[1], IG[0], IG[2]};
+  return {op};
+}
+
+static InitFunction init([] {
+  {
+    graph::OpMeta meta;
+    meta.type_ = "fc_bias_act";
+    meta.kernels[graph::kDEVICE_CPU] = FCBiasActOpImpl;
+    meta.cpuVariants_.push_back({"eigen", FCBiasActEigenOpImpl, nullptr});
+    meta.shapeInferer_ = FCBiasActOpShape;
+    meta.grad_ = GetFCBiasActGrad;
+    meta.cost_ = FCBiasActCost;
+    meta.attrMeta_.push_back(AttributeMeta::create<std::string>("activation", "activation after fc"));
+    meta.attrMeta_.back()->constraints<std::string>().defaultValue("sigmoid").add([](std::string *act, bool) {
+      CHECK_EQ(*act, "sigmoid") << "fc_bias_act only supports sigmoid";
+    });
+    graph::OpMeta::gAllOpMeta_[meta.type_] = meta;
+  }
+  {
+    graph::OpMeta meta;
+    meta.type_ = "fc_bias_act_grad";
+    meta.kernels[graph::kDEVICE_CPU] = FCBiasActGradOpImpl;
+    meta.cpuVariants_.push_back({"eigen", FCBiasActGradEigenOpImpl, nullptr});
+    meta.shapeInferer_ = FCBiasActGradShape;
+    meta.cost_ = FCBiasActGradCost;
+    graph::OpMeta::gAllOpMeta_[meta.type_] = meta;
+  }
+});
+}
+}
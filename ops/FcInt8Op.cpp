@@ -0,0 +1,126 @@
+#include "EigenOp-inl.h"
+#include "misc/Int8.h"
+
+namespace nnet {
+namespace eigen_ops {
+using IMatrix = Eigen::Matrix<int32_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+struct FCInt8Attrs {
+  float inputScale_;
+  float outputScale_;
+  bool sigmoid_;  // the activation, none or sigmoid
+};
+
+/**
+ * fc_int8 is fc for inference with int8 weights, created by the quantize stage. Its inputs are X, the weights packed
+ * by util::packInt8Weights (kINT8), the bias (optional), and the scale and the int8 sum of each column of the weights.
+ * X is float (or 16-bit), quantized by the attribute input_scale, or kINT8 already. The products are accumulated in
+ * int32 and dequantized, then the activation is applied. O is float (or 16-bit), or kINT8 requantized by output_scale
+ * for a following fc_int8.
+ */
+static void FCInt8OpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  auto &X = inputs[0];
+  auto &O = outputs[0];
+  size_t cols = X.attr_->dims_[1];
+  size_t kPad = inputs[1].attr_->dims_[0], nPad = inputs[1].attr_->dims_[1];
+  size_t n = O.attr_->dims_[1];
+  auto packed = (const int8_t *)inputs[1].buffer_->get();
+  auto &fcAttrs = attrs.get<FCInt8Attrs>();
+  float inputScale = fcAttrs.inputScale_;
+  float outputScale = fcAttrs.outputScale_;
+  bool sigmoid = fcAttrs.sigmoid_;
+
+  // O = acc * mul + add per column, add removes the zero point 128 of X, and adds the bias.
+  static thread_local Vector gMul, gAdd;
+  gMul = cast<Vector>(inputs[3]) * inputScale;
+  gAdd = -128.0f * Eigen::Map<const Eigen::VectorXi>((const int *)inputs[4].buffer_->get(), n).cast<float>();
+  gAdd.array() *= gMul.array();
+  if (inputs[2].attr_ != nullptr) {
+    gAdd += cast<Vector>(inputs[2]);
+  }
+  auto mul = gMul.transpose().array();
+  auto add = gAdd.transpose().array();
+
+  parallelFor(X.attr_->dims_[0], rowGrain(kPad * nPad * 2, 32), [&](size_t begin, size_t end) {
+    static thread_local Vec<uint8_t> gX;
+    static thread_local Vec<int32_t> gAcc;
+    static thread_local Matrix gXFloat, gO;
+    size_t rows = end - begin;
+    gX.resize(rows * kPad);
+    if (X.attr_->type_ == graph::kINT8) {
+      auto src = (const uint8_t *)X.buffer_->get() + begin * cols;
+      for (size_t i = 0; i < rows; ++i) {
+        for (size_t k = 0; k < cols; ++k) gX[i * kPad + k] = src[i * cols + k] ^ 0x80;  // int8 + 128
+      }
+    } else {
+      auto xFloat = eigen::castRows(X, begin, end, &gXFloat);
+      for (size_t i = 0; i < rows; ++i) {
+        util::quantizeU8(xFloat.row(i).data(), inputScale, gX.data() + i * kPad, cols);
+      }
+    }
+    for (size_t i = 0; i < rows; ++i) {
+      std::fill(gX.data() + i * kPad + cols, gX.data() + (i + 1) * kPad, 128);
+    }
+    gAcc.resize(rows * nPad);
+    util::gemmU8S8(gX.data(), rows, kPad, packed, nPad, gAcc.data());
+
+    bool isInt8O = O.attr_->type_ == graph::kINT8;
+    if (isInt8O) gO.resize(rows, n);
+    auto o = isInt8O ? Eigen::Map<Matrix>(gO.data(), rows, n) : eigen::castRows(O, begin, end, &gO, false);
+    auto acc = Eigen::Map<IMatrix>(gAcc.data(), rows, nPad).leftCols(n).cast<float>().array();
+    o.array() = (acc.rowwise() * mul).rowwise() + add;
+    if (sigmoid) {
+      util::vecTanh(o.data(), o.data(), o.size());  // same as the sigmoid op
+    }
+    if (isInt8O) {
+      util::quantizeS8(o.data(), outputScale, (int8_t *)O.buffer_->get() + begin * n, rows * n);
+    } else {
+      eigen::storeRows(O, begin, o);
+    }
+  });
+}
+
+static void FCInt8OpShape(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
+  auto X = inputs[0];
+  auto W = inputs[1];
+  size_t n = details::product(inputs[3]->dims_);
+  CHECK(X->type_ == graph::kFLOAT32 || graph::isHalf(X->type_) || X->type_ == graph::kINT8);
+  CHECK_EQ(W->type_, graph::kINT8);
+  CHECK_EQ(W->dims_[0], util::roundUp(X->dims_[1], util::kInt8GroupRows));
+  CHECK_EQ(W->dims_[1], util::roundUp(n, util::kInt8PanelCols));
+  CHECK_EQ(inputs[4]->type_, graph::kINT32);
+  CHECK_EQ(details::product(inputs[4]->dims_), n);
+  auto type = outputs[0]->type_;
+  CHECK(type == graph::kFLOAT32 || graph::isHalf(type) || type == graph::kINT8);
+  outputs[0]->dims_ = {X->dims_[0], n};
+}
+
+static graph::OpCost FCInt8Cost(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
+  auto cost = OpMeta::defaultCost(inputs, outputs);
+  double M = inputs[0]->dims_[0], K = inputs[0]->dims_[1], N = outputs[0]->dims_[1];
+  cost.flops_ = 2 * M * K * N;
+  return cost;
+}
+
+static InitFunction init([] {
+  graph::OpMeta meta;
+  meta.type_ = "fc_int8";
+  meta.kernels[graph::kDEVICE_CPU] = FCInt8OpImpl;
+  meta.shapeInferer_ = FCInt8OpShape;
+  meta.cost_ = FCInt8Cost;
+  meta.setAttrs<FCInt8Attrs>();
+  meta.attrMeta_.push_back(AttributeMeta::create<float>("input_scale", "value of a step of the int8 X"));
+  meta.attrMeta_.back()->bind(&FCInt8Attrs::inputScale_).constraints<float>().defaultValue(1.0f / 127);
+  meta.attrMeta_.push_back(AttributeMeta::create<float>("output_scale", "value of a step of O when it is kINT8"));
+  meta.attrMeta_.back()->bind(&FCInt8Attrs::outputScale_).constraints<float>().defaultValue(1.0f / 127);
+  meta.attrMeta_.push_back(AttributeMeta::create<std::string>("activation", "none or sigmoid"));
+  meta.attrMeta_.back()->bind<std::string, FCInt8Attrs>([](const std::string &act, FCInt8Attrs *attrs) {
+    attrs->sigmoid_ = act == "sigmoid";
+  });
+  meta.attrMeta_.back()->constraints<std::string>().defaultValue("none").add([](std::string *act, bool) {
+    CHECK(*act == "none" || *act == "sigmoid") << "fc_int8 does not support " << *act;
+  });
+  graph::OpMeta::gAllOpMeta_[meta.type_] = meta;
+});
+}
+}
@@ -1,47 +1,199 @@
 #include "EigenOp-inl.h"
+#include "misc/Gemm.h"
 
 namespace nnet {
 namespace eigen_ops {
 
-static void FCOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs,
-                     const Map<std::string, Any> &attrs) {
-  auto X = cast<Matrix>(inputs[0]);
+/**
+ * fc with a kCSR_FLOAT32 input, e.g. bag-of-words features. X is never made dense, the product only reads the rows
+ * of W of the non-zeros.
+ */
+static void FCSparseOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  auto X = eigen::castCSR(inputs[0]);
   auto W = cast<Matrix>(inputs[1]);
   auto O = cast<Matrix>(outputs[0]);
-  O = X * W;
-  if (inputs[2].attr_) {
-    auto B = eigen::cast<eigen::Vector>(inputs[2]);
-    O.rowwise() += B.transpose();
+  bool withBias = inputs[2].attr_ != nullptr;
+  size_t nnzPerRow = X.nonZeros() / std::max<size_t>(X.rows(), 1) + 1;
+  parallelFor(X.rows(), rowGrain(nnzPerRow * W.cols() * 2, 32), [&](size_t begin, size_t end) {
+    auto o = O.middleRows(begin, end - begin);
+    o.noalias() = X.middleRows(begin, end - begin) * W;
+    if (withBias) {
+      auto B = eigen::cast<eigen::Vector>(inputs[2]);
+      o.rowwise() += B.transpose();
+    }
+  });
+}
+
+/**
+ * O = X * W + B by the packed GEMM of misc/Gemm.h, the bias is added to each tile of O before it is stored. X and O
+ * may be 16-bit, they are converted to float in scratch buffers of the thread and the GEMM accumulates in float. W is
+ * always float.
+ */
+static void FCOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  if (inputs[0].attr_->type_ == graph::kCSR_FLOAT32) {
+    FCSparseOpImpl(inputs, outputs, attrs);
+    return;
   }
+  static thread_local Matrix gX, gO;
+  auto W = cast<Matrix>(inputs[1]);
+  size_t rows = inputs[0].attr_->dims_[0];
+  auto x = eigen::castRows(inputs[0], 0, rows, &gX);
+  auto o = eigen::castRows(outputs[0], 0, rows, &gO, false);
+  util::GemmEpilogue epilogue;
+  epilogue.bias_ = inputs[2].attr_ != nullptr ? (const float *)inputs[2].buffer_->get() : nullptr;
+  util::gemm(false, false, rows, W.cols(), W.rows(), x.data(), x.cols(), W.data(), W.cols(), o.data(), o.cols(),
+             epilogue);
+  eigen::storeRows(outputs[0], 0, o);
+}
+
+// fc by Eigen's GEMM, a variant of the dense fc. Each row block is converted to float in a scratch of its thread.
+static void FCEigenOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  auto W = cast<Matrix>(inputs[1]);
+  bool withBias = inputs[2].attr_ != nullptr;
+  size_t rows = inputs[0].attr_->dims_[0];
+  parallelFor(rows, rowGrain(W.rows() * W.cols() * 2, 32), [&](size_t begin, size_t end) {
+    static thread_local Matrix gX, gO;
+    auto x = eigen::castRows(inputs[0], begin, end, &gX);
+    auto o = eigen::castRows(outputs[0], begin, end, &gO, false);
+    o.noalias() = x * W;
+    if (withBias) {
+      auto B = eigen::cast<eigen::Vector>(inputs[2]);
+      o.rowwise() += B.transpose();
+    }
+    eigen::storeRows(outputs[0], begin, o);
+  });
 }
+
 static void FCOpShape(const SmallVec<graph::VariableAttrPtr> &inputs, const SmallVec<graph::VariableAttrPtr> &outputs) {
   auto X = inputs[0];
   auto W = inputs[1];
+  CHECK_EQ(X->dims_[1], W->dims_[0]);
+  CHECK_EQ(W->type_, graph::kFLOAT32) << "The weight of fc is a float master weight";
+  CHECK(outputs[0]->type_ == graph::kFLOAT32 || graph::isHalf(outputs[0]->type_));
   outputs[0]->dims_ = {X->dims_[0], W->dims_[1]};
 }
 
-static void FCGradOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs,
-                         const Map<std::string, Any> &attrs) {
-  auto X = cast<Matrix>(inputs[0]);
+/**
+ * The gradient of W for a kCSR_FLOAT32 X is row-sparse (see VariableAttr::sparseRows_), with a row per column of X
+ * having non-zeros: GW = X^T * GO is computed only over these columns. X has no gradient, it is a feature.
+ */
+static void FCSparseGradOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  auto X = eigen::castCSR(inputs[0]);
+  auto GO = cast<Matrix>(inputs[2]);
+  CHECK(outputs[1].attr_ == nullptr) << "A sparse input has no gradient";
+  if (outputs[0].attr_ != nullptr) {
+    auto GW = cast<Matrix>(outputs[0]);
+    auto rows = (int *)outputs[3].buffer_->get();
+    // The non-zeros of X ordered by column, i.e. X^T in CSR, and where each column starts.
+    struct NonZero {
+      int col_;
+      int row_;
+      float value_;
+    };
+    static thread_local Vec<NonZero> gNonZeros;
+    static thread_local Vec<size_t> gColStarts;
+    auto &nonZeros = gNonZeros;
+    auto &colStarts = gColStarts;
+    nonZeros.clear();
+    colStarts.clear();
+    for (int i = 0; i < X.rows(); ++i) {
+      for (Eigen::Map<eigen::SparseMatrix>::InnerIterator it(X, i); it; ++it) {
+        nonZeros.push_back({(int)it.col(), i, it.value()});
+      }
+    }
+    std::sort(nonZeros.begin(), nonZeros.end(), [](const NonZero &a, const NonZero &b) {
+      return a.col_ != b.col_ ? a.col_ < b.col_ : a.row_ < b.row_;
+    });
+    for (size_t i = 0; i < nonZeros.size(); ++i) {
+      if (i == 0 || nonZeros[i].col_ != nonZeros[i - 1].col_) {
+        colStarts.push_back(i);
+      }
+    }
+    size_t numRows = colStarts.size();
+    CHECK_LE(numRows, (size_t)GW.rows());
+    colStarts.push_back(nonZeros.size());
+    size_t nnzPerRow = nonZeros.size() / std::max<size_t>(numRows, 1) + 1;
+    parallelFor(numRows, rowGrain(nnzPerRow * GO.cols() * 2), [&](size_t begin, size_t end) {
+      for (size_t k = begin; k < end; ++k) {
+        rows[k] = nonZeros[colStarts[k]].col_;
+        GW.row(k).setZero();
+        for (size_t j = colStarts[k]; j < colStarts[k + 1]; ++j) {
+          GW.row(k) += nonZeros[j].value_ * GO.row(nonZeros[j].row_);
+        }
+      }
+    });
+    std::fill(rows + numRows, rows + GW.rows(), -1);
+  }
+  if (outputs[2].attr_ != nullptr) {
+    auto GB = eigen::cast<Vector>(outputs[2]);
+    assignOrAdd(accumulate(outputs[2]), GB, GO.colwise().sum().transpose());
+  }
+}
+
+/**
+ * GW = X^T * GO and GX = GO * W^T by the packed GEMM, which reads X and W transposed where they are. GB is the sum of
+ * the rows of GO.
+ */
+static void FCGradOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  if (inputs[0].attr_->type_ == graph::kCSR_FLOAT32) {
+    FCSparseGradOpImpl(inputs, outputs, attrs);
+    return;
+  }
+  static thread_local Matrix gX;
+  auto X = eigen::castRows(inputs[0], 0, inputs[0].attr_->dims_[0], &gX);  // float, whatever the type of X
+  auto W = cast<Matrix>(inputs[1]);
+  auto GO = cast<Matrix>(inputs[2]);
+  size_t M = X.rows(), K = X.cols(), N = GO.cols();
+  if (outputs[0].attr_ != nullptr) {
+    util::GemmEpilogue epilogue;
+    epilogue.accumulate_ = accumulate(outputs[0]);
+    util::gemm(true, false, K, N, M, X.data(), K, GO.data(), N, (float *)outputs[0].buffer_->get(), N, epilogue);
+  }
+  if (outputs[1].attr_ != nullptr) {
+    util::GemmEpilogue epilogue;
+    epilogue.accumulate_ = accumulate(outputs[1]);
+    util::gemm(false, true, M, K, N, GO.data(), N, W.data(), N, (float *)outputs[1].buffer_->get(), K, epilogue);
+  }
+  if (outputs[2].attr_ != nullptr) {
+    auto GB = eigen::cast<Vector>(outputs[2]);
+    assignOrAdd(accumulate(outputs[2]), GB, GO.colwise().sum().transpose());
+  }
+}
+
+// fc_grad by Eigen's GEMM, a variant of the dense fc_grad.
+static void FCGradEigenOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  static thread_local Matrix gX;
+  auto X = eigen::castRows(inputs[0], 0, inputs[0].attr_->dims_[0], &gX);  // float, whatever the type of X
   auto W = cast<Matrix>(inputs[1]);
   auto GO = cast<Matrix>(inputs[2]);
   auto GW = cast<Matrix>(outputs[0]);
-  // backward mul
-  GW = X.transpose() * GO;
+  // backward mul, GW is partitioned by its rows, i.e. by the columns of X.
+  parallelFor(GW.rows(), rowGrain(X.rows() * GO.cols() * 2, 32), [&](size_t begin, size_t end) {
+    assignOrAdd(accumulate(outputs[0]), GW.middleRows(begin, end - begin).noalias(),
+                X.middleCols(begin, end - begin).transpose() * GO);
+  });
   if (outputs[1].attr_ != nullptr) {
     auto GX = cast<Matrix>(outputs[1]);
-    GX = GO * W.transpose();
+    parallelFor(GX.rows(), rowGrain(GO.cols() * W.rows() * 2, 32), [&](size_t begin, size_t end) {
+      assignOrAdd(accumulate(outputs[1]), GX.middleRows(begin, end - begin).noalias(),
+                  GO.middleRows(begin, end - begin) * W.transpose());
+    });
   }
   if (outputs[2].attr_ != nullptr) {
     auto GB = eigen::cast<Vector>(outputs[2]);
-    GB = GO.colwise().sum();
+    assignOrAdd(accumulate(outputs[2]), GB, GO.colwise().sum().transpose());
   }
 }
 
 static void FCGradShapeImpl(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
   auto X = inputs[0];
   auto W = inputs[1];
-  outputs[0]->dims_ = W->dims_;
+  if (X->type_ == graph::kCSR_FLOAT32) {
+    outputs[0]->dims_ = {X->maxNnz_, W->dims_[1]};
+    outputs[3]->dims_ = {X->maxNnz_, 1};
+  } else {
+    outputs[0]->dims_ = W->dims_;
+  }
   if (outputs[1]) {
     outputs[1]->dims_ = X->dims_;
   }
@@ -50,29 +202,76 @@ static void FCGradShapeImpl(const SmallVec<VariableAttrPtr> &inputs, const Small
   }
 }
 
+// elements of X multiplied by each column of W, at most the non-zeros of a sparse X.
+static double numMultiplies(const VariableAttrPtr &X) {
+  return X->type_ == graph::kCSR_FLOAT32 ? X->maxNnz_ : X->dims_[0] * X->dims_[1];
+}
+
+static graph::OpCost FCCost(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
+  auto cost = OpMeta::defaultCost(inputs, outputs);
+  double M = inputs[0]->dims_[0], N = inputs[1]->dims_[1];
+  cost.flops_ = 2 * numMultiplies(inputs[0]) * N + (inputs[2] ? M * N : 0);
+  return cost;
+}
+
+static graph::OpCost FCGradCost(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
+  auto cost = OpMeta::defaultCost(inputs, outputs);
+  double M = inputs[0]->dims_[0], N = inputs[1]->dims_[1];
+  cost.flops_ = 2 * numMultiplies(inputs[0]) * N * (outputs[1] ? 2 : 1) + (outputs[2] ? M * N : 0);
+  return cost;
+}
+
 static SmallVec<graph::Op> GetFCGradImpl(const SmallVec<VariableAttrPtr> &I, const SmallVec<VariableAttrPtr> &O,
                                          const SmallVec<VariableAttrPtr> &OG, const SmallVec<VariableAttrPtr> &IG) {
   graph::Op op;
   op.type_ = "fc_grad";
   op.inputs_ = {I[0], I[1], OG[0]};
   op.outputs_ = {IG[1], IG[0], IG[2]};
+  if (IG[1] != nullptr && !IG[1]->sparseRows_.empty()) {
+    SmallVec<size_t> dims = {IG[1]->dims_[0], 1};
+    op.outputs_.push_back(std::make_shared<graph::VariableAttr>(IG[1]->sparseRows_, dims, graph::kINT32, false));
+  }
   return {op};
 }
 
+// A sparse input has no gradient, and the gradient of W only has a row per non-zero column of it.
+static void FCGradVars(const SmallVec<VariableAttrPtr> &I, const SmallVec<VariableAttrPtr> &O,
+                       SmallVec<VariableAttrPtr> *OG, SmallVec<VariableAttrPtr> *IG) {
+  graph::OpMeta().gradVars_(I, O, OG, IG);
+  if (I[0]->type_ != graph::kCSR_FLOAT32) {
+    return;
+  }
+  (*IG)[0] = nullptr;
+  auto &weightGrad = (*IG)[1];
+  if (weightGrad != nullptr) {
+    weightGrad->dims_ = {I[0]->maxNnz_, I[1]->dims_[1]};
+    weightGrad->sparseRows_ = weightGrad->name_ + ".rows";
+  }
+}
+
+static bool isDense(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
+  return inputs[0]->type_ != graph::kCSR_FLOAT32;
+}
+
 static InitFunction init([] {
   {
     graph::OpMeta meta;
     meta.type_ = "fc";
     meta.kernels[graph::kDEVICE_CPU] = FCOpImpl;
+    meta.cpuVariants_.push_back({"eigen", FCEigenOpImpl, isDense});
     meta.shapeInferer_ = FCOpShape;
     meta.grad_ = GetFCGradImpl;
+    meta.gradVars_ = FCGradVars;
+    meta.cost_ = FCCost;
     graph::OpMeta::gAllOpMeta_[meta.type_] = meta;
   }
   {
     graph::OpMeta meta;
     meta.type_ = "fc_grad";
     meta.kernels[graph::kDEVICE_CPU] = FCGradOpImpl;
+    meta.cpuVariants_.push_back({"eigen", FCGradEigenOpImpl, isDense});
     meta.shapeInferer_ = FCGradShapeImpl;
+    meta.cost_ = FCGradCost;
     graph::OpMeta::gAllOpMeta_[meta.type_] = meta;
   }
 });
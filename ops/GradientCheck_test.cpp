@@ -26,7 +26,8 @@ static void randomizeProb(const nnet::graph::Variable& t) {
   float* buf = (float*)t.buffer_->get();
   std::random_device dev;
   std::mt19937 engine(dev());
-  std::uniform_real_distribution<float> dist(0.0f, 2.0f);
+  // bounded away from 0, the numeric gradient of log(p) is NaN when p is closer to 0 than epsilon.
+  std::uniform_real_distribution<float> dist(0.05f, 2.0f);
   for (size_t r = 0; r < t.attr_->dims_[0]; ++r) {
     float rowSum = 0.0;
     for (size_t c = 0; c < t.attr_->dims_[1]; ++c) {
@@ -122,6 +123,57 @@ TEST_CASE("GradientCheck", "check_all") {
       []
     ],
     "output": ["output", [100, 10], true, "f", false]
+  },
+  {
+    "type": "fc",
+    "inputs": [
+      ["x.param", [10, 10], true, "f", true],
+      ["x.param", [10, 10], true, "f", true],
+      []
+    ],
+    "output": ["output", [10, 10], true, "f", false]
+  },
+  {
+    "type": "fc_bias_act",
+    "inputs": [
+      ["input", [20, 10], false, "f", false],
+      ["fc.param", [10, 5], true, "f", true],
+      ["fc.bias", [1, 5], true, "f", false]
+    ],
+    "output": ["output", [20, 5], true, "f", false]
+  },
+  {
+    "type": "fc_bias_act",
+    "inputs": [
+      ["input", [20, 10], true, "f", true],
+      ["fc.param", [10, 5], true, "f", false],
+      ["fc.bias", [1, 5], true, "f", false]
+    ],
+    "output": ["output", [20, 5], true, "f", false]
+  },
+  {
+    "type": "fc_bias_act",
+    "inputs": [
+      ["input", [20, 10], false, "f", false],
+      ["fc.param", [10, 5], true, "f", false],
+      ["fc.bias", [1, 5], true, "f", true]
+    ],
+    "output": ["output", [20, 5], true, "f", false]
+  },
+  {
+    "type": "softmax_cross_entropy",
+    "inputs": [
+      ["input", [20, 10], true, "f", true],
+      ["label", [20, 1], false, "i", false, {
+        "max_value": 9,
+        "min_value": 0
+      }]
+    ],
+    "outputs": [
+      ["prob", [20, 10], false, "f", false],
+      ["output", [20, 1], true, "f", false]
+    ],
+    "mean_of": 1
   }
 ]
 )"_json;
@@ -164,10 +216,19 @@ TEST_CASE("GradientCheck", "check_all") {
       }
     }
     REQUIRE(gcPoint != -1UL);
-    nnet::graph::VariableAttrPtr output = toAttr(&graph, metaInfo["output"]);
+    nnet::SmallVec<nnet::graph::VariableAttrPtr> outputs;
+    if (metaInfo.find("outputs") != metaInfo.end()) {
+      for (nlohmann::json& eachOutput : metaInfo["outputs"]) {
+        outputs.push_back(toAttr(&graph, eachOutput));
+      }
+    } else {
+      outputs.push_back(toAttr(&graph, metaInfo["output"]));
+    }
+    nnet::graph::VariableAttrPtr output = outputs[metaInfo.value("mean_of", 0)];
     LOG(INFO) << "Gradient check op " << opType << ", input index=" << gcPoint;
     auto gcTensor = workspace.getVar(input[gcPoint]);
-    graph.ops_.push_back(nnet::graph::Op(opType, input, {output}));
+    graph.ops_.push_back(nnet::graph::Op(opType, input, outputs));
+    nnet::graph::OpMeta::gAllOpMeta_.at(opType).checkAttrs(&graph.ops_.back().attrs_);
     auto meanOut = graph.createOrResizeVar("mean", {1, 1}, true, nnet::graph::kFLOAT32);
     graph.ops_.push_back(nnet::graph::Op("mean", {output}, {meanOut}));
     nnet::eigen::Matrix wGrad(gcTensor.attr_->dims_[0], gcTensor.attr_->dims_[1]);
@@ -196,6 +257,12 @@ TEST_CASE("GradientCheck", "check_all") {
       nnet::graph::compileGraph(&graph, {"backward"}, attrs);
       nnet::engine::NaiveEngine engine(workspace, graph);
       engine.resetOrCreateGradient();
+      // gradients with a single writer are not zeroed, their kernels must overwrite whatever is in them.
+      for (auto& var : graph.variables_) {
+        if (!var.second->accumulateGrad_ && !var.second->specialResetFunction_) {
+          nnet::eigen::cast<nnet::eigen::Vector>(workspace.getVar(var.second)).setConstant(12345.f);
+        }
+      }
       auto wg = workspace.getVar(graph.variables_.at(gcTensor.attr_->name_ + ".grad"));
       auto mWG = nnet::eigen::cast<nnet::eigen::Matrix>(wg);
       engine.run();
@@ -1,9 +1,9 @@
 #include "EigenOp-inl.h"
+#include <numeric>
 
 namespace nnet {
 namespace eigen_ops {
-static void lookupTable(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs,
-                        const Map<std::string, Any> &attrs) {
+static void lookupTable(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
   auto WORD = cast<IVector>(inputs[0]).array();
   auto WEIGHT = cast<Matrix>(inputs[1]).array();
   auto O = cast<Matrix>(outputs[0]).array();
@@ -22,29 +22,69 @@ static void fwdShape(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<Var
   O->dims_ = {details::product(WORD->dims_), WEIGHT->dims_[1]};
 }
 
-static void lookupTableGrad(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs,
-                            const Map<std::string, Any> &attrs) {
-  auto OG = cast<Matrix>(inputs[0]).array();
-  auto WG = cast<Matrix>(outputs[0]).array();
-  WG = OG;
+// only the looked up rows of the table are read.
+static graph::OpCost lookupTableCost(const SmallVec<VariableAttrPtr> &inputs,
+                                     const SmallVec<VariableAttrPtr> &outputs) {
+  graph::OpCost cost;
+  double n = details::product(outputs[0]->dims_);
+  cost.bytes_ = (details::product(inputs[0]->dims_) + 2 * n) * sizeof(float);
+  return cost;
+}
 
-  int *JA = (int *)outputs[2].buffer_->get();
-  int *IA = (int *)outputs[1].buffer_->get();
-  *IA = 0;
-  ++IA;
-  for (size_t i = 0; i < inputs[0].attr_->dims_[0]; ++i, ++IA) {
-    *IA = (int)((i + 1) * outputs[0].attr_->dims_[1]);
-    for (int j = 0; j < outputs[0].attr_->dims_[1]; ++j) {
-      JA[j] = j;
+/**
+ * The gradient of the table is row-sparse: one row per distinct word of the batch, in ascending order of word, and
+ * the word of each row in the rows variable. The gradients of repeated words are summed, and the unused rows are
+ * marked by -1. Optimizers update only these rows, the table is never touched as a whole.
+ */
+static void lookupTableGrad(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  auto WORD = (const int *)inputs[0].buffer_->get();
+  auto OG = cast<Matrix>(inputs[1]);
+  auto WG = cast<Matrix>(outputs[0]);
+  auto ROWS = (int *)outputs[1].buffer_->get();
+  size_t numWords = OG.rows();
+  static thread_local Vec<size_t> gOrder;
+  gOrder.resize(numWords);
+  std::iota(gOrder.begin(), gOrder.end(), 0);
+  std::stable_sort(gOrder.begin(), gOrder.end(), [WORD](size_t a, size_t b) { return WORD[a] < WORD[b]; });
+  size_t numRows = 0;
+  for (auto pos : gOrder) {
+    if (numRows != 0 && ROWS[numRows - 1] == WORD[pos]) {
+      WG.row(numRows - 1) += OG.row(pos);
+    } else {
+      ROWS[numRows] = WORD[pos];
+      WG.row(numRows++) = OG.row(pos);
     }
-    JA += outputs[0].attr_->dims_[1];
   }
+  std::fill(ROWS + numRows, ROWS + numWords, -1);
 }
 
 static void lookupTableShape(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
-  outputs[0]->dims_ = inputs[0]->dims_;  // same dim float
-  outputs[1]->dims_ = {inputs[0]->dims_[0] + 1, 1UL};
-  outputs[2]->dims_ = {inputs[0]->dims_[0] * inputs[0]->dims_[1], 1UL};
+  CHECK_EQ(inputs[0]->type_, graph::kINT32);
+  CHECK_EQ(details::product(inputs[0]->dims_), inputs[1]->dims_[0]);
+  outputs[0]->dims_ = inputs[1]->dims_;
+  outputs[1]->dims_ = {inputs[1]->dims_[0], 1UL};
+}
+
+static SmallVec<Op> GetLookupTableGrad(const SmallVec<VariableAttrPtr> &I, const SmallVec<VariableAttrPtr> &O,
+                                       const SmallVec<VariableAttrPtr> &OG, const SmallVec<VariableAttrPtr> &IG) {
+  if (IG[1] == nullptr) {
+    return {};
+  }
+  auto rows = std::make_shared<graph::VariableAttr>(IG[1]->sparseRows_, SmallVec<size_t>{OG[0]->dims_[0], 1},
+                                                    graph::kINT32, false);
+  return {Op("lookup_table_grad", {I[0], OG[0]}, {IG[1], rows})};
+}
+
+// The words have no gradient, and the gradient of the table only has a row per word.
+static void lookupTableGradVars(const SmallVec<VariableAttrPtr> &I, const SmallVec<VariableAttrPtr> &O,
+                                SmallVec<VariableAttrPtr> *OG, SmallVec<VariableAttrPtr> *IG) {
+  OpMeta().gradVars_(I, O, OG, IG);
+  (*IG)[0] = nullptr;
+  auto &tableGrad = (*IG)[1];
+  if (tableGrad != nullptr) {
+    tableGrad->dims_ = {details::product(I[0]->dims_), I[1]->dims_[1]};
+    tableGrad->sparseRows_ = tableGrad->name_ + ".rows";
+  }
 }
 
 static util::InitFunction init([] {
@@ -53,6 +93,9 @@ static util::InitFunction init([] {
     meta.type_ = "lookup_table";
     meta.kernels[kDEVICE_CPU] = lookupTable;
     meta.shapeInferer_ = fwdShape;
+    meta.cost_ = lookupTableCost;
+    meta.grad_ = GetLookupTableGrad;
+    meta.gradVars_ = lookupTableGradVars;
     OpMeta::gAllOpMeta_[meta.type_] = meta;
   }
   {
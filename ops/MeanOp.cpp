@@ -3,18 +3,20 @@
 namespace nnet {
 namespace eigen_ops {
 
-static void MeanOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs,
-                       const Map<std::string, Any> &attrs) {
+static void MeanOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
   auto i = cast<Vector>(inputs[0]).array();
   *(float *)(outputs[0].buffer_->get()) = i.mean();
 }
 
-static void MeanGradImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs,
-                         const Map<std::string, Any> &attrs) {
+static void MeanGradImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
   auto og = cast<Vector>(inputs[1]).array();   // output grad_;
   auto ig = cast<Vector>(outputs[0]).array();  // input grad_;
   float g = *og.data() / ig.size();
-  ig = g;
+  if (accumulate(outputs[0])) {
+    ig += g;
+  } else {
+    ig = g;
+  }
 }
 
 static void MeanGradShapeImpl(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
@@ -51,6 +53,7 @@ static util::InitFunction init([] {
     gradMeta.type_ = "mean_grad";
     gradMeta.kernels[kDEVICE_CPU] = MeanGradImpl;
     gradMeta.shapeInferer_ = MeanGradShapeImpl;
+    gradMeta.inplace_ = {{0, 0}};
 
     OpMeta::gAllOpMeta_[gradMeta.type_] = gradMeta;
   }
@@ -0,0 +1,86 @@
+#include "EigenOp-inl.h"
+
+namespace nnet {
+namespace eigen_ops {
+
+struct MomentumAttrs {
+  float learningRate_;
+  float momentum_;
+};
+
+/**
+ * momentum keeps a velocity per parameter: V = momentum * V + G, W -= learning_rate * V. The inputs are
+ * {params, grads, velocities}, the outputs {params, velocities}.
+ */
+static void MomentumOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  size_t n = inputs.size() - outputs.size();
+  float learning_rate = attrs.get<MomentumAttrs>().learningRate_;
+  float momentum = attrs.get<MomentumAttrs>().momentum_;
+  multiTensorFor({&outputs[0], &inputs[n], &outputs[n]}, n, rowGrain(4), [&](size_t t, size_t begin, size_t end) {
+    auto W = segment(outputs[t], begin, end).array();
+    auto G = segment(inputs[n + t], begin, end).array();
+    auto V = segment(outputs[n + t], begin, end).array();
+    V = momentum * V + G;
+    W -= learning_rate * V;
+  });
+}
+
+/**
+ * sparse_momentum is momentum for a row-sparse gradient, the inputs are {param, grad, rows, velocity}. The velocity
+ * of a row only decays when the row is in the gradient, like the lazy Adam of TensorFlow.
+ */
+static void SparseMomentumOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  auto W = cast<Matrix>(outputs[0]);
+  auto G = cast<Matrix>(inputs[1]);
+  auto rows = (const int *)inputs[2].buffer_->get();
+  auto V = cast<Matrix>(outputs[1]);
+  float learning_rate = attrs.get<MomentumAttrs>().learningRate_;
+  float momentum = attrs.get<MomentumAttrs>().momentum_;
+  parallelFor(numSparseRows(inputs[2]), rowGrain(G.cols() * 4), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      V.row(rows[i]) = momentum * V.row(rows[i]) + G.row(i);
+      W.row(rows[i]) -= learning_rate * V.row(rows[i]);
+    }
+  });
+}
+
+static void SparseMomentumShapeImpl(const SmallVec<VariableAttrPtr> &inputs,
+                                    const SmallVec<VariableAttrPtr> &outputs) {
+  CHECK_EQ(inputs[1]->dims_[1], inputs[0]->dims_[1]);
+  CHECK_EQ(inputs[2]->dims_[0], inputs[1]->dims_[0]);
+  checkUpdatedInPlace(inputs, outputs, 1, 2);  // the grad and its rows
+  CHECK_EQ(inputs[3]->dims_, inputs[0]->dims_);
+  outputs[0]->dims_ = inputs[0]->dims_;
+  outputs[1]->dims_ = inputs[0]->dims_;
+}
+
+static graph::OpCost MomentumCost(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
+  return optimizerCost(inputs, outputs, 4, 5);
+}
+
+static graph::OpCost SparseMomentumCost(const SmallVec<VariableAttrPtr> &inputs,
+                                        const SmallVec<VariableAttrPtr> &outputs) {
+  graph::OpCost cost;
+  double n = details::product(inputs[1]->dims_);
+  cost.flops_ = 4 * n;
+  cost.bytes_ = 5 * n * sizeof(float);
+  return cost;
+}
+
+static InitFunction init([] {
+  for (auto sparse : {false, true}) {
+    OpMeta meta;
+    meta.type_ = sparse ? "sparse_momentum" : "momentum";
+    meta.kernels[kDEVICE_CPU] = sparse ? SparseMomentumOpImpl : MomentumOpImpl;
+    meta.shapeInferer_ = sparse ? SparseMomentumShapeImpl : optimizerShape;
+    meta.cost_ = sparse ? SparseMomentumCost : MomentumCost;
+    meta.setAttrs<MomentumAttrs>();
+    meta.attrMeta_.push_back(AttributeMeta::create<float>("learning_rate", "LR for momentum"));
+    meta.attrMeta_.back()->bind(&MomentumAttrs::learningRate_).constraints<float>().defaultValue(0.0001);
+    meta.attrMeta_.push_back(AttributeMeta::create<float>("momentum", "decay of the velocity"));
+    meta.attrMeta_.back()->bind(&MomentumAttrs::momentum_).constraints<float>().defaultValue(0.9);
+    OpMeta::gAllOpMeta_[meta.type_] = meta;
+  }
+});
+}
+}
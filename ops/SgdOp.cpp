@@ -3,30 +3,78 @@
 namespace nnet {
 namespace eigen_ops {
 
-static void SgdOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs,
-                      const Map<std::string, Any> &attrs) {
-  auto V = cast<Vector>(inputs[0]).array();
-  auto G = cast<Vector>(inputs[1]).array();
-  auto Target = cast<Vector>(outputs[0]).array();
-  float learning_rate = any_cast<float>(attrs.at("learning_rate"));
-  Target = V - learning_rate * G;
+struct SgdAttrs {
+  float learningRate_;
+};
+
+// sgd updates each parameter by W -= learning_rate * G, the inputs are {params, grads}, the outputs {params}.
+static void SgdOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  size_t n = outputs.size();
+  float learning_rate = attrs.get<SgdAttrs>().learningRate_;
+  multiTensorFor({&outputs[0], &inputs[n]}, n, rowGrain(2), [&](size_t t, size_t begin, size_t end) {
+    auto W = segment(outputs[t], begin, end).array();
+    auto G = segment(inputs[n + t], begin, end).array();
+    W -= learning_rate * G;
+  });
+}
+
+static graph::OpCost SgdCost(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
+  return optimizerCost(inputs, outputs, 2, 3);
 }
 
-static void SgdShapeImpl(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
+// sparse_sgd updates the rows of the parameter listed in a row-sparse gradient, the inputs are {param, grad, rows}.
+static void SparseSgdOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  auto W = cast<Matrix>(outputs[0]);
+  auto G = cast<Matrix>(inputs[1]);
+  auto rows = (const int *)inputs[2].buffer_->get();
+  float learning_rate = attrs.get<SgdAttrs>().learningRate_;
+  parallelFor(numSparseRows(inputs[2]), rowGrain(G.cols() * 2), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      W.row(rows[i]) -= learning_rate * G.row(i);
+    }
+  });
+}
+
+static void SparseSgdShapeImpl(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
+  CHECK_EQ(inputs[1]->dims_[1], inputs[0]->dims_[1]);
+  CHECK_EQ(inputs[2]->dims_[0], inputs[1]->dims_[0]);
+  checkUpdatedInPlace(inputs, outputs, 1, 2);  // the grad and its rows
   outputs[0]->dims_ = inputs[0]->dims_;
 }
 
+// only the listed rows of the parameter are read and written.
+static graph::OpCost SparseSgdCost(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
+  graph::OpCost cost;
+  double n = details::product(inputs[1]->dims_);
+  cost.flops_ = 2 * n;
+  cost.bytes_ = 3 * n * sizeof(float) + inputs[1]->dims_[0] * sizeof(int);
+  return cost;
+}
+
 static util::InitFunction init([] {
   {
     OpMeta meta;
     meta.type_ = "sgd";
     meta.kernels[kDEVICE_CPU] = SgdOpImpl;
-    meta.shapeInferer_ = SgdShapeImpl;
+    meta.shapeInferer_ = optimizerShape;
+    meta.cost_ = SgdCost;
+    meta.setAttrs<SgdAttrs>();
     meta.attrMeta_.push_back(AttributeMeta::create<float>("learning_rate", "LR for sgd"));
     auto &attrMeta = meta.attrMeta_.back();
-    attrMeta->constraints<float>().defaultValue(0.0001);
+    attrMeta->bind(&SgdAttrs::learningRate_).constraints<float>().defaultValue(0.0001);
+    OpMeta::gAllOpMeta_[meta.type_] = meta;
+  }
+  {
+    OpMeta meta;
+    meta.type_ = "sparse_sgd";
+    meta.kernels[kDEVICE_CPU] = SparseSgdOpImpl;
+    meta.shapeInferer_ = SparseSgdShapeImpl;
+    meta.cost_ = SparseSgdCost;
+    meta.setAttrs<SgdAttrs>();
+    meta.attrMeta_.push_back(AttributeMeta::create<float>("learning_rate", "LR for sgd"));
+    meta.attrMeta_.back()->bind(&SgdAttrs::learningRate_).constraints<float>().defaultValue(0.0001);
     OpMeta::gAllOpMeta_[meta.type_] = meta;
   }
 });
 }
-}
\ No newline at end of file
+}
@@ -1,20 +1,26 @@
 #include "EigenOp-inl.h"
 namespace nnet {
 namespace eigen_ops {
-static void sigmoidOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs,
-                          const Map<std::string, Any> &attrs) {
+static void sigmoidOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  auto a = cast<Vector>(inputs[0]);
+  auto o = cast<Vector>(outputs[0]);
+  parallelFor(a.size(), 1UL << 12, [&](size_t begin, size_t end) {
+    util::vecTanh(a.data() + begin, o.data() + begin, end - begin);
+  });
+}
+
+// sigmoid by Eigen's scalar tanh, a variant for the autotuner.
+static void sigmoidEigenOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
   auto a = cast<Vector>(inputs[0]).array();
-  auto o = cast<Vector>((outputs[0])).array();
+  auto o = cast<Vector>(outputs[0]).array();
   o = tanh(a);
 }
 
-static void sigmoidOpGrad(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs,
-                          const Map<std::string, Any> &attrs) {
+static void sigmoidOpGrad(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
   auto O = cast<Vector>(inputs[0]).array();
   auto OG = cast<Vector>(inputs[1]).array();
   auto IG = cast<Vector>(outputs[0]).array();
-  IG = OG;
-  IG *= 1 - O * O;
+  assignOrAdd(accumulate(outputs[0]), IG, OG * (1 - O * O));
 }
 
 static void sigmoidOpGradShape(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
@@ -39,8 +45,10 @@ static util::InitFunction __init__([] {
     OpMeta meta;
     meta.type_ = "sigmoid";
     meta.kernels[kDEVICE_CPU] = sigmoidOpImpl;
+    meta.cpuVariants_.push_back({"eigen", sigmoidEigenOpImpl, nullptr});
     meta.shapeInferer_ = sigmoidShapeImpl;
     meta.grad_ = GetSigmoidGradImpl;
+    meta.inplace_ = {{0, 0}};
     OpMeta::gAllOpMeta_[meta.type_] = meta;
   }
   {
@@ -48,6 +56,7 @@ static util::InitFunction __init__([] {
     meta.type_ = "sigmoid_grad";
     meta.kernels[kDEVICE_CPU] = sigmoidOpGrad;
     meta.shapeInferer_ = sigmoidOpGradShape;
+    meta.inplace_ = {{1, 0}};  // IG overwrites OG, O is read after IG is written
     OpMeta::gAllOpMeta_[meta.type_] = meta;
   }
 });
@@ -0,0 +1,112 @@
+#include "EigenOp-inl.h"
+
+namespace nnet {
+namespace eigen_ops {
+
+/**
+ * softmax_cross_entropy is softmax followed by cross_entropy, created by the fuse stage. Inputs are the logits X and
+ * the labels, outputs are the probabilities P and the loss of each sample.
+ *
+ * It is numerically stable: the loss is log(sum(exp(x - max))) + max - x[label], it never takes the log of a
+ * probability. Its gradient is simply (P - onehot(label)) * GO.
+ */
+static void softmaxXEOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  auto X = cast<Matrix>(inputs[0]);
+  auto L = (const int *)inputs[1].buffer_->get();
+  auto P = cast<Matrix>(outputs[0]);
+  auto loss = (float *)outputs[1].buffer_->get();
+  size_t numClasses = X.cols();
+  parallelFor(X.rows(), rowGrain(X.cols() * 20), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      CHECK_LT(L[i], numClasses) << "Feature size = " << numClasses << ", but user given label is " << L[i];
+      float max = X.row(i).maxCoeff();
+      loss[i] = max - X(i, L[i]);  // P may share the buffer of X
+      P.row(i).array() = X.row(i).array() - max;
+    }
+    util::vecExp(P.row(begin).data(), P.row(begin).data(), (end - begin) * numClasses);  // the rows at once
+    for (size_t i = begin; i < end; ++i) {
+      float sum = P.row(i).sum();
+      P.row(i) /= sum;
+      loss[i] += std::log(sum);
+    }
+  });
+}
+
+// softmax_cross_entropy by Eigen's scalar exp, row by row, a variant for the autotuner.
+static void softmaxXEEigenOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs,
+                                 const OpAttrs &attrs) {
+  auto X = cast<Matrix>(inputs[0]);
+  auto L = (const int *)inputs[1].buffer_->get();
+  auto P = cast<Matrix>(outputs[0]);
+  auto loss = (float *)outputs[1].buffer_->get();
+  size_t numClasses = X.cols();
+  parallelFor(X.rows(), rowGrain(X.cols() * 20), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      CHECK_LT(L[i], numClasses) << "Feature size = " << numClasses << ", but user given label is " << L[i];
+      float max = X.row(i).maxCoeff();
+      loss[i] = max - X(i, L[i]);  // P may share the buffer of X
+      P.row(i).array() = (X.row(i).array() - max).exp();
+      float sum = P.row(i).sum();
+      P.row(i) /= sum;
+      loss[i] += std::log(sum);
+    }
+  });
+}
+
+static void softmaxXEShapeImpl(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
+  CHECK_EQ(inputs[0]->dims_[0], inputs[1]->dims_[0]);
+  CHECK_EQ(inputs[1]->type_, graph::kINT32);
+  outputs[0]->dims_ = inputs[0]->dims_;
+  outputs[1]->dims_ = {inputs[0]->dims_[0], 1};
+}
+
+static void softmaxXEGradImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  auto P = cast<Matrix>(inputs[0]);
+  auto L = (const int *)inputs[1].buffer_->get();
+  auto GO = cast<Vector>(inputs[2]);
+  auto GX = cast<Matrix>(outputs[0]);
+  parallelFor(P.rows(), rowGrain(P.cols() * 2), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      assignOrAdd(accumulate(outputs[0]), GX.row(i), P.row(i) * GO[i]);
+      GX(i, L[i]) -= GO[i];
+    }
+  });
+}
+
+static void softmaxXEGradShapeImpl(const SmallVec<VariableAttrPtr> &inputs,
+                                   const SmallVec<VariableAttrPtr> &outputs) {
+  CHECK_EQ(inputs[0]->dims_[0], details::product(inputs[2]->dims_));
+  outputs[0]->dims_ = inputs[0]->dims_;
+}
+
+static SmallVec<Op> GetSoftmaxXEGradOp(const SmallVec<VariableAttrPtr> &I, const SmallVec<VariableAttrPtr> &O,
+                                       const SmallVec<VariableAttrPtr> &OG, const SmallVec<VariableAttrPtr> &IG) {
+  // the gradient of P is not propagated, the fuse stage only fuses when no op needs it.
+  Op op;
+  op.type_ = "softmax_cross_entropy_grad";
+  op.inputs_ = {O[0], I[1], OG[1]};
+  op.outputs_ = {IG[0]};
+  return {op};
+}
+
+static InitFunction init([] {
+  {
+    OpMeta meta;
+    meta.type_ = "softmax_cross_entropy";
+    meta.kernels[kDEVICE_CPU] = softmaxXEOpImpl;
+    meta.cpuVariants_.push_back({"eigen", softmaxXEEigenOpImpl, nullptr});
+    meta.shapeInferer_ = softmaxXEShapeImpl;
+    meta.grad_ = GetSoftmaxXEGradOp;
+    OpMeta::gAllOpMeta_[meta.type_] = meta;
+  }
+  {
+    OpMeta meta;
+    meta.type_ = "softmax_cross_entropy_grad";
+    meta.kernels[kDEVICE_CPU] = softmaxXEGradImpl;
+    meta.shapeInferer_ = softmaxXEGradShapeImpl;
+    meta.inplace_ = {{0, 0}};
+    OpMeta::gAllOpMeta_[meta.type_] = meta;
+  }
+});
+}
+}
@@ -3,30 +3,43 @@
 namespace nnet {
 namespace eigen_ops {
 
-static void softmaxOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs,
-                          const Map<std::string, Any> &attrs) {
+static void softmaxOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
+  auto X = cast<Matrix>(inputs[0]);
+  auto P = cast<Matrix>(outputs[0]);
+
+  parallelFor(X.rows(), rowGrain(X.cols() * 20), [&](size_t begin, size_t end) {
+    util::vecExp(X.row(begin).data(), P.row(begin).data(), (end - begin) * X.cols());
+    auto p = P.middleRows(begin, end - begin).array();
+    p.colwise() /= p.rowwise().sum();
+  });
+}
+
+// softmax by Eigen's scalar exp, a variant for the autotuner.
+static void softmaxEigenOpImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
   auto X = cast<Matrix>(inputs[0]).array();
   auto P = cast<Matrix>(outputs[0]).array();
 
-  P = X.exp();
-  P.colwise() /= P.rowwise().sum();
+  parallelFor(X.rows(), rowGrain(X.cols() * 20), [&](size_t begin, size_t end) {
+    auto p = P.middleRows(begin, end - begin);
+    p = X.middleRows(begin, end - begin).exp();
+    p.colwise() /= p.rowwise().sum();
+  });
 }
 
 static void softmaxShapeImpl(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
   outputs[0]->dims_ = inputs[0]->dims_;
 }
 
-static void softmaxGradImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs,
-                            const Map<std::string, Any> &attrs) {
+static void softmaxGradImpl(const SmallVec<Variable> &inputs, SmallVec<Variable> &outputs, const OpAttrs &attrs) {
   auto Y = cast<Matrix>(inputs[0]);
   auto DY = cast<Matrix>(inputs[1]);
   auto DX = cast<Matrix>(outputs[0]);
-  DX.array() = DY.array();
-  for (size_t i = 0; i < inputs[0].attr_->dims_[0]; ++i) {
-    float dot = Y.row(i).dot(DY.row(i));
-    DX.row(i).array() -= dot;
-  }
-  DX.array() *= Y.array();
+  parallelFor(Y.rows(), rowGrain(Y.cols() * 4), [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      float dot = Y.row(i).dot(DY.row(i));  // DX may share the buffer of DY, take the dot first
+      assignOrAdd(accumulate(outputs[0]), DX.row(i).array(), (DY.row(i).array() - dot) * Y.row(i).array());
+    }
+  });
 }
 static void softmaxGradShapeImpl(const SmallVec<VariableAttrPtr> &inputs, const SmallVec<VariableAttrPtr> &outputs) {
   auto P = inputs[0];
@@ -51,8 +64,10 @@ static util::InitFunction init([] {
     OpMeta meta;
     meta.type_ = "softmax";
     meta.kernels[kDEVICE_CPU] = softmaxOpImpl;
+    meta.cpuVariants_.push_back({"eigen", softmaxEigenOpImpl, nullptr});
     meta.shapeInferer_ = softmaxShapeImpl;
     meta.grad_ = GetSoftmaxGradOp;
+    meta.inplace_ = {{0, 0}};
     OpMeta::gAllOpMeta_[meta.type_] = meta;
   }
   {
@@ -60,6 +75,7 @@ static util::InitFunction init([] {
     meta.type_ = "softmax_grad";
     meta.kernels[kDEVICE_CPU] = softmaxGradImpl;
     meta.shapeInferer_ = softmaxGradShapeImpl;
+    meta.inplace_ = {{1, 0}};  // each row of DY is read before the same row of DX is written
     OpMeta::gAllOpMeta_[meta.type_] = meta;
   }
 });